@@ -6,27 +6,16 @@ void echo_handler(HTTP_Response *resp, HTTP_Request *req) {
     http_response_set_content_length(resp, req->content_length);
     http_response_send(resp, HTTP_Status_OK);
 
-    HTTP_Err err;
-    while (true) {
-        char chunk[20] = {0};
-        err = http_request_read_body_chunk(req, chunk, 20);
-        if (err != HTTP_ERR_CONT) {
-            if (err != HTTP_ERR_OK) {
-                http_response_send(resp, HTTP_Status_INTERNAL_SERVER_ERROR);
-                printf("ERROR: Failed to read body chunk: %s\n", http_err_to_cstr(err));
-                return;
-            }
-            break;
-        }
-        
-        err = http_response_write_body_chunk(resp, chunk, 20);
+    char chunk[64*1<<10];
+    ssize_t n;
+    while ((n = http_request_read_body(req, chunk, sizeof(chunk))) > 0) {
+        HTTP_Err err = http_response_write_body_chunk(resp, chunk, n);
         if (err != HTTP_ERR_OK) {
-            http_response_send(resp, HTTP_Status_INTERNAL_SERVER_ERROR);
             printf("ERROR: Failed to write body chunk: %s\n", http_err_to_cstr(err));
             return;
         }
     }
-
+    if (n < 0) printf("ERROR: Failed to read body: %s\n", http_err_to_cstr(n));
 }
 
 int main(void) {
@@ -0,0 +1,128 @@
+// Measures memory, that the server holds per idle keep-alive connection.
+//
+// The server forks a client, that opens N connections, sends a request on
+// each of them and keeps them open, then asks the server for its stats and
+// stops it:
+//
+//     $ cc -o idle_conns examples/idle_conns.c && ./idle_conns 1000
+#define _GNU_SOURCE
+#define HTTP_IMPL
+#include "../http.h"
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define ADDR "127.0.0.1"
+#define PORT 8081
+
+static HTTP_Server s = {0};
+
+void hello_handler(HTTP_Response *resp, HTTP_Request *req) {
+    HTTP_UNUSED(req);
+    http_response_set_content_length(resp, 3);
+    http_response_send(resp, HTTP_Status_OK);
+    http_response_write_body_chunk(resp, "ok\n", 3);
+}
+
+void stats_handler(HTTP_Response *resp, HTTP_Request *req) {
+    HTTP_UNUSED(req);
+    HTTP_ServerStats st = http_server_stats(&s);
+    // The connection, that asks for the stats, holds a receive buffer
+    size_t held = st.conns_idle * st.idle_conn_sz + (st.pool.bufs_in_use - 1) * st.pool.buf_sz;
+
+    char body[512];
+    int n = snprintf(body, sizeof(body),
+                     "idle connections:          %zu\n"
+                     "state per idle connection: %zu bytes\n"
+                     "buffers held by idle ones: %zu\n"
+                     "pool reserved:             %zu bytes\n"
+                     "held per idle connection:  %zu bytes\n",
+                     st.conns_idle, st.idle_conn_sz, st.pool.bufs_in_use - 1, st.pool.reserved_sz,
+                     st.conns_idle ? held / st.conns_idle : 0);
+    http_response_set_content_length(resp, n);
+    http_response_send(resp, HTTP_Status_OK);
+    http_response_write_body_chunk(resp, body, n);
+}
+
+static int client_connect(void) {
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(PORT) };
+    inet_pton(AF_INET, ADDR, &sa.sin_addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) return -1;
+    return fd;
+}
+
+static bool client_get(int fd, const char *path, char *resp, size_t resp_sz) {
+    char req[128];
+    int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: " ADDR "\r\n\r\n", path);
+    if (write(fd, req, n) != n) return false;
+
+    // Head and body may come in separate segments
+    size_t len = 0;
+    char *body = NULL;
+    long content_length = 0;
+    while (body == NULL || len - (body - resp) < (size_t)content_length) {
+        ssize_t nread = read(fd, resp + len, resp_sz - 1 - len);
+        if (nread <= 0) return false;
+        len += nread;
+        resp[len] = '\0';
+        if (body == NULL && (body = strstr(resp, "\r\n\r\n")) != NULL) {
+            body += 4;
+            char *cl = strcasestr(resp, "Content-Length:");
+            if (cl) content_length = atol(cl + strlen("Content-Length:"));
+        }
+    }
+    return true;
+}
+
+static void run_client(int nconns) {
+    char resp[1024];
+    int *fds = malloc(nconns * sizeof(int));
+    for (int i = 0; i < nconns; i++) {
+        if ((fds[i] = client_connect()) == -1 || !client_get(fds[i], "/", resp, sizeof(resp))) {
+            fprintf(stderr, "ERROR: Connection %d failed\n", i);
+            exit(1);
+        }
+    }
+    // Let the server see the connections go idle
+    usleep(100*1000);
+
+    int fd = client_connect();
+    if (fd == -1 || !client_get(fd, "/stats", resp, sizeof(resp))) {
+        fprintf(stderr, "ERROR: Failed to get stats\n");
+        exit(1);
+    }
+    char *body = strstr(resp, "\r\n\r\n");
+    printf("%s", body ? body + 4 : resp);
+
+    close(fd);
+    for (int i = 0; i < nconns; i++) close(fds[i]);
+    free(fds);
+}
+
+int main(int argc, char **argv) {
+    HTTP_Err err;
+    int nconns = argc > 1 ? atoi(argv[1]) : 500;
+
+    if ((err = http_server_init(&s, ADDR ":8081"))) {
+        HTTP_ERROR("Failed to initialize server: %s", http_err_to_cstr(err));
+        return 1;
+    }
+    http_server_add_handler(&s, "/", hello_handler);
+    http_server_add_handler(&s, "/stats", stats_handler);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        run_client(nconns);
+        kill(getppid(), SIGINT);
+        return 0;
+    }
+
+    if ((err = http_server_run(&s))) HTTP_ERROR("Failed to run server: %s", http_err_to_cstr(err));
+    waitpid(pid, NULL, 0);
+    http_server_free(&s);
+    return 0;
+}
@@ -2,19 +2,42 @@
 #  define HTTP_H
 
 #  ifdef HTTP_IMPL
+#    define HTTP_ACCESSLOG_IMPL
+#    define HTTP_ARENA_IMPL
+#    define HTTP_CACHE_IMPL
+#    define HTTP_COMPRESS_IMPL
+#    define HTTP_DATE_IMPL
+#    define HTTP_ETAG_IMPL
+#    define HTTP_HEADERS_IMPL
+#    define HTTP_METRICS_IMPL
 #    define HTTP_PARSER_IMPL
+#    define HTTP_PERTHREAD_IMPL
+#    define HTTP_PHASE_IMPL
+#    define HTTP_POOL_IMPL
 #    define HTTP_REQRESP_IMPL
 #    define HTTP_SERVER_IMPL
 #    define HTTP_PATH_IMPL
 #    define HTTP_SOCK_IMPL
 #  endif
 
+#  include "include/accesslog.h"
+#  include "include/arena.h"
+#  include "include/cache.h"
+#  include "include/clock.h"
 #  include "include/common.h"
+#  include "include/compress.h"
 #  include "include/da.h"
+#  include "include/date.h"
 #  include "include/err.h"
+#  include "include/etag.h"
+#  include "include/headers.h"
 #  include "include/log.h"
+#  include "include/metrics.h"
 #  include "include/parser.h"
 #  include "include/path.h"
+#  include "include/perthread.h"
+#  include "include/phase.h"
+#  include "include/pool.h"
 #  include "include/reqresp.h"
 #  include "include/server.h"
 #  include "include/socket.h"
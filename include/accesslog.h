@@ -0,0 +1,456 @@
+/*
+ * accesslog.h - Access log, that never blocks the requests it logs.
+ *
+ * Every thread, that serves requests, puts fixed-size records into its own
+ * ring, which has a single writer (the thread) and a single reader (the log
+ * thread), so logging takes neither locks nor syscalls. The log thread
+ * formats the records and writes them in batches, with a single writev()
+ * per batch:
+ *
+ * ```c
+ * HTTP_AccessLog log = {0};
+ * http_access_log_init(&log, STDOUT_FILENO, 1, HTTP_AccessLog_TEXT);
+ *
+ * HTTP_AccessRecord *r = http_access_log_reserve(&log);
+ * if (r) {
+ *     r->status = 200;
+ *     // ...
+ *     http_access_log_commit(&log, r);
+ * }
+ *
+ * http_access_log_free(&log);
+ * ```
+ *
+ * Records, that don't fit into a full ring, are dropped and counted, instead
+ * of waiting for the log thread. Busy servers may also log only every n-th
+ * request of a thread (see `sample` of HTTP_AccessLog).
+ *
+ * Records are written either as lines of text, or as Chrome trace events
+ * (HTTP_AccessLog_TRACE), that show the phases of each request (see
+ * HTTP_PHASE_MAP) and can be opened in a trace viewer (e.g. Perfetto).
+ */
+#ifndef HTTP_ACCESSLOG_H
+#  define HTTP_ACCESSLOG_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "err.h"
+#include "perthread.h"
+#include "phase.h"
+
+// Records a single thread may have unwritten at once (power of two)
+#ifndef HTTP_ACCESS_LOG_RING_SZ
+#  define HTTP_ACCESS_LOG_RING_SZ 1024
+#endif // HTTP_ACCESS_LOG_RING_SZ
+
+// Longer Request-URIs are truncated
+#ifndef HTTP_ACCESS_LOG_PATH_MAX
+#  define HTTP_ACCESS_LOG_PATH_MAX 192
+#endif // HTTP_ACCESS_LOG_PATH_MAX
+
+// Records written with a single writev()
+#ifndef HTTP_ACCESS_LOG_BATCH
+#  define HTTP_ACCESS_LOG_BATCH 64
+#endif // HTTP_ACCESS_LOG_BATCH
+
+// Records of trace events are written with, at most, this many events apart
+// from the request itself, so the phases must fit
+_Static_assert(HTTP_PHASES <= 16, "Too many phases to trace");
+
+// Milliseconds the log thread sleeps, once the rings are empty
+#ifndef HTTP_ACCESS_LOG_FLUSH_MS
+#  define HTTP_ACCESS_LOG_FLUSH_MS 20
+#endif // HTTP_ACCESS_LOG_FLUSH_MS
+
+_Static_assert((HTTP_ACCESS_LOG_RING_SZ & (HTTP_ACCESS_LOG_RING_SZ - 1)) == 0,
+               "HTTP_ACCESS_LOG_RING_SZ must be a power of two");
+
+typedef plex {
+    uint64_t time_ns;    // wall-clock time the request arrived (since the Epoch)
+    uint64_t latency_ns; // time it took to serve the request
+    uint64_t bytes_in, bytes_out;
+    uint16_t status;     // 0, if nothing was sent
+    uint16_t port;       // of the peer (host byte order)
+    uint8_t  family;     // of the peer address, AF_UNSPEC if unknown
+    uint8_t  addr[16];   // peer address (network byte order)
+    int      conn;       // connection, that the request was received on
+    uint64_t phases[HTTP_PHASES]; // see `phases` of HTTP_Request
+    char     method[8];  // empty, if the request line failed to parse
+    char     path[HTTP_ACCESS_LOG_PATH_MAX]; // Request-URI, NUL-terminated
+} HTTP_AccessRecord;
+
+typedef plex http_access_ring_s {
+    plex http_access_ring_s *next;
+    atomic_size_t head;   // written by the owner thread
+    char _pad0[64 - sizeof(atomic_size_t)];
+    atomic_size_t tail;   // written by the log thread
+    char _pad1[64 - sizeof(atomic_size_t)];
+    atomic_uint_fast64_t seen, dropped; // written by the owner thread
+    HTTP_AccessRecord records[HTTP_ACCESS_LOG_RING_SZ];
+} HTTP_AccessRing;
+
+typedef plex {
+    uint64_t written;   // records written to the log
+    uint64_t dropped;   // records lost to full rings or failed writes
+    uint64_t sampled;   // requests, that were sampled out
+} HTTP_AccessLogStats;
+
+typedef enum {
+    HTTP_AccessLog_TEXT,  // a line per request
+    HTTP_AccessLog_TRACE, // Chrome trace events in JSON Array Format
+} HTTP_AccessLogFormat;
+
+typedef plex {
+    int fd;          // file, that records are written to
+    uint32_t sample; // log every `sample`-th request of a thread, 0 and 1 log all
+    HTTP_AccessLogFormat format;
+
+    HTTP_PerThread _rings;  // HTTP_AccessRing of each thread
+    pthread_t _thread;
+    atomic_bool _stopping;
+    bool _started;
+    atomic_uint_fast64_t _written, _failed; // written by the log thread
+} HTTP_AccessLog;
+
+/**
+ * Initializes access log `log`, that writes to `fd` every `sample`-th
+ * request of each thread in format `format`, and starts its thread.
+ */
+HTTP_Err http_access_log_init(HTTP_AccessLog *log, int fd, uint32_t sample, HTTP_AccessLogFormat format);
+
+/**
+ * Returns record to be filled in by the calling thread, or NULL, if the
+ * request is sampled out, or the thread's ring is full (the record is
+ * counted as dropped then).
+ *
+ * NOTE: The record must be passed to http_access_log_commit(), before the
+ *       next one is reserved.
+ */
+HTTP_AccessRecord *http_access_log_reserve(HTTP_AccessLog *log);
+
+/**
+ * Hands record `r`, that was reserved by the calling thread, to the log
+ * thread.
+ */
+void http_access_log_commit(HTTP_AccessLog *log, HTTP_AccessRecord *r);
+
+/**
+ * Returns statistics of access log `log` of all threads.
+ */
+HTTP_AccessLogStats http_access_log_stats(HTTP_AccessLog *log);
+
+/**
+ * Writes the remaining records, stops the thread of access log `log` and
+ * frees the rings of all threads.
+ */
+void http_access_log_free(HTTP_AccessLog *log);
+
+#endif // HTTP_ACCESSLOG_H
+
+#ifdef HTTP_ACCESSLOG_IMPL
+#  ifndef HTTP_ACCESSLOG_IMPL_GUARD
+#    define HTTP_ACCESSLOG_IMPL_GUARD
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+
+// Every byte of the path may take 6 bytes, when it's escaped, and the trace
+// events of a request take up to 16 lines of ~128 bytes
+#define HTTP_ACCESS_LOG_LINE_MAX (6*HTTP_ACCESS_LOG_PATH_MAX + 16*128 + 256)
+
+HTTP_AccessRecord *http_access_log_reserve(HTTP_AccessLog *log) {
+    HTTP_AccessRing *ring = http_per_thread_get(&log->_rings);
+    if (ring == NULL) return NULL;
+    if (log->sample > 1) {
+        uint64_t seen = atomic_load_explicit(&ring->seen, memory_order_relaxed);
+        atomic_store_explicit(&ring->seen, seen + 1, memory_order_relaxed);
+        if (seen % log->sample != 0) return NULL;
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == HTTP_ACCESS_LOG_RING_SZ) {
+        // Single writer, so no read-modify-write is needed
+        atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return NULL;
+    }
+    HTTP_AccessRecord *r = &ring->records[head & (HTTP_ACCESS_LOG_RING_SZ - 1)];
+    memset(r, 0, offsetof(HTTP_AccessRecord, path) + 1);
+    r->conn = -1;
+    return r;
+}
+
+void http_access_log_commit(HTTP_AccessLog *log, HTTP_AccessRecord *r) {
+    HTTP_UNUSED(r);
+    HTTP_AccessRing *ring = pthread_getspecific(log->_rings.key);
+    HTTP_ASSERT(ring != NULL && "Record was not reserved by this thread");
+    // Publishes the record to the log thread
+    atomic_store_explicit(&ring->head, atomic_load_explicit(&ring->head, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+/**
+ * Appends `s` to `dest` at `pos`, escaping quotes, backslashes and bytes,
+ * that are not printable (as JSON does, if `json` is set), so the line can't
+ * be forged by the client.
+ */
+static size_t _access_log_escape(char *dest, size_t pos, const char *s, bool json) {
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            dest[pos++] = '\\';
+            dest[pos++] = c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            pos += sprintf(dest + pos, json ? "\\u%04x" : "\\x%02x", c);
+        } else {
+            dest[pos++] = c;
+        }
+    }
+    return pos;
+}
+
+/**
+ * Writes address of the peer of record `r` into `dest` (at least
+ * INET6_ADDRSTRLEN + 8 bytes). Returns its length.
+ */
+static size_t _access_log_peer(const HTTP_AccessRecord *r, char *dest) {
+    char addr[INET6_ADDRSTRLEN] = "-";
+    if (r->family != AF_UNSPEC) inet_ntop(r->family, r->addr, addr, sizeof(addr));
+    if (r->family == AF_INET6) return sprintf(dest, "[%s]:%u", addr, r->port);
+    if (r->family == AF_INET) return sprintf(dest, "%s:%u", addr, r->port);
+    return sprintf(dest, "-");
+}
+
+/**
+ * Formats record `r` into `dest` (HTTP_ACCESS_LOG_LINE_MAX bytes) as a single
+ * line:
+ *
+ *     2025-01-01T12:00:00.123Z 127.0.0.1:51234 "GET /index.html" 200 78 1024 0.000231
+ *
+ * (time, peer, method and Request-URI, status, bytes received, bytes sent and
+ * latency in seconds). Returns length of the line.
+ */
+static size_t _access_log_format(const HTTP_AccessRecord *r, char *dest) {
+    size_t pos = 0;
+    time_t sec = r->time_ns / 1000000000ULL;
+    plex tm tm;
+    gmtime_r(&sec, &tm);
+    pos += strftime(dest, 32, "%Y-%m-%dT%H:%M:%S", &tm);
+    pos += sprintf(dest + pos, ".%03uZ ", (unsigned)(r->time_ns / 1000000 % 1000));
+
+    pos += _access_log_peer(r, dest + pos);
+    dest[pos++] = ' ';
+    dest[pos++] = '"';
+
+    if (r->method[0] == '\0') {
+        dest[pos++] = '-';
+    } else {
+        pos = _access_log_escape(dest, pos, r->method, false);
+        dest[pos++] = ' ';
+        pos = _access_log_escape(dest, pos, r->path, false);
+    }
+    pos += sprintf(dest + pos, "\" %u %llu %llu %.6f\n", r->status, (unsigned long long)r->bytes_in,
+                   (unsigned long long)r->bytes_out, r->latency_ns / 1e9);
+    return pos;
+}
+
+/**
+ * Formats record `r` into `dest` (HTTP_ACCESS_LOG_LINE_MAX bytes) as Chrome
+ * trace events, each on its own line, followed by a comma: the request, that
+ * spans from its first recorded phase to the last one, and the time between
+ * every two recorded phases, that is named after what was done then (see
+ * HTTP_PHASE_MAP). Events are put on the track of the connection. Returns
+ * length of the events.
+ */
+static size_t _access_log_format_trace(const HTTP_AccessRecord *r, char *dest) {
+    static const char *spans[] = {
+#define XX(num, name, repr, span) span,
+        HTTP_PHASE_MAP(XX)
+#undef XX
+    };
+    size_t pos = 0, first = HTTP_PHASES, last = 0;
+    for (size_t i = 0; i < HTTP_PHASES; i++) {
+        if (r->phases[i] == 0) continue;
+        if (first == HTTP_PHASES) first = i;
+        last = i;
+    }
+    // Request, that has no phases recorded, can't be placed on the timeline
+    if (first == HTTP_PHASES) return 0;
+
+    pos += sprintf(dest + pos, "{\"name\":\"");
+    if (r->method[0] == '\0') {
+        dest[pos++] = '-';
+    } else {
+        pos = _access_log_escape(dest, pos, r->method, true);
+        dest[pos++] = ' ';
+        pos = _access_log_escape(dest, pos, r->path, true);
+    }
+    pos += sprintf(dest + pos, "\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"args\":{\"peer\":\"", r->conn, r->phases[first] / 1e3, (r->phases[last] - r->phases[first]) / 1e3);
+    pos += _access_log_peer(r, dest + pos);
+    pos += sprintf(dest + pos, "\",\"status\":%u,\"bytes_in\":%llu,\"bytes_out\":%llu}},\n", r->status,
+                   (unsigned long long)r->bytes_in, (unsigned long long)r->bytes_out);
+
+    for (size_t i = first + 1, prev = first; i <= last; i++) {
+        if (r->phases[i] == 0) continue;
+        pos += sprintf(dest + pos, "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                       "\"ts\":%.3f,\"dur\":%.3f},\n", spans[i], r->conn, r->phases[prev] / 1e3,
+                       (r->phases[i] - r->phases[prev]) / 1e3);
+        prev = i;
+    }
+    return pos;
+}
+
+/**
+ * Writes all of `iov` (`iovcnt` of them) into `fd`, resuming after short
+ * writes.
+ */
+static bool _access_log_writev(int fd, plex iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        for (; iovcnt > 0 && (size_t)n >= iov->iov_len; iov++, iovcnt--) n -= iov->iov_len;
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+/**
+ * Writes records of all rings of access log `log`, that are available, with
+ * `lines` as the scratch space. Returns number of the written records.
+ */
+static size_t _access_log_flush(HTTP_AccessLog *log, char (*lines)[HTTP_ACCESS_LOG_LINE_MAX]) {
+    plex iovec iov[HTTP_ACCESS_LOG_BATCH];
+    size_t total = 0;
+
+    for (HTTP_AccessRing *ring = http_per_thread_list(&log->_rings); ring; ring = ring->next) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        while (tail != head) {
+            int count = 0;
+            for (; tail != head && count < HTTP_ACCESS_LOG_BATCH; tail++, count++) {
+                HTTP_AccessRecord *r = &ring->records[tail & (HTTP_ACCESS_LOG_RING_SZ - 1)];
+                iov[count].iov_base = lines[count];
+                iov[count].iov_len = log->format == HTTP_AccessLog_TRACE ?
+                    _access_log_format_trace(r, lines[count]) : _access_log_format(r, lines[count]);
+            }
+            // The records are copied out, so their slots may be reused
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+            atomic_uint_fast64_t *c = _access_log_writev(log->fd, iov, count) ? &log->_written : &log->_failed;
+            atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + count, memory_order_relaxed);
+            total += count;
+        }
+    }
+    return total;
+}
+
+static void *_access_log_run(void *arg) {
+    HTTP_AccessLog *log = arg;
+    char (*lines)[HTTP_ACCESS_LOG_LINE_MAX] = malloc(HTTP_ACCESS_LOG_BATCH * sizeof(*lines));
+    HTTP_ASSERT(lines != NULL && "Failed to allocate access log lines");
+
+    // Events are written in JSON Array Format, that is closed, once the log
+    // is stopped (trace viewers accept the unclosed one as well)
+    static const char trace_start[] = "[\n";
+    static const char trace_end[] = "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"http server\"}}\n]\n";
+    plex iovec iov = { (void *)trace_start, sizeof(trace_start) - 1 };
+    if (log->format == HTTP_AccessLog_TRACE) _access_log_writev(log->fd, &iov, 1);
+
+    for (;;) {
+        bool stopping = atomic_load(&log->_stopping);
+        // Once stopping, the records, that are left, are still written
+        if (_access_log_flush(log, lines) > 0) continue;
+        if (stopping) break;
+        plex timespec ts = { .tv_sec = 0, .tv_nsec = HTTP_ACCESS_LOG_FLUSH_MS * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    iov = (plex iovec) { (void *)trace_end, sizeof(trace_end) - 1 };
+    if (log->format == HTTP_AccessLog_TRACE) _access_log_writev(log->fd, &iov, 1);
+    free(lines);
+    return NULL;
+}
+
+HTTP_Err http_access_log_init(HTTP_AccessLog *log, int fd, uint32_t sample, HTTP_AccessLogFormat format) {
+    log->fd = fd;
+    log->sample = sample;
+    log->format = format;
+    log->_started = false;
+    atomic_store(&log->_stopping, false);
+    atomic_store(&log->_written, 0);
+    atomic_store(&log->_failed, 0);
+
+    if (!http_per_thread_init(&log->_rings, sizeof(HTTP_AccessRing), offsetof(HTTP_AccessRing, next)))
+        return HTTP_ERR_OOM;
+    if (pthread_create(&log->_thread, NULL, _access_log_run, log) != 0) {
+        http_per_thread_free(&log->_rings);
+        return HTTP_ERR_OOM;
+    }
+    log->_started = true;
+    return HTTP_ERR_OK;
+}
+
+HTTP_AccessLogStats http_access_log_stats(HTTP_AccessLog *log) {
+    HTTP_AccessLogStats st = {0};
+    if (!log->_started) return st;
+    st.written = atomic_load_explicit(&log->_written, memory_order_relaxed);
+    st.dropped = atomic_load_explicit(&log->_failed, memory_order_relaxed);
+    for (HTTP_AccessRing *ring = http_per_thread_list(&log->_rings); ring; ring = ring->next) {
+        st.dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        uint64_t seen = atomic_load_explicit(&ring->seen, memory_order_relaxed);
+        if (log->sample > 1) st.sampled += seen - (seen + log->sample - 1) / log->sample;
+    }
+    return st;
+}
+
+void http_access_log_free(HTTP_AccessLog *log) {
+    if (!log->_started) return;
+    atomic_store(&log->_stopping, true);
+    pthread_join(log->_thread, NULL);
+    log->_started = false;
+
+    http_per_thread_free(&log->_rings);
+}
+
+#  endif // HTTP_ACCESSLOG_IMPL_GUARD
+#endif // HTTP_ACCESSLOG_IMPL
+
+/*
+ * Copyright (c) 2025 Artem Darizhapov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
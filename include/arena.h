@@ -0,0 +1,326 @@
+/*
+ * arena.h - Bump allocator with chunk growth.
+ *
+ * Arena hands out memory from a list of chunks by simply advancing an offset
+ * within the current chunk. When the chunk is exhausted, the next one is
+ * reused (or a new one is allocated). Individual allocations are never freed;
+ * instead, the whole arena is rewound at once with http_arena_reset(), which
+ * is O(1), and the chunks are kept for reuse.
+ *
+ * The library routes all of its allocations through `HTTP_REALLOC` and
+ * `HTTP_FREE`, which default to http_realloc() and http_free(). These
+ * functions allocate from the arena that is currently in use by the calling
+ * thread (see http_arena_use()), or fall back to the system allocator when
+ * there is none:
+ *
+ * ```c
+ * HTTP_Arena a = {0};
+ * http_arena_init(&a, HTTP_ARENA_CHUNK_SZ);
+ *
+ * HTTP_Arena *prev = http_arena_use(&a);
+ * // ... everything allocated by the library here lives in `a` ...
+ * http_arena_use(prev);
+ *
+ * http_arena_reset(&a); // release everything at once
+ * http_arena_free(&a);
+ * ```
+ *
+ * NOTE: Memory allocated while an arena is in use MUST NOT be released after
+ *       the arena was swapped out (and vice versa), since http_free() decides
+ *       what to do only by looking at the arena currently in use.
+ *
+ * NOTE: If you re-define `HTTP_REALLOC`/`HTTP_FREE`, the library will not use
+ *       arenas at all.
+ *
+ * NOTE: Objects, that outlive requests (the cache, compressors, metrics, rings
+ *       of the access log, etc.), are allocated with malloc() directly,
+ *       bypassing the arena in use, which is reset with the request.
+ */
+#ifndef HTTP_ARENA_H
+#  define HTTP_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef HTTP_ARENA_CHUNK_SZ
+#  define HTTP_ARENA_CHUNK_SZ (16*1<<10)
+#endif // HTTP_ARENA_CHUNK_SZ
+
+typedef struct http_arena_chunk_s HTTP_ArenaChunk;
+
+struct http_arena_chunk_s {
+    HTTP_ArenaChunk *next;
+    size_t cap, len;
+    max_align_t data[];
+};
+
+typedef struct {
+    HTTP_ArenaChunk *first, *cur;
+    size_t chunk_sz;
+
+    /* stats */
+    size_t allocated; // bytes handed out since the last reset
+    size_t reserved;  // bytes held by all chunks
+} HTTP_Arena;
+
+/**
+ * Initializes arena `a`, that allocates chunks of at least `chunk_sz` bytes.
+ *
+ * No memory is allocated until the first allocation is made.
+ */
+void http_arena_init(HTTP_Arena *a, size_t chunk_sz);
+
+/**
+ * Allocates `n` bytes from arena `a`. The returned memory is aligned to
+ * `max_align_t`.
+ *
+ * Returns NULL if failed to allocate a new chunk.
+ */
+void *http_arena_alloc(HTTP_Arena *a, size_t n);
+
+/**
+ * Resizes allocation `p` (that was made from arena `a`) to `n` bytes.
+ *
+ * If `p` is the last allocation made from the arena and the chunk has enough
+ * room, the allocation is extended in place. Otherwise, a new block is
+ * allocated and the contents are copied. If `p` is NULL, it is equivalent to
+ * http_arena_alloc(). If `p` was not made from the arena (e.g. it came from
+ * malloc()), it's resized with realloc() and stays off the arena.
+ */
+void *http_arena_realloc(HTTP_Arena *a, void *p, size_t n);
+
+/**
+ * Returns true, if `p` points into one of the chunks of arena `a`.
+ */
+bool http_arena_owns(HTTP_Arena *a, const void *p);
+
+/**
+ * Duplicates up to `n` bytes of string `s` into arena `a`.
+ */
+char *http_arena_strndup(HTTP_Arena *a, const char *s, size_t n);
+
+/**
+ * Releases every allocation made from arena `a` at once, keeping the chunks
+ * for reuse.
+ */
+void http_arena_reset(HTTP_Arena *a);
+
+/**
+ * Frees arena `a` and all of its chunks.
+ */
+void http_arena_free(HTTP_Arena *a);
+
+/**
+ * Makes arena `a` the one used by the calling thread for http_realloc() and
+ * friends. Passing NULL switches back to the system allocator.
+ *
+ * Returns the arena that was in use before the call.
+ */
+HTTP_Arena *http_arena_use(HTTP_Arena *a);
+
+/**
+ * Returns the arena in use by the calling thread, or NULL.
+ */
+HTTP_Arena *http_arena_current(void);
+
+/**
+ * Allocator functions, that respect the arena in use by the calling thread.
+ * Memory, that was not allocated from the arena, is resized and freed with
+ * the system allocator even while the arena is in use.
+ */
+void *http_realloc(void *p, size_t n);
+void  http_free(void *p);
+char *http_strdup(const char *s);
+char *http_strndup(const char *s, size_t n);
+
+#endif // HTTP_ARENA_H
+
+#ifdef HTTP_ARENA_IMPL
+#  ifndef HTTP_ARENA_IMPL_GUARD
+#    define HTTP_ARENA_IMPL_GUARD
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Every arena allocation is prefixed by its size, so it could be resized
+ * later.
+ */
+typedef union {
+    size_t sz;
+    max_align_t _align;
+} _HTTP_ArenaHeader;
+
+static _Thread_local HTTP_Arena *_http_arena_current = NULL;
+
+static inline size_t _arena_align(size_t n) {
+    size_t a = sizeof(max_align_t);
+    return (n + a - 1) & ~(a - 1);
+}
+
+static inline char *_arena_chunk_data(HTTP_ArenaChunk *c) {
+    return (char *)c->data;
+}
+
+static HTTP_ArenaChunk *_arena_chunk_new(HTTP_Arena *a, size_t n) {
+    size_t cap = (n > a->chunk_sz) ? n : a->chunk_sz;
+    HTTP_ArenaChunk *c = malloc(sizeof(HTTP_ArenaChunk) + cap);
+    if (c == NULL) return NULL;
+
+    c->next = NULL;
+    c->cap  = cap;
+    c->len  = 0;
+    a->reserved += cap;
+    return c;
+}
+
+void http_arena_init(HTTP_Arena *a, size_t chunk_sz) {
+    a->first = a->cur = NULL;
+    a->chunk_sz = _arena_align(chunk_sz > 0 ? chunk_sz : HTTP_ARENA_CHUNK_SZ);
+    a->allocated = a->reserved = 0;
+}
+
+void *http_arena_alloc(HTTP_Arena *a, size_t n) {
+    size_t need = sizeof(_HTTP_ArenaHeader) + _arena_align(n);
+
+    if (a->cur == NULL) {
+        if (a->first == NULL && (a->first = _arena_chunk_new(a, need)) == NULL) return NULL;
+        a->cur = a->first;
+        a->cur->len = 0;
+    }
+
+    // NOTE: Chunks are rewound lazily, when the allocation moves onto them.
+    //       This is what makes http_arena_reset() O(1).
+    while (a->cur->cap - a->cur->len < need) {
+        HTTP_ArenaChunk *next = a->cur->next;
+        if (next == NULL || next->cap < need) {
+            HTTP_ArenaChunk *c = _arena_chunk_new(a, need);
+            if (c == NULL) return NULL;
+            c->next = next;
+            a->cur->next = c;
+            next = c;
+        }
+        a->cur = next;
+        a->cur->len = 0;
+    }
+
+    _HTTP_ArenaHeader *h = (_HTTP_ArenaHeader *)(_arena_chunk_data(a->cur) + a->cur->len);
+    h->sz = n;
+    a->cur->len += need;
+    a->allocated += need;
+
+    return h + 1;
+}
+
+void *http_arena_realloc(HTTP_Arena *a, void *p, size_t n) {
+    if (p == NULL) return http_arena_alloc(a, n);
+    // Memory from elsewhere has no header to read the size from
+    if (!http_arena_owns(a, p)) return realloc(p, n);
+
+    _HTTP_ArenaHeader *h = (_HTTP_ArenaHeader *)p - 1;
+    if (n <= h->sz) return p;
+
+    // Extend in place, if `p` is the last allocation in the current chunk
+    char *chunk_end = _arena_chunk_data(a->cur) + a->cur->len;
+    size_t old_sz = _arena_align(h->sz), new_sz = _arena_align(n);
+    if ((char *)p + old_sz == chunk_end && a->cur->cap - a->cur->len >= new_sz - old_sz) {
+        a->cur->len  += new_sz - old_sz;
+        a->allocated += new_sz - old_sz;
+        h->sz = n;
+        return p;
+    }
+
+    void *np = http_arena_alloc(a, n);
+    if (np == NULL) return NULL;
+    memcpy(np, p, h->sz);
+    return np;
+}
+
+bool http_arena_owns(HTTP_Arena *a, const void *p) {
+    for (HTTP_ArenaChunk *c = a->first; c != NULL; c = c->next) {
+        char *data = _arena_chunk_data(c);
+        if ((const char *)p >= data && (const char *)p < data + c->cap) return true;
+    }
+    return false;
+}
+
+char *http_arena_strndup(HTTP_Arena *a, const char *s, size_t n) {
+    size_t len = strnlen(s, n);
+    char *dup = http_arena_alloc(a, len + 1);
+    if (dup == NULL) return NULL;
+    memcpy(dup, s, len);
+    dup[len] = '\0';
+    return dup;
+}
+
+void http_arena_reset(HTTP_Arena *a) {
+    a->cur = a->first;
+    if (a->cur) a->cur->len = 0;
+    a->allocated = 0;
+}
+
+void http_arena_free(HTTP_Arena *a) {
+    HTTP_ArenaChunk *c = a->first;
+    while (c != NULL) {
+        HTTP_ArenaChunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    a->first = a->cur = NULL;
+    a->allocated = a->reserved = 0;
+}
+
+HTTP_Arena *http_arena_use(HTTP_Arena *a) {
+    HTTP_Arena *prev = _http_arena_current;
+    _http_arena_current = a;
+    return prev;
+}
+
+HTTP_Arena *http_arena_current(void) {
+    return _http_arena_current;
+}
+
+void *http_realloc(void *p, size_t n) {
+    if (_http_arena_current) return http_arena_realloc(_http_arena_current, p, n);
+    return realloc(p, n);
+}
+
+void http_free(void *p) {
+    if (_http_arena_current && http_arena_owns(_http_arena_current, p)) return;
+    free(p);
+}
+
+char *http_strdup(const char *s) {
+    if (_http_arena_current) return http_arena_strndup(_http_arena_current, s, strlen(s));
+    return strdup(s);
+}
+
+char *http_strndup(const char *s, size_t n) {
+    if (_http_arena_current) return http_arena_strndup(_http_arena_current, s, n);
+    return strndup(s, n);
+}
+
+#  endif // HTTP_ARENA_IMPL_GUARD
+#endif // HTTP_ARENA_IMPL
+
+/*
+ * Copyright (c) 2025 Artem Darizhapov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
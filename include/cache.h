@@ -0,0 +1,372 @@
+/*
+ * cache.h - Memory-bounded cache of serialized responses.
+ *
+ * Responses are stored by an opaque key (the server builds it from the method,
+ * URL and selected request headers) for a limited time. The cache is split
+ * into shards, each protected by its own mutex and holding its own LRU list,
+ * so concurrent lookups of different keys rarely contend. Once the cache
+ * exceeds `max_sz`, the least recently used entries of the shard are evicted.
+ *
+ * Entries are reference counted: an entry returned by http_cache_get() stays
+ * valid until it's released, even if it was evicted in the meantime:
+ *
+ * ```c
+ * HTTP_Cache c = {0};
+ * http_cache_init(&c, 32*1<<20, HTTP_CACHE_SHARDS);
+ *
+ * http_cache_put(&c, key, key_len, &resp, 5);
+ *
+ * HTTP_CacheEntry *e = http_cache_get(&c, key, key_len);
+ * if (e) {
+ *     // ... send e->resp ...
+ *     http_cache_release(&c, e);
+ * }
+ *
+ * http_cache_free(&c);
+ * ```
+ */
+#ifndef HTTP_CACHE_H
+#  define HTTP_CACHE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "common.h"
+#include "err.h"
+
+#ifndef HTTP_CACHE_SHARDS
+#  define HTTP_CACHE_SHARDS 16
+#endif // HTTP_CACHE_SHARDS
+
+// Number of hash buckets of a single shard
+#ifndef HTTP_CACHE_SHARD_BUCKETS
+#  define HTTP_CACHE_SHARD_BUCKETS 1024
+#endif // HTTP_CACHE_SHARD_BUCKETS
+
+typedef plex http_cache_entry_s {
+    plex http_cache_entry_s *hnext;       // next entry in the same bucket
+    plex http_cache_entry_s *prev, *next; // LRU list of the shard
+    uint64_t hash;
+    time_t expires_at;
+    atomic_size_t refs;
+    size_t sz;                            // bytes accounted for the entry
+    char *key;
+    size_t key_len;
+    HTTP_SerializedResponse resp;
+    char mem[];
+} HTTP_CacheEntry;
+
+typedef plex {
+    pthread_mutex_t lock;
+    HTTP_CacheEntry *buckets[HTTP_CACHE_SHARD_BUCKETS];
+    HTTP_CacheEntry *head, *tail;  // the most and the least recently used
+    size_t sz, entries;
+} HTTP_CacheShard;
+
+typedef plex {
+    size_t max_sz;  // bytes all of the entries may take
+    size_t nshards;
+
+    HTTP_CacheShard *_shards;
+    atomic_size_t _hits, _misses, _stores, _evictions;
+} HTTP_Cache;
+
+typedef plex {
+    size_t max_sz;    // bytes all of the entries may take
+    size_t sz;        // bytes taken by the entries
+    size_t entries;   // number of stored entries
+    size_t hits;      // lookups, that found a fresh entry
+    size_t misses;    // lookups, that found nothing or an expired entry
+    size_t stores;    // stored entries
+    size_t evictions; // entries evicted to make room for others
+} HTTP_CacheStats;
+
+/**
+ * Initializes cache `c`, that may take at most `max_sz` bytes, split into
+ * `nshards` shards.
+ */
+HTTP_Err http_cache_init(HTTP_Cache *c, size_t max_sz, size_t nshards);
+
+/**
+ * Returns fresh entry stored by key `key` of length `key_len`, or NULL if
+ * there is none. The entry must be released with http_cache_release().
+ */
+HTTP_CacheEntry *http_cache_get(HTTP_Cache *c, const char *key, size_t key_len);
+
+/**
+ * Releases entry `e`, that was returned by http_cache_get().
+ */
+void http_cache_release(HTTP_Cache *c, HTTP_CacheEntry *e);
+
+/**
+ * Stores a copy of response `resp` by key `key` of length `key_len` for `ttl`
+ * seconds, replacing the entry stored by the same key.
+ *
+ * Returns `HTTP_ERR_OOB`, if the entry doesn't fit into a single shard.
+ */
+HTTP_Err http_cache_put(HTTP_Cache *c, const char *key, size_t key_len,
+                        const HTTP_SerializedResponse *resp, int ttl);
+
+/**
+ * Returns usage statistics of cache `c`.
+ */
+HTTP_CacheStats http_cache_stats(HTTP_Cache *c);
+
+/**
+ * Frees cache `c` with all of its entries. Entries, that are still in use,
+ * are freed, once they are released.
+ */
+void http_cache_free(HTTP_Cache *c);
+
+/**
+ * Returns true, if `Cache-Control` header value `value` contains directive
+ * `directive` (case-insensitive).
+ */
+bool http_cache_control_has(const char *value, const char *directive);
+
+/**
+ * Returns true, if response with status code `sc` may be cached without
+ * explicit freshness information (RFC 7231, section 6.1).
+ */
+bool http_cache_status_cacheable(uint16_t sc);
+
+#endif // HTTP_CACHE_H
+
+#ifdef HTTP_CACHE_IMPL
+#  ifndef HTTP_CACHE_IMPL_GUARD
+#    define HTTP_CACHE_IMPL_GUARD
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// FNV-1a
+static uint64_t _cache_hash(const char *key, size_t key_len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < key_len; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static inline HTTP_CacheShard *_cache_shard(HTTP_Cache *c, uint64_t hash) {
+    return &c->_shards[hash % c->nshards];
+}
+
+static inline HTTP_CacheEntry **_cache_bucket(HTTP_CacheShard *sh, uint64_t hash) {
+    // Low bits select the shard, so buckets are selected by the high ones
+    return &sh->buckets[(hash >> 32) % HTTP_CACHE_SHARD_BUCKETS];
+}
+
+static void _cache_entry_unref(HTTP_CacheEntry *e) {
+    if (atomic_fetch_sub(&e->refs, 1) == 1) free(e);
+}
+
+/**
+ * Removes entry `e` from shard `sh`. Must be called with the shard locked.
+ */
+static void _cache_unlink(HTTP_CacheShard *sh, HTTP_CacheEntry *e) {
+    HTTP_CacheEntry **pp = _cache_bucket(sh, e->hash);
+    while (*pp != e) pp = &(*pp)->hnext;
+    *pp = e->hnext;
+
+    if (e->prev) e->prev->next = e->next;
+    else sh->head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else sh->tail = e->prev;
+
+    sh->sz -= e->sz;
+    sh->entries--;
+    _cache_entry_unref(e);
+}
+
+static void _cache_touch(HTTP_CacheShard *sh, HTTP_CacheEntry *e) {
+    if (sh->head == e) return;
+    e->prev->next = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else sh->tail = e->prev;
+
+    e->prev = NULL;
+    e->next = sh->head;
+    sh->head->prev = e;
+    sh->head = e;
+}
+
+static HTTP_CacheEntry *_cache_find(HTTP_CacheShard *sh, uint64_t hash, const char *key, size_t key_len) {
+    for (HTTP_CacheEntry *e = *_cache_bucket(sh, hash); e; e = e->hnext) {
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->key, key, key_len) == 0) return e;
+    }
+    return NULL;
+}
+
+HTTP_Err http_cache_init(HTTP_Cache *c, size_t max_sz, size_t nshards) {
+    if (nshards == 0) nshards = 1;
+    c->max_sz = max_sz;
+    c->nshards = nshards;
+
+    c->_shards = calloc(nshards, sizeof(HTTP_CacheShard));
+    if (c->_shards == NULL) return HTTP_ERR_OOM;
+    for (size_t i = 0; i < nshards; i++) {
+        if (pthread_mutex_init(&c->_shards[i].lock, NULL) != 0) return HTTP_ERR_OOM;
+    }
+
+    atomic_init(&c->_hits, 0);
+    atomic_init(&c->_misses, 0);
+    atomic_init(&c->_stores, 0);
+    atomic_init(&c->_evictions, 0);
+    return HTTP_ERR_OK;
+}
+
+HTTP_CacheEntry *http_cache_get(HTTP_Cache *c, const char *key, size_t key_len) {
+    uint64_t hash = _cache_hash(key, key_len);
+    HTTP_CacheShard *sh = _cache_shard(c, hash);
+
+    pthread_mutex_lock(&sh->lock);
+    HTTP_CacheEntry *e = _cache_find(sh, hash, key, key_len);
+    if (e && e->expires_at <= time(NULL)) {
+        _cache_unlink(sh, e);
+        e = NULL;
+    }
+    if (e) {
+        _cache_touch(sh, e);
+        atomic_fetch_add(&e->refs, 1);
+    }
+    pthread_mutex_unlock(&sh->lock);
+
+    atomic_fetch_add(e ? &c->_hits : &c->_misses, 1);
+    return e;
+}
+
+void http_cache_release(HTTP_Cache *c, HTTP_CacheEntry *e) {
+    HTTP_UNUSED(c);
+    _cache_entry_unref(e);
+}
+
+HTTP_Err http_cache_put(HTTP_Cache *c, const char *key, size_t key_len,
+                        const HTTP_SerializedResponse *resp, int ttl) {
+    size_t sz = sizeof(HTTP_CacheEntry) + key_len + resp->len;
+    size_t shard_max_sz = c->max_sz / c->nshards;
+    if (sz > shard_max_sz) return HTTP_ERR_OOB;
+
+    HTTP_CacheEntry *e = malloc(sz);
+    if (e == NULL) return HTTP_ERR_OOM;
+    e->hash = _cache_hash(key, key_len);
+    e->expires_at = time(NULL) + ttl;
+    atomic_init(&e->refs, 1); // held by the cache
+    e->sz = sz;
+    e->key = e->mem;
+    e->key_len = key_len;
+    memcpy(e->key, key, key_len);
+    e->resp = *resp;
+    e->resp.data = e->mem + key_len;
+    memcpy(e->resp.data, resp->data, resp->len);
+
+    HTTP_CacheShard *sh = _cache_shard(c, e->hash);
+    pthread_mutex_lock(&sh->lock);
+    HTTP_CacheEntry *old = _cache_find(sh, e->hash, key, key_len);
+    if (old) _cache_unlink(sh, old);
+    while (sh->sz + sz > shard_max_sz) {
+        _cache_unlink(sh, sh->tail);
+        atomic_fetch_add(&c->_evictions, 1);
+    }
+
+    HTTP_CacheEntry **bucket = _cache_bucket(sh, e->hash);
+    e->hnext = *bucket;
+    *bucket = e;
+    e->prev = NULL;
+    e->next = sh->head;
+    if (sh->head) sh->head->prev = e;
+    sh->head = e;
+    if (sh->tail == NULL) sh->tail = e;
+    sh->sz += sz;
+    sh->entries++;
+    pthread_mutex_unlock(&sh->lock);
+
+    atomic_fetch_add(&c->_stores, 1);
+    return HTTP_ERR_OK;
+}
+
+HTTP_CacheStats http_cache_stats(HTTP_Cache *c) {
+    HTTP_CacheStats st = {0};
+    st.max_sz = c->max_sz;
+    for (size_t i = 0; i < c->nshards; i++) {
+        HTTP_CacheShard *sh = &c->_shards[i];
+        pthread_mutex_lock(&sh->lock);
+        st.sz += sh->sz;
+        st.entries += sh->entries;
+        pthread_mutex_unlock(&sh->lock);
+    }
+    st.hits = atomic_load(&c->_hits);
+    st.misses = atomic_load(&c->_misses);
+    st.stores = atomic_load(&c->_stores);
+    st.evictions = atomic_load(&c->_evictions);
+    return st;
+}
+
+void http_cache_free(HTTP_Cache *c) {
+    for (size_t i = 0; i < c->nshards; i++) {
+        HTTP_CacheShard *sh = &c->_shards[i];
+        while (sh->head) _cache_unlink(sh, sh->head);
+        pthread_mutex_destroy(&sh->lock);
+    }
+    free(c->_shards);
+    c->_shards = NULL;
+    c->nshards = 0;
+}
+
+bool http_cache_control_has(const char *value, const char *directive) {
+    size_t n = strlen(directive);
+    for (const char *p = value; *p;) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (strncasecmp(p, directive, n) == 0 && strchr(" \t,=", p[n])) return true;
+        while (*p && *p != ',') p++;
+    }
+    return false;
+}
+
+bool http_cache_status_cacheable(uint16_t sc) {
+    switch (sc) {
+    case HTTP_Status_OK:
+    case HTTP_Status_NON_AUTHORITATIVE_INFORMATION:
+    case HTTP_Status_NO_CONTENT:
+    case HTTP_Status_MULTIPLE_CHOICES:
+    case HTTP_Status_MOVED_PERMANENTLY:
+    case HTTP_Status_NOT_FOUND:
+    case HTTP_Status_METHOD_NOT_ALLOWED:
+    case HTTP_Status_GONE:
+    case HTTP_Status_URI_TOO_LONG:
+    case HTTP_Status_NOT_IMPLEMENTED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+#  endif // HTTP_CACHE_IMPL_GUARD
+#endif // HTTP_CACHE_IMPL
+
+/*
+ * Copyright (c) 2025 Artem Darizhapov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
@@ -1,16 +1,32 @@
 #ifndef HTTP_COMMON_H
 #  define HTTP_COMMON_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
+
 #define plex struct
 
 #ifndef HTTP_REALLOC
-#  define HTTP_REALLOC realloc
+#  define HTTP_REALLOC http_realloc
 #endif // HTTP_REALLOC
 
+#ifndef HTTP_FREE
+#  define HTTP_FREE http_free
+#endif // HTTP_FREE
+
+#ifndef HTTP_STRDUP
+#  define HTTP_STRDUP http_strdup
+#endif // HTTP_STRDUP
+
+#ifndef HTTP_STRNDUP
+#  define HTTP_STRNDUP http_strndup
+#endif // HTTP_STRNDUP
+
 #ifndef HTTP_ASSERT
 #  include <assert.h>
 #  define HTTP_ASSERT assert
@@ -32,14 +48,16 @@
 #  define HTTP_PARSER_URI_MAX_LEN 256
 #endif // HTTP_PARSER_URI_MAX_LEN
 
+/**
+ * Serialized response: the status line and headers, followed by the empty
+ * line and the body.
+ */
 typedef plex {
-    char *k, *v;
-} HTTP_Header;
-
-typedef plex {
-    size_t       len, cap;
-    HTTP_Header *items;
-} HTTP_Headers;
+    char *data;
+    size_t len;
+    size_t head_len;  // length of the status line and headers
+    size_t date_off;  // offset of `Date` header value, or 0 if there is none
+} HTTP_SerializedResponse;
 
 typedef plex {
     unsigned short maj, min;
@@ -77,7 +95,8 @@ char *http_method_to_cstr(HTTP_Method method) {
     return "UNKNOWN";
 }
 
-// NOTE: For now, only default statuses (as specified by RFC 2616) are allowed
+// NOTE: For now, only default statuses (as specified by RFC 2616) are allowed,
+//       plus 431 (RFC 6585), that the server uses to reject large headers
 #define HTTP_STATUS_MAP(XX)                                             \
     XX(0,   UNKNOWN,                         "Unrecognized Status")     \
     XX(100, CONTINUE,                        "Continue")                \
@@ -114,6 +133,7 @@ char *http_method_to_cstr(HTTP_Method method) {
     XX(415, UNSUPPORTED_MEDIA_TYPE,          "Unsupported Media Type")  \
     XX(416, RANGE_NOT_SATISFIABLE,           "Range Not Satisfiable")   \
     XX(417, EXPECTATION_FAILED,              "Expectation Failed")      \
+    XX(431, REQUEST_HEADER_FIELDS_TOO_LARGE, "Request Header Fields Too Large") \
     XX(500, INTERNAL_SERVER_ERROR,           "Internal Server Error")   \
     XX(501, NOT_IMPLEMENTED,                 "Not Implemented")         \
     XX(502, BAD_GATEWAY,                     "Bad Gateway")             \
@@ -134,24 +154,6 @@ char *http_reason_phrase(uint16_t status_code) {
     return "UNKNOWN";
 }
 
-/**
- * Frees header `h`.
- */
-void http_header_free(HTTP_Header *h) {
-    if (h->k) free(h->k);
-    if (h->v) free(h->v);
-}
-
-/**
- * Frees headers `hs`.
- */
-void http_headers_free(HTTP_Headers *hs) {
-    for (size_t i = 0; i < hs->len; i++) {
-        http_header_free(&hs->items[i]);
-    }
-    if (hs->items) free(hs->items);
-}
-
 #endif // HTTP_COMMON_H
 
 /*
@@ -0,0 +1,658 @@
+/*
+ * compress.h - Content coding negotiation and streaming compression.
+ *
+ * The encoding of a response is picked from the client's `Accept-Encoding`
+ * with http_encoding_negotiate(). The body is then compressed piece by piece
+ * with a compressor, whose output is handed to a callback as soon as zlib
+ * produces it, so the whole body never has to be held in memory.
+ *
+ * A deflate context takes a few hundred kilobytes, so compressors are kept in
+ * a pool, that is shared by all threads, and are reset instead of being
+ * re-created for every response:
+ *
+ * ```c
+ * HTTP_CompressorPool pool = {0};
+ * http_compressor_pool_init(&pool, 6, HTTP_COMPRESS_POOL_MAX);
+ *
+ * HTTP_Compressor *c = http_compressor_acquire(&pool, HTTP_Encoding_GZIP);
+ * http_compressor_write(c, body, body_len, false, send_piece, ctx);
+ * http_compressor_write(c, NULL, 0, true, send_piece, ctx);
+ * http_compressor_release(&pool, c);
+ *
+ * http_compressor_pool_free(&pool);
+ * ```
+ *
+ * NOTE: Compression is backed by zlib, and is compiled in only if
+ *       `HTTP_WITH_ZLIB` is defined (the program must be linked with `-lz`
+ *       then). Otherwise, http_compressor_acquire() always fails, so the
+ *       responses are sent as is.
+ *
+ * Request bodies, that are sent encoded, are inflated the same way: a
+ * decompressor from a pool pulls the encoded input with a callback and
+ * inflates it into the caller's buffer, one buffer at a time:
+ *
+ * ```c
+ * HTTP_Decompressor *d = http_decompressor_acquire(&dpool, HTTP_Encoding_GZIP);
+ * while ((err = http_decompressor_read(d, buf, sizeof(buf), &n, recv_piece, ctx)) == HTTP_ERR_CONT)
+ *     consume(buf, n);
+ * http_decompressor_release(&dpool, d);
+ * ```
+ */
+#ifndef HTTP_COMPRESS_H
+#  define HTTP_COMPRESS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef HTTP_WITH_ZLIB
+#  include <zlib.h>
+#endif // HTTP_WITH_ZLIB
+
+#include "common.h"
+#include "err.h"
+
+// Compressors, that are kept for reuse
+#ifndef HTTP_COMPRESS_POOL_MAX
+#  define HTTP_COMPRESS_POOL_MAX 16
+#endif // HTTP_COMPRESS_POOL_MAX
+
+// Compressed output is handed to the callback in pieces of at most this size
+#ifndef HTTP_COMPRESS_OUT_BUF_SZ
+#  define HTTP_COMPRESS_OUT_BUF_SZ (16*1<<10)
+#endif // HTTP_COMPRESS_OUT_BUF_SZ
+
+// Encoded input is pulled by a decompressor in pieces of at most this size
+#ifndef HTTP_DECOMPRESS_IN_BUF_SZ
+#  define HTTP_DECOMPRESS_IN_BUF_SZ (16*1<<10)
+#endif // HTTP_DECOMPRESS_IN_BUF_SZ
+
+// NOTE: Encodings are listed in the order of preference
+#define HTTP_ENCODING_MAP(XX)                   \
+    XX(0, IDENTITY, "identity")                 \
+    XX(1, GZIP,     "gzip"    )                 \
+    XX(2, DEFLATE,  "deflate" )
+
+typedef enum {
+#define XX(num, name, ...) HTTP_Encoding_##name = num,
+    HTTP_ENCODING_MAP(XX)
+#undef XX
+} HTTP_Encoding;
+
+typedef plex http_compressor_s {
+    plex http_compressor_s *next; // next free compressor of the pool
+    HTTP_Encoding encoding;
+#ifdef HTTP_WITH_ZLIB
+    z_stream z;
+#endif // HTTP_WITH_ZLIB
+} HTTP_Compressor;
+
+typedef plex {
+    int level;        // compression level, 1 (fastest) to 9 (smallest)
+    size_t max_free;  // compressors, that are kept for reuse
+
+    pthread_mutex_t _lock;
+    HTTP_Compressor *_free;
+    size_t _nfree;
+} HTTP_CompressorPool;
+
+typedef plex http_decompressor_s {
+    plex http_decompressor_s *next; // next free decompressor of the pool
+    HTTP_Encoding encoding;
+    uint64_t total_out;             // bytes inflated since acquired
+    bool done;                      // the encoded stream is over
+#ifdef HTTP_WITH_ZLIB
+    z_stream z;
+#endif // HTTP_WITH_ZLIB
+    char in[HTTP_DECOMPRESS_IN_BUF_SZ]; // pulled input, that isn't inflated yet
+} HTTP_Decompressor;
+
+typedef plex {
+    size_t max_free;  // decompressors, that are kept for reuse
+
+    pthread_mutex_t _lock;
+    HTTP_Decompressor *_free;
+    size_t _nfree;
+} HTTP_DecompressorPool;
+
+/**
+ * Response compression, that the server offers to a handler's response.
+ */
+typedef plex {
+    HTTP_CompressorPool *pool;
+    HTTP_Encoding encoding; // accepted by the client
+    size_t min_sz;          // smaller bodies are sent as is
+} HTTP_Compression;
+
+/**
+ * Request body decoding, that the server sets up for a request, whose body
+ * is sent encoded.
+ */
+typedef plex {
+    HTTP_DecompressorPool *pool;
+    HTTP_Encoding encoding; // of the request body
+    uint64_t max_sz;        // larger decoded bodies are rejected, 0 means no limit
+} HTTP_Decompression;
+
+char *http_encoding_to_cstr(HTTP_Encoding e);
+
+/**
+ * Returns encoding, that value `coding` of `Content-Encoding` header names,
+ * or -1, if it's unknown or lists several encodings.
+ */
+int http_encoding_from_cstr(const char *coding);
+
+/**
+ * Picks the most preferred encoding, that value `accept` of `Accept-Encoding`
+ * header allows (RFC 2616, section 14.3). Encodings with `q=0` are never
+ * picked, `*` stands for any encoding, that isn't listed explicitly.
+ */
+HTTP_Encoding http_encoding_negotiate(const char *accept);
+
+/**
+ * Returns true, if value `accept` of `Accept-Encoding` header allows
+ * encoding `e`.
+ */
+bool http_encoding_accepted(const char *accept, HTTP_Encoding e);
+
+/**
+ * Returns true, if body of media type `content_type` (value of
+ * `Content-Type` header) is worth compressing, i.e. it's textual.
+ */
+bool http_content_type_compressible(const char *content_type);
+
+/**
+ * Initializes pool `p` of compressors with compression level `level`, that
+ * keeps at most `max_free` released compressors for reuse.
+ */
+HTTP_Err http_compressor_pool_init(HTTP_CompressorPool *p, int level, size_t max_free);
+
+/**
+ * Returns compressor for encoding `e` from pool `p`, or NULL if failed to
+ * create one (or compression isn't compiled in).
+ */
+HTTP_Compressor *http_compressor_acquire(HTTP_CompressorPool *p, HTTP_Encoding e);
+
+/**
+ * Resets compressor `c` and returns it to pool `p`.
+ */
+void http_compressor_release(HTTP_CompressorPool *p, HTTP_Compressor *c);
+
+/**
+ * Compresses `len` bytes of `in` with compressor `c`, passing the output to
+ * `out` with context `ctx`. If `finish` is set, the rest of the output is
+ * flushed and the stream is ended (`in` may be NULL then).
+ *
+ * Returns the first error returned by `out`.
+ */
+HTTP_Err http_compressor_write(HTTP_Compressor *c, const char *in, size_t len, bool finish,
+                               HTTP_Err (*out)(void *ctx, const char *data, size_t len), void *ctx);
+
+/**
+ * Compresses `len` bytes of `in` with encoding `e` and level `level` at once,
+ * saving the output, that is allocated with malloc(), into `out` and its
+ * length into `out_len`.
+ *
+ * Returns `HTTP_ERR_NOT_IMPLEMENTED`, if compression isn't compiled in.
+ */
+HTTP_Err http_compress(HTTP_Encoding e, int level, const char *in, size_t len, char **out, size_t *out_len);
+
+/**
+ * Frees pool `p` with all of its free compressors.
+ */
+void http_compressor_pool_free(HTTP_CompressorPool *p);
+
+/**
+ * Initializes pool `p` of decompressors, that keeps at most `max_free`
+ * released decompressors for reuse.
+ */
+HTTP_Err http_decompressor_pool_init(HTTP_DecompressorPool *p, size_t max_free);
+
+/**
+ * Returns decompressor for encoding `e` from pool `p`, or NULL if failed to
+ * create one (or compression isn't compiled in).
+ */
+HTTP_Decompressor *http_decompressor_acquire(HTTP_DecompressorPool *p, HTTP_Encoding e);
+
+/**
+ * Resets decompressor `d` and returns it to pool `p`.
+ */
+void http_decompressor_release(HTTP_DecompressorPool *p, HTTP_Decompressor *d);
+
+/**
+ * Inflates input of decompressor `d` into `out` of size `out_sz`, saving the
+ * number of inflated bytes into `out_len`. Once the pulled input is inflated,
+ * more is pulled with `in` with context `ctx`, which saves the number of
+ * bytes it put into `buf` (of size `sz`) into `len`, or 0 once the input is
+ * over.
+ *
+ * Returns HTTP_ERR_CONT, while there is output, HTTP_ERR_OK, once the stream
+ * is over, HTTP_ERR_FAILED_PARSE, if the input is corrupted or truncated, or
+ * the first error returned by `in`.
+ */
+HTTP_Err http_decompressor_read(HTTP_Decompressor *d, char *out, size_t out_sz, size_t *out_len,
+                                HTTP_Err (*in)(void *ctx, char *buf, size_t sz, size_t *len), void *ctx);
+
+/**
+ * Frees pool `p` with all of its free decompressors.
+ */
+void http_decompressor_pool_free(HTTP_DecompressorPool *p);
+
+#endif // HTTP_COMPRESS_H
+
+#ifdef HTTP_COMPRESS_IMPL
+#  ifndef HTTP_COMPRESS_IMPL_GUARD
+#    define HTTP_COMPRESS_IMPL_GUARD
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+char *http_encoding_to_cstr(HTTP_Encoding e) {
+#define XX(num, name, repr) if (num == e) return repr;
+    HTTP_ENCODING_MAP(XX)
+#undef XX
+    return "identity";
+}
+
+int http_encoding_from_cstr(const char *coding) {
+    while (*coding == ' ' || *coding == '\t') coding++;
+    size_t len = strlen(coding);
+    while (len > 0 && (coding[len - 1] == ' ' || coding[len - 1] == '\t')) len--;
+#define XX(num, name, repr)                                                     \
+    if (len == sizeof(repr) - 1 && strncasecmp(coding, repr, len) == 0) return num;
+    HTTP_ENCODING_MAP(XX)
+#undef XX
+    if (len == 6 && strncasecmp(coding, "x-gzip", 6) == 0) return HTTP_Encoding_GZIP;
+    return -1;
+}
+
+/**
+ * Parses quality value of a list element, that starts at `params` (right
+ * after the coding), into `q` (in thousandths).
+ */
+static void _encoding_parse_q(const char *params, const char *end, int *q) {
+    *q = 1000;
+    const char *p = params;
+    while (p < end) {
+        while (p < end && (*p == ';' || *p == ' ' || *p == '\t')) p++;
+        if (end - p >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+            p += 2;
+            int v = 0, scale = 1000;
+            if (p < end && isdigit((unsigned char)*p)) v = (*p++ - '0') * 1000;
+            if (p < end && *p == '.') {
+                p++;
+                for (scale = 100; p < end && isdigit((unsigned char)*p) && scale > 0; p++, scale /= 10)
+                    v += (*p - '0') * scale;
+            }
+            *q = v > 1000 ? 1000 : v;
+            return;
+        }
+        while (p < end && *p != ';') p++;
+    }
+}
+
+// Number of encodings in HTTP_ENCODING_MAP
+#define _HTTP_ENCODING_COUNT (HTTP_Encoding_DEFLATE + 1)
+
+/**
+ * Parses value `accept` of `Accept-Encoding` header into quality values `q`
+ * of the known encodings and `q_any` of `*` (in thousandths, -1 if missing).
+ */
+static void _encoding_parse_accept(const char *accept, int q[_HTTP_ENCODING_COUNT], int *q_any) {
+    for (size_t e = 0; e < _HTTP_ENCODING_COUNT; e++) q[e] = -1;
+    *q_any = -1;
+
+    const char *p = accept;
+    while (*p) {
+        while (*p == ',' || *p == ' ' || *p == '\t') p++;
+        const char *coding = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') p++;
+        size_t coding_len = p - coding;
+        const char *params = p;
+        while (*p && *p != ',') p++;
+        if (coding_len == 0) continue;
+
+        int cq;
+        _encoding_parse_q(params, p, &cq);
+        if (coding_len == 1 && *coding == '*') *q_any = cq;
+#define XX(num, name, repr)                                                     \
+        else if (coding_len == sizeof(repr) - 1 && strncasecmp(coding, repr, coding_len) == 0) q[num] = cq;
+        HTTP_ENCODING_MAP(XX)
+#undef XX
+        // x-gzip is the same as gzip (RFC 2616, section 3.5)
+        else if (coding_len == 6 && strncasecmp(coding, "x-gzip", 6) == 0) q[HTTP_Encoding_GZIP] = cq;
+    }
+}
+
+HTTP_Encoding http_encoding_negotiate(const char *accept) {
+    int q[_HTTP_ENCODING_COUNT], q_any;
+    _encoding_parse_accept(accept, q, &q_any);
+
+    // Identity is acceptable, unless it's refused explicitly, but any other
+    // acceptable encoding is preferred over it, unless it has higher quality
+    HTTP_Encoding best = HTTP_Encoding_IDENTITY;
+    int best_q = q[HTTP_Encoding_IDENTITY] >= 0 ? q[HTTP_Encoding_IDENTITY] : 0;
+    for (size_t e = HTTP_Encoding_IDENTITY + 1; e < _HTTP_ENCODING_COUNT; e++) {
+        int eq = q[e] >= 0 ? q[e] : q_any;
+        if (eq > 0 && (eq > best_q || (eq == best_q && best == HTTP_Encoding_IDENTITY))) {
+            best = e;
+            best_q = eq;
+        }
+    }
+    return best;
+}
+
+bool http_encoding_accepted(const char *accept, HTTP_Encoding e) {
+    int q[_HTTP_ENCODING_COUNT], q_any;
+    _encoding_parse_accept(accept, q, &q_any);
+    if (e == HTTP_Encoding_IDENTITY) return q[e] != 0 && (q[e] > 0 || q_any != 0);
+    return (q[e] >= 0 ? q[e] : q_any) > 0;
+}
+
+bool http_content_type_compressible(const char *content_type) {
+    static const char *types[] = {
+        "text/", "application/json", "application/javascript", "application/xml",
+        "application/xhtml+xml", "application/x-www-form-urlencoded", "image/svg+xml",
+    };
+    for (size_t i = 0; i < sizeof(types)/sizeof(types[0]); i++) {
+        if (strncasecmp(content_type, types[i], strlen(types[i])) == 0) return true;
+    }
+    // Structured syntax suffixes (RFC 6839), e.g. application/problem+json
+    const char *end = strchr(content_type, ';');
+    size_t len = end ? (size_t)(end - content_type) : strlen(content_type);
+    while (len > 0 && content_type[len - 1] == ' ') len--;
+    return (len > 5 && strncasecmp(content_type + len - 5, "+json", 5) == 0) ||
+           (len > 4 && strncasecmp(content_type + len - 4, "+xml", 4) == 0);
+}
+
+HTTP_Err http_compressor_pool_init(HTTP_CompressorPool *p, int level, size_t max_free) {
+    p->level = (level < 1 || level > 9) ? 6 : level;
+    p->max_free = max_free;
+    p->_free = NULL;
+    p->_nfree = 0;
+    if (pthread_mutex_init(&p->_lock, NULL) != 0) return HTTP_ERR_OOM;
+    return HTTP_ERR_OK;
+}
+
+static void _compressor_destroy(HTTP_Compressor *c) {
+#ifdef HTTP_WITH_ZLIB
+    deflateEnd(&c->z);
+#endif // HTTP_WITH_ZLIB
+    free(c);
+}
+
+HTTP_Compressor *http_compressor_acquire(HTTP_CompressorPool *p, HTTP_Encoding e) {
+#ifdef HTTP_WITH_ZLIB
+    if (e == HTTP_Encoding_IDENTITY) return NULL;
+
+    pthread_mutex_lock(&p->_lock);
+    HTTP_Compressor **pc = &p->_free;
+    while (*pc && (*pc)->encoding != e) pc = &(*pc)->next;
+    HTTP_Compressor *c = *pc;
+    if (c) {
+        *pc = c->next;
+        p->_nfree--;
+    }
+    pthread_mutex_unlock(&p->_lock);
+    if (c) return c;
+
+    if ((c = malloc(sizeof(HTTP_Compressor))) == NULL) return NULL;
+    memset(c, 0, sizeof(*c));
+    c->encoding = e;
+    // Window bits select the framing: 16+ adds gzip header and trailer,
+    // otherwise the zlib ones are used, which is what `deflate` means
+    int wbits = (e == HTTP_Encoding_GZIP) ? 16 + MAX_WBITS : MAX_WBITS;
+    if (deflateInit2(&c->z, p->level, Z_DEFLATED, wbits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(c);
+        return NULL;
+    }
+    return c;
+#else
+    HTTP_UNUSED(p);
+    HTTP_UNUSED(e);
+    return NULL;
+#endif // HTTP_WITH_ZLIB
+}
+
+void http_compressor_release(HTTP_CompressorPool *p, HTTP_Compressor *c) {
+#ifdef HTTP_WITH_ZLIB
+    if (deflateReset(&c->z) != Z_OK) {
+        _compressor_destroy(c);
+        return;
+    }
+#endif // HTTP_WITH_ZLIB
+    pthread_mutex_lock(&p->_lock);
+    if (p->_nfree < p->max_free) {
+        c->next = p->_free;
+        p->_free = c;
+        p->_nfree++;
+        c = NULL;
+    }
+    pthread_mutex_unlock(&p->_lock);
+    if (c) _compressor_destroy(c);
+}
+
+HTTP_Err http_compressor_write(HTTP_Compressor *c, const char *in, size_t len, bool finish,
+                               HTTP_Err (*out)(void *ctx, const char *data, size_t len), void *ctx) {
+#ifdef HTTP_WITH_ZLIB
+    HTTP_Err err;
+    char buf[HTTP_COMPRESS_OUT_BUF_SZ];
+
+    c->z.next_in = (Bytef *)in;
+    c->z.avail_in = len;
+    int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+    int ret;
+    do {
+        c->z.next_out = (Bytef *)buf;
+        c->z.avail_out = sizeof(buf);
+        ret = deflate(&c->z, flush);
+        if (ret == Z_STREAM_ERROR) return HTTP_ERR_FAILED_WRITE;
+        size_t n = sizeof(buf) - c->z.avail_out;
+        if (n > 0 && (err = out(ctx, buf, n))) return err;
+    } while (c->z.avail_out == 0 || (finish && ret != Z_STREAM_END));
+    return HTTP_ERR_OK;
+#else
+    HTTP_UNUSED(c);
+    HTTP_UNUSED(in);
+    HTTP_UNUSED(len);
+    HTTP_UNUSED(finish);
+    HTTP_UNUSED(out);
+    HTTP_UNUSED(ctx);
+    return HTTP_ERR_NOT_IMPLEMENTED;
+#endif // HTTP_WITH_ZLIB
+}
+
+HTTP_Err http_compress(HTTP_Encoding e, int level, const char *in, size_t len, char **out, size_t *out_len) {
+#ifdef HTTP_WITH_ZLIB
+    HTTP_CompressorPool pool = { .level = (level < 1 || level > 9) ? 6 : level };
+    HTTP_Compressor *c = http_compressor_acquire(&pool, e);
+    if (c == NULL) return HTTP_ERR_OOM;
+
+    // The output fits into the bound at once, so a single call is enough
+    size_t cap = deflateBound(&c->z, len);
+    *out = malloc(cap);
+    if (*out != NULL) {
+        c->z.next_in = (Bytef *)in;
+        c->z.avail_in = len;
+        c->z.next_out = (Bytef *)*out;
+        c->z.avail_out = cap;
+        if (deflate(&c->z, Z_FINISH) == Z_STREAM_END) {
+            *out_len = cap - c->z.avail_out;
+        } else {
+            free(*out);
+            *out = NULL;
+        }
+    }
+    _compressor_destroy(c);
+    return *out ? HTTP_ERR_OK : HTTP_ERR_OOM;
+#else
+    HTTP_UNUSED(e);
+    HTTP_UNUSED(level);
+    HTTP_UNUSED(in);
+    HTTP_UNUSED(len);
+    HTTP_UNUSED(out);
+    HTTP_UNUSED(out_len);
+    return HTTP_ERR_NOT_IMPLEMENTED;
+#endif // HTTP_WITH_ZLIB
+}
+
+void http_compressor_pool_free(HTTP_CompressorPool *p) {
+    HTTP_Compressor *c = p->_free;
+    while (c != NULL) {
+        HTTP_Compressor *next = c->next;
+        _compressor_destroy(c);
+        c = next;
+    }
+    pthread_mutex_destroy(&p->_lock);
+    memset(p, 0, sizeof(*p));
+}
+
+HTTP_Err http_decompressor_pool_init(HTTP_DecompressorPool *p, size_t max_free) {
+    p->max_free = max_free;
+    p->_free = NULL;
+    p->_nfree = 0;
+    if (pthread_mutex_init(&p->_lock, NULL) != 0) return HTTP_ERR_OOM;
+    return HTTP_ERR_OK;
+}
+
+static void _decompressor_destroy(HTTP_Decompressor *d) {
+#ifdef HTTP_WITH_ZLIB
+    inflateEnd(&d->z);
+#endif // HTTP_WITH_ZLIB
+    free(d);
+}
+
+HTTP_Decompressor *http_decompressor_acquire(HTTP_DecompressorPool *p, HTTP_Encoding e) {
+#ifdef HTTP_WITH_ZLIB
+    if (e == HTTP_Encoding_IDENTITY) return NULL;
+
+    pthread_mutex_lock(&p->_lock);
+    HTTP_Decompressor **pd = &p->_free;
+    while (*pd && (*pd)->encoding != e) pd = &(*pd)->next;
+    HTTP_Decompressor *d = *pd;
+    if (d) {
+        *pd = d->next;
+        p->_nfree--;
+    }
+    pthread_mutex_unlock(&p->_lock);
+    if (d) return d;
+
+    if ((d = malloc(sizeof(HTTP_Decompressor))) == NULL) return NULL;
+    memset(d, 0, offsetof(HTTP_Decompressor, in));
+    d->encoding = e;
+    // 16+ accepts gzip framing only, otherwise the zlib one, which is what
+    // `deflate` means
+    int wbits = (e == HTTP_Encoding_GZIP) ? 16 + MAX_WBITS : MAX_WBITS;
+    if (inflateInit2(&d->z, wbits) != Z_OK) {
+        free(d);
+        return NULL;
+    }
+    return d;
+#else
+    HTTP_UNUSED(p);
+    HTTP_UNUSED(e);
+    return NULL;
+#endif // HTTP_WITH_ZLIB
+}
+
+void http_decompressor_release(HTTP_DecompressorPool *p, HTTP_Decompressor *d) {
+#ifdef HTTP_WITH_ZLIB
+    if (inflateReset(&d->z) != Z_OK) {
+        _decompressor_destroy(d);
+        return;
+    }
+    d->z.next_in = NULL;
+    d->z.avail_in = 0;
+#endif // HTTP_WITH_ZLIB
+    d->total_out = 0;
+    d->done = false;
+    pthread_mutex_lock(&p->_lock);
+    if (p->_nfree < p->max_free) {
+        d->next = p->_free;
+        p->_free = d;
+        p->_nfree++;
+        d = NULL;
+    }
+    pthread_mutex_unlock(&p->_lock);
+    if (d) _decompressor_destroy(d);
+}
+
+HTTP_Err http_decompressor_read(HTTP_Decompressor *d, char *out, size_t out_sz, size_t *out_len,
+                                HTTP_Err (*in)(void *ctx, char *buf, size_t sz, size_t *len), void *ctx) {
+    *out_len = 0;
+#ifdef HTTP_WITH_ZLIB
+    HTTP_Err err;
+    if (d->done) return HTTP_ERR_OK;
+
+    d->z.next_out = (Bytef *)out;
+    d->z.avail_out = out_sz;
+    while (d->z.avail_out > 0) {
+        if (d->z.avail_in == 0) {
+            size_t n = 0;
+            if ((err = in(ctx, d->in, sizeof(d->in), &n))) return err;
+            // The input is over before the stream is
+            if (n == 0) return HTTP_ERR_FAILED_PARSE;
+            d->z.next_in = (Bytef *)d->in;
+            d->z.avail_in = n;
+        }
+        int ret = inflate(&d->z, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            d->done = true;
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) return HTTP_ERR_FAILED_PARSE;
+        // Return what is inflated so far, rather than wait for more input
+        if (d->z.avail_in == 0 && d->z.avail_out < out_sz) break;
+    }
+    *out_len = out_sz - d->z.avail_out;
+    d->total_out += *out_len;
+    if (*out_len > 0) return HTTP_ERR_CONT;
+    return d->done ? HTTP_ERR_OK : HTTP_ERR_CONT;
+#else
+    HTTP_UNUSED(d);
+    HTTP_UNUSED(out);
+    HTTP_UNUSED(out_sz);
+    HTTP_UNUSED(in);
+    HTTP_UNUSED(ctx);
+    return HTTP_ERR_NOT_IMPLEMENTED;
+#endif // HTTP_WITH_ZLIB
+}
+
+void http_decompressor_pool_free(HTTP_DecompressorPool *p) {
+    HTTP_Decompressor *d = p->_free;
+    while (d != NULL) {
+        HTTP_Decompressor *next = d->next;
+        _decompressor_destroy(d);
+        d = next;
+    }
+    pthread_mutex_destroy(&p->_lock);
+    memset(p, 0, sizeof(*p));
+}
+
+#  endif // HTTP_COMPRESS_IMPL_GUARD
+#endif // HTTP_COMPRESS_IMPL
+
+/*
+ * Copyright (c) 2025 Artem Darizhapov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
@@ -29,7 +29,7 @@
         (da)->len += (carr_len);                                        \
     } while (0)
 #define http_da_reset(da) ({(da)->len = 0;})
-#define http_da_free(da) ({free((da)->items);})
+#define http_da_free(da) ({HTTP_FREE((da)->items);})
 
 #define http_sb_append_cstr(sb, cstr) http_da_append_carr((sb), (cstr), strlen(cstr))
 #define http_sb_append_format(sb, format, ...) do {                     \
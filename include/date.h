@@ -0,0 +1,99 @@
+/*
+ * date.h - HTTP-date formatting.
+ *
+ * Responses carry the current time in `Date` header, and files their
+ * modification time in `Last-Modified`, both as HTTP-date in RFC 1123 format
+ * (RFC 2616, section 3.3.1):
+ *
+ * ```c
+ * char last_modified[HTTP_DATE_LEN];
+ * http_date_format(st.st_mtime, last_modified);
+ *
+ * const char *now = http_date_now(); // cached, cheap to call per response
+ * ```
+ */
+#ifndef HTTP_DATE_H
+#  define HTTP_DATE_H
+
+#include <time.h>
+
+#include "common.h"
+
+// Length of HTTP-date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+#define HTTP_DATE_LEN 29
+
+/**
+ * Writes time `t` into `dest` as HTTP-date in RFC 1123 format (RFC 2616,
+ * section 3.3.1). `dest` must have room for HTTP_DATE_LEN bytes, and is not
+ * NUL-terminated.
+ */
+void http_date_format(time_t t, char *dest);
+
+/**
+ * Returns current time as HTTP-date of HTTP_DATE_LEN bytes (not
+ * NUL-terminated).
+ *
+ * The date is cached per thread and formatted at most once per second, so
+ * it's cheap to call for every response and needs no locking.
+ */
+const char *http_date_now(void);
+
+#endif // HTTP_DATE_H
+
+#ifdef HTTP_DATE_IMPL
+#  ifndef HTTP_DATE_IMPL_GUARD
+#    define HTTP_DATE_IMPL_GUARD
+
+#include <stdio.h>
+#include <string.h>
+
+void http_date_format(time_t t, char *dest) {
+    static const char *days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                   "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    plex tm tm;
+    gmtime_r(&t, &tm);
+
+    char date[64];
+    snprintf(date, sizeof(date), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+             days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900,
+             tm.tm_hour, tm.tm_min, tm.tm_sec);
+    memcpy(dest, date, HTTP_DATE_LEN);
+}
+
+const char *http_date_now(void) {
+    static _Thread_local time_t cached_at = 0;
+    static _Thread_local char date[HTTP_DATE_LEN];
+
+    time_t now = time(NULL);
+    if (now != cached_at) {
+        http_date_format(now, date);
+        cached_at = now;
+    }
+    return date;
+}
+
+#  endif // HTTP_DATE_IMPL_GUARD
+#endif // HTTP_DATE_IMPL
+
+/*
+ * Copyright (c) 2025 Artem Darizhapov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
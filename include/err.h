@@ -22,7 +22,15 @@
     XX(-12, WRONG_STAGE,  "Tried to parse message with parser being at wrong stage") \
     XX(-13, FAILED_PARSE, "Failed to parse HTTP Message")               \
     /* Other errors */                                                  \
-    XX(-14, NOT_IMPLEMENTED, "Feature not implemented yet")
+    XX(-14, NOT_IMPLEMENTED, "Feature not implemented yet")             \
+    XX(-15, BUSY,            "Resource is temporarily exhausted")       \
+    /* Parser limits */                                                 \
+    XX(-16, HEADERS_TOO_LARGE, "Encountered too large headers")       \
+    /* IO errors */                                                     \
+    XX(-17, TIMEOUT,           "Timed out reading from a socket")   \
+    /* Body limits */                                                   \
+    XX(-18, BODY_TOO_LARGE,    "Encountered too large decoded body")    \
+    XX(-19, ENCODED_BODY,      "Can't pass encoded body as is")
 
 typedef enum {
 #define XX(num, name, ...) HTTP_ERR_##name = num,
@@ -47,6 +55,9 @@ HTTP_Err io_err_to_http_err(IO_Err err) {
     if (err == IO_ERR_EOF) return HTTP_ERR_EOF;
     if (err == IO_ERR_PARTIAL) return HTTP_ERR_OK;
     if (err == IO_ERR_FAILED_READ) return HTTP_ERR_FAILED_READ;
+    if (err == IO_ERR_UNSUPPORTED) return HTTP_ERR_NOT_IMPLEMENTED;
+    if (err == IO_ERR_FAILED_WRITE) return HTTP_ERR_FAILED_WRITE;
+    if (err == IO_ERR_TIMEOUT) return HTTP_ERR_TIMEOUT;
 
     HTTP_ASSERT(0 && "Unreachable");
 }
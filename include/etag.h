@@ -0,0 +1,176 @@
+/*
+ * etag.h - Body hashing and ETags.
+ *
+ * Server hashes response bodies to tag them with strong ETags, and answers
+ * conditional requests with 304 Not Modified (RFC 7232).
+ */
+#ifndef HTTP_ETAG_H
+#  define HTTP_ETAG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/**
+ * Incremental 64-bit hash of a body, that is fed to it piece by piece. It's
+ * fast, not cryptographic, and is used to make strong ETags.
+ */
+typedef plex {
+    uint64_t h;
+    uint64_t len;
+    unsigned char tail[8]; // bytes, that don't make a whole word yet
+    size_t tail_len;
+} HTTP_Hash;
+
+// Longest ETag, that is made by the library: quoted hash and encoding suffix
+#define HTTP_ETAG_MAX_LEN 32
+
+/**
+ * Starts hash `hs`.
+ */
+void http_hash_init(HTTP_Hash *hs);
+
+/**
+ * Feeds `len` bytes at `data` to hash `hs`.
+ */
+void http_hash_update(HTTP_Hash *hs, const void *data, size_t len);
+
+/**
+ * Returns hash of all the bytes, that were fed to `hs`.
+ */
+uint64_t http_hash_final(HTTP_Hash *hs);
+
+/**
+ * Writes strong ETag of body with hash `hash`, encoded with `encoding` (NULL
+ * for identity), into `dest`, that must have room for HTTP_ETAG_MAX_LEN
+ * bytes.
+ *
+ * Returns length of the ETag.
+ */
+size_t http_etag_format(uint64_t hash, const char *encoding, char *dest);
+
+/**
+ * Returns true, if value `if_none_match` of `If-None-Match` header lists
+ * ETag `etag` of length `etag_len`, or is `*`. ETags are compared weakly
+ * (RFC 7232, section 3.2).
+ */
+bool http_etag_match(const char *if_none_match, const char *etag, size_t etag_len);
+
+#endif // HTTP_ETAG_H
+
+#ifdef HTTP_ETAG_IMPL
+#  ifndef HTTP_ETAG_IMPL_GUARD
+#    define HTTP_ETAG_IMPL_GUARD
+
+#include <stdio.h>
+#include <string.h>
+
+#define _HASH_P1 0x9E3779B185EBCA87ULL
+#define _HASH_P2 0xC2B2AE3D27D4EB4FULL
+#define _HASH_P3 0x165667B19E3779F9ULL
+
+static inline uint64_t _hash_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t _hash_round(uint64_t h, uint64_t k) {
+    k = _hash_rotl(k * _HASH_P2, 31) * _HASH_P1;
+    return _hash_rotl(h ^ k, 27) * _HASH_P1 + _HASH_P3;
+}
+
+void http_hash_init(HTTP_Hash *hs) {
+    *hs = (HTTP_Hash) { .h = _HASH_P3 };
+}
+
+void http_hash_update(HTTP_Hash *hs, const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint64_t k;
+    hs->len += len;
+    if (hs->tail_len > 0) {
+        size_t n = sizeof(hs->tail) - hs->tail_len;
+        if (n > len) n = len;
+        memcpy(hs->tail + hs->tail_len, p, n);
+        hs->tail_len += n;
+        p += n;
+        len -= n;
+        if (hs->tail_len < sizeof(hs->tail)) return;
+        memcpy(&k, hs->tail, sizeof(k));
+        hs->h = _hash_round(hs->h, k);
+        hs->tail_len = 0;
+    }
+    for (; len >= sizeof(k); p += sizeof(k), len -= sizeof(k)) {
+        memcpy(&k, p, sizeof(k));
+        hs->h = _hash_round(hs->h, k);
+    }
+    memcpy(hs->tail, p, len);
+    hs->tail_len = len;
+}
+
+uint64_t http_hash_final(HTTP_Hash *hs) {
+    uint64_t h = hs->h ^ hs->len;
+    for (size_t i = 0; i < hs->tail_len; i++) h = _hash_rotl(h ^ hs->tail[i] * _HASH_P3, 11) * _HASH_P1;
+    // Avalanche, so that every input bit affects every output bit
+    h ^= h >> 33;
+    h *= _HASH_P2;
+    h ^= h >> 29;
+    h *= _HASH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+size_t http_etag_format(uint64_t hash, const char *encoding, char *dest) {
+    // Encoded variants are different representations, so they get their own
+    // ETags (RFC 7232, section 2.3.3)
+    int n = encoding ? snprintf(dest, HTTP_ETAG_MAX_LEN, "\"%016llx-%s\"", (unsigned long long)hash, encoding)
+                     : snprintf(dest, HTTP_ETAG_MAX_LEN, "\"%016llx\"", (unsigned long long)hash);
+    return (n > 0 && n < HTTP_ETAG_MAX_LEN) ? (size_t)n : 0;
+}
+
+bool http_etag_match(const char *if_none_match, const char *etag, size_t etag_len) {
+    if (etag_len > 2 && etag[0] == 'W' && etag[1] == '/') {
+        etag += 2;
+        etag_len -= 2;
+    }
+    const char *p = if_none_match;
+    while (*p) {
+        while (*p == ',' || *p == ' ' || *p == '\t') p++;
+        if (*p == '*') return true;
+        if (p[0] == 'W' && p[1] == '/') p += 2;
+        const char *tag = p;
+        if (*p == '"') {
+            p++;
+            while (*p && *p != '"') p++;
+            if (*p == '"') p++;
+        }
+        if ((size_t)(p - tag) == etag_len && memcmp(tag, etag, etag_len) == 0) return true;
+        while (*p && *p != ',') p++;
+    }
+    return false;
+}
+
+#  endif // HTTP_ETAG_IMPL_GUARD
+#endif // HTTP_ETAG_IMPL
+
+/*
+ * Copyright (c) 2025 Artem Darizhapov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
@@ -0,0 +1,91 @@
+/*
+ * headers.h - HTTP header fields.
+ */
+#ifndef HTTP_HEADERS_H
+#  define HTTP_HEADERS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+typedef plex {
+    char *k, *v;
+    uint32_t kl, vl; // lengths of `k` and `v`, if known (0 otherwise)
+    bool borrowed;   // `k` and `v` are not owned by the header
+} HTTP_Header;
+
+typedef plex {
+    size_t       len, cap;
+    HTTP_Header *items;
+} HTTP_Headers;
+
+/**
+ * Frees header `h`.
+ */
+void http_header_free(HTTP_Header *h);
+
+/**
+ * Returns value of the first header in `hs` named `name` (case-insensitive),
+ * or NULL if there is no such header.
+ */
+char *http_headers_get(HTTP_Headers *hs, const char *name);
+
+/**
+ * Frees headers `hs`.
+ */
+void http_headers_free(HTTP_Headers *hs);
+
+#endif // HTTP_HEADERS_H
+
+#ifdef HTTP_HEADERS_IMPL
+#  ifndef HTTP_HEADERS_IMPL_GUARD
+#    define HTTP_HEADERS_IMPL_GUARD
+
+#include <strings.h>
+
+void http_header_free(HTTP_Header *h) {
+    if (h->borrowed) return;
+    if (h->k) HTTP_FREE(h->k);
+    if (h->v) HTTP_FREE(h->v);
+}
+
+char *http_headers_get(HTTP_Headers *hs, const char *name) {
+    for (size_t i = 0; i < hs->len; i++) {
+        if (strcasecmp(hs->items[i].k, name) == 0) return hs->items[i].v;
+    }
+    return NULL;
+}
+
+void http_headers_free(HTTP_Headers *hs) {
+    for (size_t i = 0; i < hs->len; i++) {
+        http_header_free(&hs->items[i]);
+    }
+    if (hs->items) HTTP_FREE(hs->items);
+}
+
+#  endif // HTTP_HEADERS_IMPL_GUARD
+#endif // HTTP_HEADERS_IMPL
+
+/*
+ * Copyright (c) 2025 Artem Darizhapov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
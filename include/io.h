@@ -25,13 +25,19 @@
 #ifndef IO_H
 #  define IO_H
 
-#define IO_ERR_MAP(XX)                                          \
-    XX(1, OK,          "OK"                                 )   \
-    XX(2, OOM,         "Out of memory"                      )   \
-    XX(3, OOB,         "Out of bounds"                      )   \
-    XX(4, EOF,         "End of file"                        )   \
-    XX(5, PARTIAL,     "Reader read less than was requested")   \
-    XX(6, FAILED_READ, "Failed to read from file descriptor")
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define IO_ERR_MAP(XX)                                           \
+    XX(1, OK,           "OK"                                 )   \
+    XX(2, OOM,          "Out of memory"                      )   \
+    XX(3, OOB,          "Out of bounds"                      )   \
+    XX(4, EOF,          "End of file"                        )   \
+    XX(5, PARTIAL,      "Reader read less than was requested")   \
+    XX(6, FAILED_READ,  "Failed to read from file descriptor")   \
+    XX(7, UNSUPPORTED,  "Operation is not supported"         )   \
+    XX(8, FAILED_WRITE, "Failed to write to file descriptor" )   \
+    XX(9, TIMEOUT,      "Timed out reading from file descriptor")
 
 
 typedef enum {
@@ -65,10 +71,20 @@ const char *io_err_to_cstr(IO_Err err);
  * in this range of memory: [start, end).
  *
  * NOTE: Case, when `start == end`, implies an empty buffer.
+ *
+ * Mirrored buffer (see io_buffer_init_mirrored()) maps the same storage twice
+ * back-to-back, so that `buf[i]` and `buf[i + cap + 1]` refer to the same
+ * byte. For such buffer any data region, as well as any free region, can be
+ * accessed contiguously from its beginning, without caring about wrapping.
+ *
+ * Buffer may also be backed by storage it doesn't own (see
+ * io_buffer_init_with()). Such storage is never freed by the buffer.
  */
 typedef struct {
     char *buf, *start, *end;
     size_t cap;
+    int mirrored;
+    int foreign;
 } IO_Buffer;
 
 /**
@@ -78,6 +94,31 @@ typedef struct {
  */
 IO_Err io_buffer_init(IO_Buffer *b, size_t cap);
 
+/**
+ * Initializes IO buffer `b` with `cap` capacity on top of `storage`, that is
+ * owned by the caller and must be at least `cap` + 1 bytes long.
+ *
+ * io_buffer_free() doesn't release such storage, and io_buffer_resize()
+ * moves the data into the storage of its own, leaving `storage` intact.
+ */
+IO_Err io_buffer_init_with(IO_Buffer *b, char *storage, size_t cap);
+
+/**
+ * Initializes mirrored IO buffer `b` with at least `cap` capacity.
+ *
+ * The storage is a memory file mapped twice into adjacent virtual memory, so
+ * its size is rounded up to the page size (see io_buffer_mirrored_cap()).
+ *
+ * Returns `IO_ERR_UNSUPPORTED` on platforms that do not support it.
+ */
+IO_Err io_buffer_init_mirrored(IO_Buffer *b, size_t cap);
+
+/**
+ * Returns capacity that a mirrored IO buffer gets, when initialized with
+ * `cap` capacity.
+ */
+size_t io_buffer_mirrored_cap(size_t cap);
+
 /**
  * Frees IO buffer `b`.
  */
@@ -106,6 +147,24 @@ char io_buffer_at(IO_Buffer *b, size_t pos);
  */
 IO_Err io_buffer_reset(IO_Buffer *b);
 
+/**
+ * Changes capacity of IO buffer `b` to `cap`, preserving its data.
+ *
+ * After resizing, the data is laid out contiguously from the beginning of the
+ * storage. If `cap` is less than the length of the data, returns
+ * `IO_ERR_OOB` and leaves the buffer intact.
+ */
+IO_Err io_buffer_resize(IO_Buffer *b, size_t cap);
+
+/**
+ * Returns the number of bytes of IO buffer (`b`) data, that are stored
+ * contiguously starting from the first valid byte, saving the pointer to that
+ * byte into `data`.
+ *
+ * For mirrored buffers the result always equals to io_buffer_len().
+ */
+size_t io_buffer_contiguous(IO_Buffer *b, char **data);
+
 /**
  * Advances IO buffer `b` by up to `n` bytes forward and returns number of
  * bytes the start pointer was advanced.
@@ -134,6 +193,29 @@ IO_Err io_buffer_nspit(IO_Buffer *src, char *dest, size_t n);
  */
 IO_Err io_buffer_append(IO_Buffer *dest, char *src, size_t n);
 
+/**
+ * Fills `iov` with the regions of IO Buffer `b`, that hold its data, in
+ * order. Data of a wrapped buffer occupies two regions, otherwise - one (or
+ * none, if the buffer is empty).
+ *
+ * Returns the number of filled regions.
+ */
+int io_buffer_data_iov(IO_Buffer *b, struct iovec iov[2]);
+
+/**
+ * Fills `iov` with the free regions of IO Buffer `b`, in the order they
+ * would be written to by io_buffer_append().
+ *
+ * Returns the number of filled regions.
+ */
+int io_buffer_space_iov(IO_Buffer *b, struct iovec iov[2]);
+
+/**
+ * Marks `n` bytes, that were written right into the free space of IO Buffer
+ * `b` (see io_buffer_space_iov()), as data.
+ */
+void io_buffer_commit(IO_Buffer *b, size_t n);
+
 /**
  * Reader entity.
  *
@@ -144,6 +226,7 @@ IO_Err io_buffer_append(IO_Buffer *dest, char *src, size_t n);
 typedef struct {
     IO_Buffer *b;
     size_t nread, pos;
+    size_t nsyscalls; // number of reads performed on `fd`
     int fd;
 } IO_Reader;
 
@@ -173,9 +256,9 @@ size_t io_reader_buffered(IO_Reader *r);
  * the buffer defines the maximum peekable window size.
  *
  * The function first checks whether any data is already buffered. If the
- * internal buffer is empty, it performs a direct read from the underlying
- * file descriptor into dest, then appends what was read into the internal
- * buffer so future peeks or reads see the same data.
+ * internal buffer is empty, it performs a single read from the underlying
+ * file descriptor straight into the internal buffer (see io_reader_fill()),
+ * so future peeks or reads see the same data.
  *
  * If data is already buffered, it copies up to `n` bytes from the buffer into
  * dest without consuming them.
@@ -202,16 +285,78 @@ IO_Err io_reader_npeek(IO_Reader *r, char *dest, size_t n);
  */
 IO_Err io_reader_nread(IO_Reader *r, char *dest, size_t n);
 
+// Maximum number of regions io_reader_readv() reads into at once
+#ifndef IO_IOV_MAX
+#  define IO_IOV_MAX 16
+#endif // IO_IOV_MAX
+
+/**
+ * Reads into regions `iov` (`iovcnt` of them) from reader (`r`), advancing
+ * the reader's position, until the regions are filled or the stream is
+ * closed. The number of bytes read is saved into `n`.
+ *
+ * Buffered data is consumed first. The rest is read straight from the file
+ * descriptor into `iov`, bypassing the internal buffer, so large reads are not
+ * split into buffer-sized pieces and are not copied twice.
+ *
+ * If the stream is closed before anything is read, returns `IO_ERR_EOF`; if
+ * it is closed later, returns `IO_ERR_PARTIAL`. On failed read returns
+ * `IO_ERR_FAILED_READ`, `n` still holds the number of bytes read before.
+ */
+IO_Err io_reader_readv(IO_Reader *r, const struct iovec *iov, int iovcnt, size_t *n);
+
+/**
+ * Moves `n` bytes from reader (`r`) into file descriptor `out_fd`, advancing
+ * the reader's position. The number of bytes written is saved into
+ * `written`.
+ *
+ * Buffered data is written first. On Linux, the rest is moved with splice(2)
+ * through a pipe, so it never reaches user space. If `out_fd` (or the
+ * reader's file descriptor) doesn't support splicing, or on other platforms,
+ * it falls back to read()/write() through a small stack buffer.
+ *
+ * If the stream is closed before anything is moved, returns `IO_ERR_EOF`; if
+ * it is closed later, returns `IO_ERR_PARTIAL`.
+ */
+IO_Err io_reader_splice(IO_Reader *r, int out_fd, size_t n, size_t *written);
+
 /**
  * Ensures that at least `n` bytes are available in the reader's (`r`)
- * internal buffer by performing a non-advancing read (peek) operation.
+ * internal buffer, without consuming them.
  *
- * This function allocates a temporary buffer of size `n` and calls
- * io_reader_npeek() to read or fetch data into the internal buffer without
- * consuming it. The temporary buffer is freed immediately after use.
+ * If fewer than `n` bytes are buffered, performs a single read straight into
+ * the buffer's free space (see io_reader_fill()). Returns `IO_ERR_OOB` if `n`
+ * exceeds the buffer capacity, and `IO_ERR_PARTIAL` if fewer than `n` bytes
+ * are buffered after the read.
  */
 IO_Err io_reader_prefetch(IO_Reader *r, size_t n);
 
+/**
+ * Performs a single read from the reader's (`r`) file descriptor, appending
+ * the data to the internal buffer.
+ *
+ * Unlike io_reader_npeek(), this function reads even if the buffer is not
+ * empty, straight into all of the buffer's free space. When the free space
+ * wraps around, both of its regions are filled with a single readv(). If the
+ * buffer is full, returns `IO_ERR_OOB`. If the stream is closed (EOF),
+ * returns `IO_ERR_EOF`. If the receive timeout of a socket expires, returns
+ * `IO_ERR_TIMEOUT`.
+ */
+IO_Err io_reader_fill(IO_Reader *r);
+
+/**
+ * Borrows the buffered bytes of reader `r` without copying or consuming
+ * them. `*data` is set to the first buffered byte.
+ *
+ * Returns the number of bytes, that are contiguous from `*data`. For a wrapped
+ * buffer this is less than io_reader_buffered(); consume the borrowed bytes
+ * to reach the rest.
+ *
+ * The pointer stays valid until the buffer is filled, reset or resized. Once
+ * done, release the bytes with io_reader_nconsume(r, NULL, n).
+ */
+size_t io_reader_borrow(IO_Reader *r, char **data);
+
 /**
  * Consumes up to `n` bytes from reader (`r`)'s internal buffer, copying
  * consumed data into `dest` (if non-NULL) and advancing the reader's position
@@ -243,6 +388,8 @@ IO_Err io_reader_discard(IO_Reader *r);
 #  ifndef IO_IMPL_GUARD
 #    define IO_IMPL_GUARD
 
+#include <errno.h>
+#include <stdbool.h>
 #include <string.h>
 
 #ifndef IO_ASSERT
@@ -259,12 +406,24 @@ IO_Err io_reader_discard(IO_Reader *r);
 #  define IO_MALLOC malloc
 #endif // IO_MALLOC
 
+#ifdef __linux__
+#  include <linux/memfd.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif // __linux__
+
 #ifndef IO_READ
 // TODO: Depending on platform, use different implementations of `read()`
 #  include <unistd.h>
 #  define IO_READ read
 #endif // IO_READ
 
+#ifndef IO_READV
+#  include <sys/uio.h>
+#  define IO_READV readv
+#endif // IO_READV
+
 
 #ifndef MIN
 #  define MIN(a, b) (((a) < (b)) ? (a) : (b))
@@ -283,16 +442,69 @@ const char *io_err_to_cstr(IO_Err err) {
 
 IO_Err io_buffer_init(IO_Buffer *b, size_t cap) {
     b->cap = cap;
+    b->mirrored = 0;
+    b->foreign = 0;
     b->end = b->start = b->buf = IO_MALLOC(cap + 1);
     if (b->buf == NULL) return IO_ERR_OOM;
     return IO_ERR_OK;
 }
 
-IO_Err io_buffer_free(IO_Buffer *b) {
-    free(b->buf);
+IO_Err io_buffer_init_with(IO_Buffer *b, char *storage, size_t cap) {
+    b->cap = cap;
+    b->mirrored = 0;
+    b->foreign = 1;
+    b->end = b->start = b->buf = storage;
     return IO_ERR_OK;
 }
 
+size_t io_buffer_mirrored_cap(size_t cap) {
+#ifdef __linux__
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (cap + 1 + page - 1) / page * page - 1;
+#else
+    return cap;
+#endif // __linux__
+}
+
+IO_Err io_buffer_init_mirrored(IO_Buffer *b, size_t cap) {
+#ifdef __linux__
+    size_t size = io_buffer_mirrored_cap(cap) + 1;
+
+    // NOTE: memfd_create() wrapper requires _GNU_SOURCE, so the syscall is
+    //       made directly
+    int fd = syscall(SYS_memfd_create, "io_buffer", MFD_CLOEXEC);
+    if (fd == -1) return IO_ERR_OOM;
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        return IO_ERR_OOM;
+    }
+
+    // Reserve address space for both mappings, then map the file over it
+    char *base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return IO_ERR_OOM;
+    }
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, 2 * size);
+        close(fd);
+        return IO_ERR_OOM;
+    }
+    close(fd);
+
+    b->cap = size - 1;
+    b->end = b->start = b->buf = base;
+    b->mirrored = 1;
+    b->foreign = 0;
+    return IO_ERR_OK;
+#else
+    (void)b;
+    (void)cap;
+    return IO_ERR_UNSUPPORTED;
+#endif // __linux__
+}
+
 /**
  * Returns physical size of the buffer.
  */
@@ -300,6 +512,17 @@ static inline size_t _io_buffer_size(IO_Buffer *b) {
     return b->cap + 1;
 }
 
+IO_Err io_buffer_free(IO_Buffer *b) {
+#ifdef __linux__
+    if (b->mirrored) {
+        if (b->buf) munmap(b->buf, 2 * _io_buffer_size(b));
+        return IO_ERR_OK;
+    }
+#endif // __linux__
+    if (!b->foreign) free(b->buf);
+    return IO_ERR_OK;
+}
+
 size_t io_buffer_len(IO_Buffer *b) {
     if (b->end >= b->start) return b->end - b->start;
     return _io_buffer_size(b) - (b->start - b->buf) + (b->end - b->buf);
@@ -310,6 +533,35 @@ IO_Err io_buffer_reset(IO_Buffer *b) {
     return IO_ERR_OK;
 }
 
+IO_Err io_buffer_resize(IO_Buffer *b, size_t cap) {
+    size_t len = io_buffer_len(b);
+    if (cap < len) return IO_ERR_OOB;
+
+    if (b->mirrored) {
+        if (io_buffer_mirrored_cap(cap) == b->cap) return IO_ERR_OK;
+
+        IO_Buffer nb = {0};
+        IO_Err err = io_buffer_init_mirrored(&nb, cap);
+        if (err != IO_ERR_OK) return err;
+        memcpy(nb.buf, b->start, len);
+        nb.end = nb.buf + len;
+        io_buffer_free(b);
+        *b = nb;
+        return IO_ERR_OK;
+    }
+
+    char *buf = IO_MALLOC(cap + 1);
+    if (buf == NULL) return IO_ERR_OOM;
+    IO_ASSERT(io_buffer_nspit(b, buf, len) == IO_ERR_OK);
+    if (!b->foreign) free(b->buf);
+
+    b->foreign = 0;
+    b->buf = b->start = buf;
+    b->end = buf + len;
+    b->cap = cap;
+    return IO_ERR_OK;
+}
+
 /**
  * Returns the number of bytes between the later (farthest-from-`buf`) of
  * `b->start` and `b->end` and the physical end of the storage region.
@@ -336,10 +588,22 @@ static inline size_t _io_buffer_left_until_wrap(IO_Buffer *b) {
     return _io_buffer_size(b) - (b->start - b->buf);
 }
 
+size_t io_buffer_contiguous(IO_Buffer *b, char **data) {
+    *data = b->start;
+    if (b->mirrored || b->end >= b->start) return io_buffer_len(b);
+    return _io_buffer_left_until_wrap(b);
+}
+
 size_t io_buffer_nadvance(IO_Buffer *b, size_t n) {
     size_t len = io_buffer_len(b);
     size_t to_shift = (n > len) ? len : n;
 
+    if (b->mirrored) {
+        b->start += to_shift;
+        if (b->start >= b->buf + _io_buffer_size(b)) b->start -= _io_buffer_size(b);
+        return to_shift;
+    }
+
     size_t cur_pos = b->start - b->buf;
     size_t new_pos = (cur_pos + to_shift) % _io_buffer_size(b);
 
@@ -350,6 +614,7 @@ size_t io_buffer_nadvance(IO_Buffer *b, size_t n) {
 }
 
 char io_buffer_at(IO_Buffer *b, size_t pos) {
+    if (b->mirrored) return b->start[pos];
     size_t cur_pos = b->start - b->buf;
     return b->buf[(cur_pos + pos) % _io_buffer_size(b)];
 }
@@ -358,7 +623,7 @@ IO_Err io_buffer_nspit(IO_Buffer *src, char *dest, size_t n) {
     if (n == 0 || dest == NULL) return IO_ERR_OK;
     if (n > io_buffer_len(src)) return IO_ERR_OOB;
 
-    if (src->end >= src->start) {
+    if (src->mirrored || src->end >= src->start) {
         memcpy(dest, src->start, n);
         return IO_ERR_OK;
     }
@@ -379,6 +644,13 @@ IO_Err io_buffer_append(IO_Buffer *dest, char *src, size_t n) {
     size_t space_left = dest->cap - len;
     if (n > space_left) return IO_ERR_OOB;
 
+    if (dest->mirrored) {
+        memcpy(dest->end, src, n);
+        dest->end += n;
+        if (dest->end >= dest->buf + _io_buffer_size(dest)) dest->end -= _io_buffer_size(dest);
+        return IO_ERR_OK;
+    }
+
     if (dest->start > dest->end) {
         memcpy(dest->end, src, n);
         dest->end += n;
@@ -401,10 +673,48 @@ IO_Err io_buffer_append(IO_Buffer *dest, char *src, size_t n) {
     return IO_ERR_OK;
 }
 
+int io_buffer_data_iov(IO_Buffer *b, struct iovec iov[2]) {
+    size_t len = io_buffer_len(b);
+    if (len == 0) return 0;
+
+    char *data;
+    size_t n = io_buffer_contiguous(b, &data);
+    iov[0] = (struct iovec) { .iov_base = data, .iov_len = n };
+    if (n == len) return 1;
+    iov[1] = (struct iovec) { .iov_base = b->buf, .iov_len = len - n };
+    return 2;
+}
+
+int io_buffer_space_iov(IO_Buffer *b, struct iovec iov[2]) {
+    size_t space_left = b->cap - io_buffer_len(b);
+    if (space_left == 0) return 0;
+
+    // Keep the buffer contiguous, when it's empty
+    if (b->start == b->end) b->start = b->end = b->buf;
+
+    if (b->mirrored || b->start > b->end) {
+        iov[0] = (struct iovec) { .iov_base = b->end, .iov_len = space_left };
+        return 1;
+    }
+
+    size_t n = MIN(_io_buffer_left_until_wrap(b), space_left);
+    iov[0] = (struct iovec) { .iov_base = b->end, .iov_len = n };
+    if (n == space_left) return 1;
+    iov[1] = (struct iovec) { .iov_base = b->buf, .iov_len = space_left - n };
+    return 2;
+}
+
+void io_buffer_commit(IO_Buffer *b, size_t n) {
+    IO_ASSERT(n <= b->cap - io_buffer_len(b) && "Out of bounds");
+    b->end += n;
+    if (b->end >= b->buf + _io_buffer_size(b)) b->end -= _io_buffer_size(b);
+}
+
 IO_Err io_reader_init(IO_Reader *r, IO_Buffer *b, int fd) {
     r->b = b;
     r->fd = fd;
     r->pos = r->nread = 0;
+    r->nsyscalls = 0;
     return IO_ERR_OK;
 }
 
@@ -419,13 +729,9 @@ IO_Err io_reader_npeek(IO_Reader *r, char *dest, size_t n) {
 
     size_t buffered = io_reader_buffered(r);
     if (buffered == 0) {
-        int nread = IO_READ(r->fd, dest, n);
-        if (nread < 0) return IO_ERR_FAILED_READ;
-        if (nread == 0) return IO_ERR_EOF;
-        IO_ASSERT(io_buffer_append(r->b, dest, nread) == IO_ERR_OK);
-        r->nread += nread;
-        if ((size_t)nread < n) return IO_ERR_PARTIAL;
-        return IO_ERR_OK;
+        IO_Err err = io_reader_fill(r);
+        if (err != IO_ERR_OK) return err;
+        buffered = io_reader_buffered(r);
     }
 
     size_t to_copy = MIN(buffered, n);
@@ -434,12 +740,223 @@ IO_Err io_reader_npeek(IO_Reader *r, char *dest, size_t n) {
     return IO_ERR_OK;
 }
 
+IO_Err io_reader_readv(IO_Reader *r, const struct iovec *iov, int iovcnt, size_t *n) {
+    *n = 0;
+    if (iovcnt > IO_IOV_MAX) iovcnt = IO_IOV_MAX;
+
+    // Work on a copy, advancing it past the filled bytes
+    struct iovec v[IO_IOV_MAX];
+    int k = 0, cnt = 0;
+    for (int i = 0; i < iovcnt; i++) if (iov[i].iov_len > 0) v[cnt++] = iov[i];
+
+    for (; k < cnt && io_reader_buffered(r) > 0; k++) {
+        size_t to_copy = MIN(v[k].iov_len, io_reader_buffered(r));
+        io_reader_nconsume(r, v[k].iov_base, to_copy);
+        *n += to_copy;
+        if (to_copy < v[k].iov_len) {
+            v[k].iov_base = (char *)v[k].iov_base + to_copy;
+            v[k].iov_len -= to_copy;
+            break;
+        }
+    }
+
+    while (k < cnt) {
+        ssize_t nread = (cnt - k == 1)
+            ? IO_READ(r->fd, v[k].iov_base, v[k].iov_len)
+            : IO_READV(r->fd, v + k, cnt - k);
+        r->nsyscalls++;
+        if (nread < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return IO_ERR_TIMEOUT;
+            return IO_ERR_FAILED_READ;
+        }
+        if (nread == 0) return (*n == 0) ? IO_ERR_EOF : IO_ERR_PARTIAL;
+
+        r->nread += nread;
+        r->pos += nread;
+        *n += nread;
+        for (size_t left = nread; left > 0;) {
+            size_t step = MIN(left, v[k].iov_len);
+            v[k].iov_base = (char *)v[k].iov_base + step;
+            v[k].iov_len -= step;
+            left -= step;
+            if (v[k].iov_len == 0) k++;
+        }
+    }
+
+    return IO_ERR_OK;
+}
+
+#ifndef IO_SPLICE_CHUNK_SZ
+#  define IO_SPLICE_CHUNK_SZ (64*1<<10)
+#endif // IO_SPLICE_CHUNK_SZ
+
+// Size of the stack buffer, used when splicing is not available
+#ifndef IO_COPY_CHUNK_SZ
+#  define IO_COPY_CHUNK_SZ (16*1<<10)
+#endif // IO_COPY_CHUNK_SZ
+
+static IO_Err _io_write_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t nwritten = write(fd, buf, n);
+        if (nwritten < 0) {
+            if (errno == EINTR) continue;
+            return IO_ERR_FAILED_WRITE;
+        }
+        buf += nwritten;
+        n -= nwritten;
+    }
+    return IO_ERR_OK;
+}
+
+/**
+ * Moves up to `n` bytes from file descriptor `in_fd` into `out_fd` through a
+ * stack buffer, adding the number of bytes moved to `moved`.
+ *
+ * Returns `IO_ERR_EOF`, if `in_fd` is closed before `n` bytes are moved.
+ */
+static IO_Err _io_copy(int in_fd, int out_fd, size_t n, size_t *moved, size_t *nsyscalls) {
+    char chunk[IO_COPY_CHUNK_SZ];
+    for (size_t left = n; left > 0;) {
+        ssize_t nread = IO_READ(in_fd, chunk, MIN(left, sizeof(chunk)));
+        (*nsyscalls)++;
+        if (nread < 0) {
+            if (errno == EINTR) continue;
+            return IO_ERR_FAILED_READ;
+        }
+        if (nread == 0) return IO_ERR_EOF;
+
+        IO_Err err = _io_write_all(out_fd, chunk, nread);
+        if (err != IO_ERR_OK) return err;
+        *moved += nread;
+        left -= nread;
+    }
+    return IO_ERR_OK;
+}
+
+#ifdef __linux__
+#  ifndef SPLICE_F_MOVE
+#    define SPLICE_F_MOVE 1
+#  endif // SPLICE_F_MOVE
+#  ifndef SPLICE_F_MORE
+#    define SPLICE_F_MORE 4
+#  endif // SPLICE_F_MORE
+
+// NOTE: splice() wrapper requires _GNU_SOURCE, so the syscall is made directly
+static inline ssize_t _io_splice(int in_fd, int out_fd, size_t n) {
+    return syscall(SYS_splice, in_fd, NULL, out_fd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+}
+
+/**
+ * Moves up to `n` bytes from file descriptor `in_fd` into `out_fd` through
+ * pipe `pipefd` with splice(), adding the number of bytes moved to `moved`.
+ *
+ * Returns `IO_ERR_UNSUPPORTED`, if nothing was moved, because either of the
+ * file descriptors doesn't support splicing.
+ */
+static IO_Err _io_splice_through(int in_fd, int out_fd, int pipefd[2], size_t n, size_t *moved, size_t *nsyscalls) {
+    bool splice_out = true;
+    for (size_t left = n; left > 0;) {
+        ssize_t nin = _io_splice(in_fd, pipefd[1], MIN(left, IO_SPLICE_CHUNK_SZ));
+        (*nsyscalls)++;
+        if (nin < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL && left == n) return IO_ERR_UNSUPPORTED;
+            return IO_ERR_FAILED_READ;
+        }
+        if (nin == 0) return IO_ERR_EOF;
+        left -= nin;
+
+        while (nin > 0) {
+            ssize_t nout = splice_out ? _io_splice(pipefd[0], out_fd, nin) : -1;
+            if (nout < 0 && splice_out) {
+                if (errno == EINTR) continue;
+                if (errno != EINVAL) return IO_ERR_FAILED_WRITE;
+                splice_out = false;
+            }
+            if (!splice_out) {
+                // `out_fd` doesn't support splicing, so drain the pipe through
+                // user space
+                size_t drained = 0;
+                IO_Err err = _io_copy(pipefd[0], out_fd, nin, &drained, nsyscalls);
+                if (err != IO_ERR_OK) return err;
+                nout = drained;
+            }
+            *moved += nout;
+            nin -= nout;
+        }
+    }
+    return IO_ERR_OK;
+}
+#endif // __linux__
+
+IO_Err io_reader_splice(IO_Reader *r, int out_fd, size_t n, size_t *written) {
+    *written = 0;
+
+    struct iovec iov[2];
+    int iovcnt = io_buffer_data_iov(r->b, iov);
+    for (int k = 0; k < iovcnt && *written < n; k++) {
+        size_t m = MIN(iov[k].iov_len, n - *written);
+        IO_Err err = _io_write_all(out_fd, iov[k].iov_base, m);
+        if (err != IO_ERR_OK) return err;
+        io_reader_nconsume(r, NULL, m);
+        *written += m;
+    }
+    if (*written == n) return IO_ERR_OK;
+
+    size_t moved = 0;
+    IO_Err err = IO_ERR_UNSUPPORTED;
+#ifdef __linux__
+    int pipefd[2];
+    if (pipe(pipefd) == 0) {
+        err = _io_splice_through(r->fd, out_fd, pipefd, n - *written, &moved, &r->nsyscalls);
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+#endif // __linux__
+    if (err == IO_ERR_UNSUPPORTED) err = _io_copy(r->fd, out_fd, n - *written, &moved, &r->nsyscalls);
+
+    r->nread += moved;
+    r->pos += moved;
+    *written += moved;
+    if (err == IO_ERR_EOF && *written > 0) return IO_ERR_PARTIAL;
+    return err;
+}
+
 IO_Err io_reader_prefetch(IO_Reader *r, size_t n) {
-    char *tmp = IO_MALLOC(n);
-    if (tmp == NULL) return IO_ERR_OOM;
-    IO_Err res = io_reader_npeek(r, tmp, n);
-    free(tmp);
-    return res;
+    if (n > r->b->cap) return IO_ERR_OOB;
+    if (io_reader_buffered(r) >= n) return IO_ERR_OK;
+
+    IO_Err err = io_reader_fill(r);
+    if (err != IO_ERR_OK) return err;
+    if (io_reader_buffered(r) < n) return IO_ERR_PARTIAL;
+    return IO_ERR_OK;
+}
+
+IO_Err io_reader_fill(IO_Reader *r) {
+    struct iovec iov[2];
+    int iovcnt = io_buffer_space_iov(r->b, iov);
+    if (iovcnt == 0) return IO_ERR_OOB;
+
+    ssize_t nread = (iovcnt == 1)
+        ? IO_READ(r->fd, iov[0].iov_base, iov[0].iov_len)
+        : IO_READV(r->fd, iov, iovcnt);
+    r->nsyscalls++;
+    if (nread < 0) {
+        // Blocking socket with receive timeout set (SO_RCVTIMEO)
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return IO_ERR_TIMEOUT;
+        return IO_ERR_FAILED_READ;
+    }
+    if (nread == 0) return IO_ERR_EOF;
+
+    io_buffer_commit(r->b, nread);
+    r->nread += nread;
+
+    return IO_ERR_OK;
+}
+
+size_t io_reader_borrow(IO_Reader *r, char **data) {
+    return io_buffer_contiguous(r->b, data);
 }
 
 IO_Err io_reader_nconsume(IO_Reader *r, char *dest, size_t n) {
@@ -472,6 +989,7 @@ IO_Err io_reader_nread(IO_Reader *r, char *dest, size_t n) {
     size_t to_read = n - copied;
     if (to_read > 0) {
         int nread = IO_READ(r->fd, dest + copied, to_read);
+        r->nsyscalls++;
         if (nread < 0) return IO_ERR_FAILED_READ;
         if (nread == 0 && copied == 0) return IO_ERR_EOF;
 
@@ -21,9 +21,7 @@
 #  define HTTP_TODO(...) http_log("TODO", __VA_ARGS__)
 #endif
 
-/* #ifndef HTTP_LOG_REQUEST */
-/* #  define HTTP_LOG_REQUEST(req) http_log_request(req) */
-/* #endif */
+// NOTE: Requests are logged by the server apart, see accesslog.h
 
 void http_log(const char *level, const char *fmt, ...) {
     fprintf(stderr, "[%s] ", level);
@@ -34,18 +32,6 @@ void http_log(const char *level, const char *fmt, ...) {
     fprintf(stderr, "\n");
 }
 
-/* void http_log_request(HTTP_Request req) { */
-/*     time_t timer; */
-/*     char time_repr[26]; */
-/*     plex tm* tm_info; */
-
-/*     timer = time(NULL); */
-/*     tm_info = localtime(&timer); */
-
-/*     strftime(time_repr, 26, "%Y-%m-%d %H:%M:%S", tm_info); */
-/*     HTTP_INFO("%s - %s - \"%s %s HTTP/%d.%d\"", time_repr, req.addr, req.method, req.uri, req.httpver.maj, req.httpver.min); */
-/* } */
-
 #endif // HTTP_LOG_H
 
 /*
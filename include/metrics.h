@@ -0,0 +1,337 @@
+/*
+ * metrics.h - Per-route request counters and latency histograms.
+ *
+ * Every thread, that serves requests, counts them in its own shard, so
+ * counting takes neither locks nor atomic read-modify-write instructions:
+ * each counter has a single writer, and is only read by the others. Shards
+ * are summed up, when the metrics are exported in Prometheus text format:
+ *
+ * ```c
+ * HTTP_Metrics m = {0};
+ * http_metrics_init(&m, nroutes);
+ *
+ * HTTP_RouteMetrics *r = http_metrics_route(&m, route);
+ * http_metrics_count(&m, r, 200, bytes_in, bytes_out);
+ * http_histogram_record(&r->total, elapsed_ns);
+ *
+ * HTTP_StringBuilder sb = {0};
+ * http_metrics_export(&m, route_names, &sb);
+ *
+ * http_metrics_free(&m);
+ * ```
+ *
+ * Latencies are kept in HDR-style histograms: buckets grow exponentially,
+ * and each power of two is split into HTTP_HISTOGRAM_SUB_BUCKETS linear
+ * ones, so any latency from a microsecond to a minute is recorded with a
+ * bounded relative error.
+ */
+#ifndef HTTP_METRICS_H
+#  define HTTP_METRICS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "common.h"
+#include "da.h"
+#include "err.h"
+#include "perthread.h"
+
+// Every power of two is split into 2^HTTP_HISTOGRAM_SUB_BITS linear buckets
+#ifndef HTTP_HISTOGRAM_SUB_BITS
+#  define HTTP_HISTOGRAM_SUB_BITS 2
+#endif // HTTP_HISTOGRAM_SUB_BITS
+
+// Latencies above 2^HTTP_HISTOGRAM_MAX_EXP microseconds fall into the last bucket
+#ifndef HTTP_HISTOGRAM_MAX_EXP
+#  define HTTP_HISTOGRAM_MAX_EXP 26
+#endif // HTTP_HISTOGRAM_MAX_EXP
+
+#define HTTP_HISTOGRAM_SUB_BUCKETS (1 << HTTP_HISTOGRAM_SUB_BITS)
+#define HTTP_HISTOGRAM_BUCKETS \
+    (HTTP_HISTOGRAM_SUB_BUCKETS * (HTTP_HISTOGRAM_MAX_EXP - HTTP_HISTOGRAM_SUB_BITS + 2))
+
+// Status codes of HTTP_STATUS_MAP are counted separately, the rest together
+#define XX(...) + 1
+enum { HTTP_METRICS_STATUSES = 1 HTTP_STATUS_MAP(XX) };
+#undef XX
+
+typedef plex {
+    atomic_uint_fast64_t buckets[HTTP_HISTOGRAM_BUCKETS]; // in microseconds
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum_ns;
+} HTTP_Histogram;
+
+typedef plex {
+    atomic_uint_fast64_t requests[HTTP_METRICS_STATUSES]; // by status code
+    atomic_uint_fast64_t bytes_in, bytes_out;
+    HTTP_Histogram parse;   // receiving and parsing the head
+    HTTP_Histogram handler; // calling the handler
+    HTTP_Histogram total;   // serving the whole request
+} HTTP_RouteMetrics;
+
+typedef plex http_metrics_shard_s {
+    plex http_metrics_shard_s *next;
+    HTTP_RouteMetrics routes[];
+} HTTP_MetricsShard;
+
+typedef plex {
+    size_t nroutes;
+
+    HTTP_PerThread _shards;        // HTTP_MetricsShard of each thread
+    uint8_t _status_idx[600];      // index of status code in `requests`
+} HTTP_Metrics;
+
+/**
+ * Initializes metrics `m` of `nroutes` routes (numbered from 0).
+ */
+HTTP_Err http_metrics_init(HTTP_Metrics *m, size_t nroutes);
+
+/**
+ * Returns counters of route `route` of metrics `m`, that belong to the
+ * calling thread, or NULL, if failed to allocate them.
+ */
+HTTP_RouteMetrics *http_metrics_route(HTTP_Metrics *m, size_t route);
+
+/**
+ * Counts request to route `r`, that was answered with status code `sc`,
+ * having received `bytes_in` bytes and sent `bytes_out` bytes.
+ */
+void http_metrics_count(HTTP_Metrics *m, HTTP_RouteMetrics *r, uint16_t sc, uint64_t bytes_in, uint64_t bytes_out);
+
+/**
+ * Records latency of `ns` nanoseconds into histogram `h`.
+ *
+ * NOTE: `h` must belong to the calling thread (see http_metrics_route()).
+ */
+void http_histogram_record(HTTP_Histogram *h, uint64_t ns);
+
+/**
+ * Returns the upper bound of bucket `i` of a histogram in microseconds.
+ */
+uint64_t http_histogram_bucket_bound(size_t i);
+
+/**
+ * Appends metrics `m` of all threads to `out` in Prometheus text format.
+ * Routes are labeled with `route_names` (`nroutes` of them, NULL ones are
+ * labeled as "none").
+ */
+HTTP_Err http_metrics_export(HTTP_Metrics *m, const char *const *route_names, HTTP_StringBuilder *out);
+
+/**
+ * Frees metrics `m` with the shards of all threads.
+ */
+void http_metrics_free(HTTP_Metrics *m);
+
+#endif // HTTP_METRICS_H
+
+#ifdef HTTP_METRICS_IMPL
+#  ifndef HTTP_METRICS_IMPL_GUARD
+#    define HTTP_METRICS_IMPL_GUARD
+
+#include <stdlib.h>
+#include <string.h>
+
+HTTP_Err http_metrics_init(HTTP_Metrics *m, size_t nroutes) {
+    m->nroutes = nroutes;
+
+    static const uint16_t statuses[] = {
+#define XX(num, ...) num,
+        HTTP_STATUS_MAP(XX)
+#undef XX
+    };
+    memset(m->_status_idx, 0, sizeof(m->_status_idx));
+    for (size_t i = 0; i < sizeof(statuses)/sizeof(statuses[0]); i++) {
+        if (statuses[i] < sizeof(m->_status_idx)) m->_status_idx[statuses[i]] = i + 1;
+    }
+
+    size_t sz = sizeof(HTTP_MetricsShard) + nroutes * sizeof(HTTP_RouteMetrics);
+    if (!http_per_thread_init(&m->_shards, sz, offsetof(HTTP_MetricsShard, next))) return HTTP_ERR_OOM;
+    return HTTP_ERR_OK;
+}
+
+HTTP_RouteMetrics *http_metrics_route(HTTP_Metrics *m, size_t route) {
+    HTTP_ASSERT(route < m->nroutes && "Unknown route");
+    HTTP_MetricsShard *sh = http_per_thread_get(&m->_shards);
+    if (sh == NULL) return NULL;
+    return &sh->routes[route];
+}
+
+/**
+ * Adds `v` to counter `c`, that has no other writers, so it doesn't need
+ * an atomic read-modify-write.
+ */
+static inline void _metrics_add(atomic_uint_fast64_t *c, uint64_t v) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+void http_metrics_count(HTTP_Metrics *m, HTTP_RouteMetrics *r, uint16_t sc, uint64_t bytes_in, uint64_t bytes_out) {
+    size_t idx = sc < sizeof(m->_status_idx) ? m->_status_idx[sc] : 0;
+    _metrics_add(&r->requests[idx], 1);
+    _metrics_add(&r->bytes_in, bytes_in);
+    _metrics_add(&r->bytes_out, bytes_out);
+}
+
+/**
+ * Returns index of the bucket, that latency of `us` microseconds falls into.
+ */
+static size_t _histogram_bucket(uint64_t us) {
+    if (us < HTTP_HISTOGRAM_SUB_BUCKETS) return us;
+    size_t exp = 63 - __builtin_clzll(us);
+    // The bits right after the leading one select the linear bucket
+    size_t sub = (us >> (exp - HTTP_HISTOGRAM_SUB_BITS)) & (HTTP_HISTOGRAM_SUB_BUCKETS - 1);
+    size_t i = HTTP_HISTOGRAM_SUB_BUCKETS * (exp - HTTP_HISTOGRAM_SUB_BITS + 1) + sub;
+    return i < HTTP_HISTOGRAM_BUCKETS ? i : HTTP_HISTOGRAM_BUCKETS - 1;
+}
+
+uint64_t http_histogram_bucket_bound(size_t i) {
+    if (i < HTTP_HISTOGRAM_SUB_BUCKETS) return i + 1;
+    size_t exp = i / HTTP_HISTOGRAM_SUB_BUCKETS + HTTP_HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = i % HTTP_HISTOGRAM_SUB_BUCKETS;
+    return (HTTP_HISTOGRAM_SUB_BUCKETS + sub + 1) << (exp - HTTP_HISTOGRAM_SUB_BITS);
+}
+
+void http_histogram_record(HTTP_Histogram *h, uint64_t ns) {
+    _metrics_add(&h->buckets[_histogram_bucket(ns / 1000)], 1);
+    _metrics_add(&h->count, 1);
+    _metrics_add(&h->sum_ns, ns);
+}
+
+/**
+ * Sums up counters of route `route` of all shards, that start at `shards`,
+ * into `sum`.
+ */
+static void _metrics_sum(HTTP_MetricsShard *shards, size_t route, HTTP_RouteMetrics *sum) {
+    uint64_t *dst = (uint64_t *)sum;
+    size_t n = sizeof(HTTP_RouteMetrics) / sizeof(atomic_uint_fast64_t);
+    _Static_assert(sizeof(atomic_uint_fast64_t) == sizeof(uint64_t), "Counters must be plain 64-bit words");
+    memset(sum, 0, sizeof(*sum));
+    for (HTTP_MetricsShard *sh = shards; sh; sh = sh->next) {
+        atomic_uint_fast64_t *src = (atomic_uint_fast64_t *)&sh->routes[route];
+        for (size_t i = 0; i < n; i++) dst[i] += atomic_load_explicit(&src[i], memory_order_relaxed);
+    }
+}
+
+/**
+ * Appends label value `v` to `out`, escaping it (Prometheus text format).
+ */
+static void _metrics_append_label(HTTP_StringBuilder *out, const char *v) {
+    for (; *v; v++) {
+        if (*v == '\\' || *v == '"') http_sb_append_char(out, '\\');
+        if (*v == '\n') {
+            http_sb_append_cstr(out, "\\n");
+            continue;
+        }
+        http_sb_append_char(out, *v);
+    }
+}
+
+static void _metrics_export_histogram(HTTP_StringBuilder *out, const char *name, const char *route, HTTP_Histogram *h) {
+    uint64_t *buckets = (uint64_t *)h->buckets, count = (uint64_t)h->count, sum_ns = (uint64_t)h->sum_ns;
+    // Buckets past the last non-empty one add nothing but lines
+    size_t last = 0;
+    for (size_t i = 0; i < HTTP_HISTOGRAM_BUCKETS; i++) if (buckets[i] > 0) last = i;
+
+    uint64_t cum = 0;
+    for (size_t i = 0; i <= last && i < HTTP_HISTOGRAM_BUCKETS - 1; i++) {
+        cum += buckets[i];
+        http_sb_append_format(out, "%s_bucket{route=\"", name);
+        _metrics_append_label(out, route);
+        http_sb_append_format(out, "\",le=\"%g\"} %llu\n", http_histogram_bucket_bound(i) / 1e6, (unsigned long long)cum);
+    }
+    http_sb_append_format(out, "%s_bucket{route=\"", name);
+    _metrics_append_label(out, route);
+    http_sb_append_format(out, "\",le=\"+Inf\"} %llu\n", (unsigned long long)count);
+    http_sb_append_format(out, "%s_sum{route=\"", name);
+    _metrics_append_label(out, route);
+    http_sb_append_format(out, "\"} %.9f\n", sum_ns / 1e9);
+    http_sb_append_format(out, "%s_count{route=\"", name);
+    _metrics_append_label(out, route);
+    http_sb_append_format(out, "\"} %llu\n", (unsigned long long)count);
+}
+
+HTTP_Err http_metrics_export(HTTP_Metrics *m, const char *const *route_names, HTTP_StringBuilder *out) {
+    static const uint16_t statuses[] = {
+        0,
+#define XX(num, ...) num,
+        HTTP_STATUS_MAP(XX)
+#undef XX
+    };
+    HTTP_RouteMetrics *sums = malloc(m->nroutes * sizeof(HTTP_RouteMetrics));
+    if (sums == NULL && m->nroutes > 0) return HTTP_ERR_OOM;
+    HTTP_MetricsShard *shards = http_per_thread_list(&m->_shards);
+    for (size_t r = 0; r < m->nroutes; r++) _metrics_sum(shards, r, &sums[r]);
+
+    http_sb_append_cstr(out, "# HELP http_requests_total Requests served, by route and status code.\n"
+                             "# TYPE http_requests_total counter\n");
+    for (size_t r = 0; r < m->nroutes; r++) {
+        const char *route = route_names[r] ? route_names[r] : "none";
+        for (size_t i = 0; i < HTTP_METRICS_STATUSES; i++) {
+            uint64_t count = (uint64_t)sums[r].requests[i];
+            if (count == 0) continue;
+            http_sb_append_cstr(out, "http_requests_total{route=\"");
+            _metrics_append_label(out, route);
+            if (i == 0) http_sb_append_format(out, "\",status=\"other\"} %llu\n", (unsigned long long)count);
+            else http_sb_append_format(out, "\",status=\"%u\"} %llu\n", statuses[i], (unsigned long long)count);
+        }
+    }
+
+#define _EXPORT_COUNTER(name, help, field) do {                         \
+        http_sb_append_cstr(out, "# HELP " name " " help "\n# TYPE " name " counter\n"); \
+        for (size_t r = 0; r < m->nroutes; r++) {                       \
+            http_sb_append_cstr(out, name "{route=\"");                 \
+            _metrics_append_label(out, route_names[r] ? route_names[r] : "none"); \
+            http_sb_append_format(out, "\"} %llu\n", (unsigned long long)sums[r].field); \
+        }                                                               \
+    } while (0)
+    _EXPORT_COUNTER("http_request_bytes_total", "Bytes received, by route.", bytes_in);
+    _EXPORT_COUNTER("http_response_bytes_total", "Bytes sent, by route.", bytes_out);
+#undef _EXPORT_COUNTER
+
+#define _EXPORT_HISTOGRAM(name, help, field) do {                       \
+        http_sb_append_cstr(out, "# HELP " name " " help "\n# TYPE " name " histogram\n"); \
+        for (size_t r = 0; r < m->nroutes; r++) {                       \
+            if (sums[r].field.count == 0) continue;                     \
+            _metrics_export_histogram(out, name, route_names[r] ? route_names[r] : "none", &sums[r].field); \
+        }                                                               \
+    } while (0)
+    _EXPORT_HISTOGRAM("http_request_parse_seconds", "Time spent receiving and parsing request heads, by route.", parse);
+    _EXPORT_HISTOGRAM("http_request_handler_seconds", "Time spent in handlers, by route.", handler);
+    _EXPORT_HISTOGRAM("http_request_duration_seconds", "Time spent serving requests, by route.", total);
+#undef _EXPORT_HISTOGRAM
+
+    free(sums);
+    return HTTP_ERR_OK;
+}
+
+void http_metrics_free(HTTP_Metrics *m) {
+    http_per_thread_free(&m->_shards);
+    memset(m, 0, sizeof(*m));
+}
+
+#  endif // HTTP_METRICS_IMPL_GUARD
+#endif // HTTP_METRICS_IMPL
+
+/*
+ * Copyright (c) 2025 Artem Darizhapov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
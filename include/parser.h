@@ -62,7 +62,8 @@
  *        1. Chunked message body (when Transfer-Encoding header is
  *           specified). Message body is parsed only when message has
  *           explicitly specified header 'Content-Length', otherwise it is
- *           omitted;
+ *           omitted. Messages with Transfer-Encoding are rejected, since
+ *           their body can't be told apart from the next message;
  *       2. Keep-alive connections;
  *       3. Upgrade connections;
  *       4. Multi-line header values;
@@ -76,10 +77,14 @@
 #include <stdint.h>
 
 #include "common.h"
+#include "headers.h"
 #ifdef HTTP_PARSER_IMPL
 #  define IO_IMPL
 #  define HTTP_URL_IMPL
+#  define HTTP_ARENA_IMPL
 #endif // HTTP_PARSER_IMPL
+#include "arena.h"
+#include "clock.h"
 #include "io.h"
 #include "url.h"
 
@@ -95,6 +100,42 @@ typedef enum {
 #  define HTTP_PARSER_URL_MAX_LEN 256
 #endif // HTTP_PARSER_URL_MAX_LEN
 
+// Default limits on the headers of a single message (see HTTP_ParserLimits)
+#ifndef HTTP_PARSER_HEADER_LINE_MAX_SZ
+#  define HTTP_PARSER_HEADER_LINE_MAX_SZ (8*1<<10)
+#endif // HTTP_PARSER_HEADER_LINE_MAX_SZ
+
+#ifndef HTTP_PARSER_HEADERS_MAX_SZ
+#  define HTTP_PARSER_HEADERS_MAX_SZ (32*1<<10)
+#endif // HTTP_PARSER_HEADERS_MAX_SZ
+
+#ifndef HTTP_PARSER_HEADERS_MAX_COUNT
+#  define HTTP_PARSER_HEADERS_MAX_COUNT 100
+#endif // HTTP_PARSER_HEADERS_MAX_COUNT
+
+// Initial size of the receive buffer. When a line of the message doesn't fit
+// into the buffer, it grows geometrically up to HTTP_PARSER_BUF_MAX_SZ, and
+// shrinks back once the headers are parsed.
+#ifndef HTTP_PARSER_BUF_SZ
+#  define HTTP_PARSER_BUF_SZ (4*1<<10)
+#endif // HTTP_PARSER_BUF_SZ
+
+#ifndef HTTP_PARSER_BUF_MAX_SZ
+#  define HTTP_PARSER_BUF_MAX_SZ (64*1<<10)
+#endif // HTTP_PARSER_BUF_MAX_SZ
+
+/**
+ * Limits, that bound the memory a single message may cost. They are enforced
+ * while the message is being received, so an offending line is rejected
+ * before it's buffered as a whole.
+ */
+typedef plex {
+    size_t url_max_len;       // longer Request-URI fails with HTTP_ERR_URL_TOO_LONG
+    size_t header_line_max_sz; // longer header line fails with HTTP_ERR_HEADERS_TOO_LARGE
+    size_t headers_max_sz;    // so do larger headers in total,
+    size_t headers_max_count; // and more headers than that
+} HTTP_ParserLimits;
+
 typedef plex {
     // It is expected that the connection socket is opened and is ready
     // for reading
@@ -111,9 +152,17 @@ typedef plex {
     HTTP_Headers headers;
     uint64_t content_length;
 
+    size_t buf_sz;     // initial (and shrink-back) size of the receive buffer
+    size_t buf_max_sz; // receive buffer never grows beyond this size
+    HTTP_ParserLimits limits;
+    uint64_t head_deadline; // time (see http_clock_ns()) the start line and
+                            // headers must be received by, 0 if none
+
     IO_Buffer _buffer;
     IO_Reader _reader;
+    size_t _syscalls_base;
     size_t _last_reader_pos;
+    size_t _headers_sz;
     ssize_t _body_start_pos;
     bool _ignore_lf;
 } HTTP_Parser;
@@ -130,6 +179,39 @@ typedef plex {
  */
 HTTP_Err http_parser_init(HTTP_Parser *p, HTTP_ParserKind pk, int connfd);
 
+/**
+ * Initializes parser `p` the same way http_parser_init() does, but instead of
+ * allocating a new receive buffer, takes over the storage of buffer `b`.
+ * Buffer `b` is emptied and must not be used by the caller anymore.
+ *
+ * If `b` is NULL, a new buffer is allocated.
+ */
+HTTP_Err http_parser_init_with_buffer(HTTP_Parser *p, HTTP_ParserKind pk, int connfd, IO_Buffer *b);
+
+/**
+ * Moves receive buffer of parser `p` into `b`, so it could be reused for
+ * another connection. Any data that was buffered, but not parsed yet, is
+ * dropped.
+ *
+ * After this call the parser may only be freed.
+ */
+HTTP_Err http_parser_take_buffer(HTTP_Parser *p, IO_Buffer *b);
+
+/**
+ * Sets initial size `buf_sz` and maximum size `buf_max_sz` of the receive
+ * buffer of parser `p`.
+ *
+ * The buffer is resized immediately, if it's possible without losing
+ * buffered data.
+ */
+HTTP_Err http_parser_set_buf_sz(HTTP_Parser *p, size_t buf_sz, size_t buf_max_sz);
+
+/**
+ * Returns the number of read() calls parser `p` performed on the connection
+ * since it was initialized or reset (see http_parser_reset()).
+ */
+size_t http_parser_syscalls(HTTP_Parser *p);
+
 /**
  * Returns the number of bytes parser `p` read last time from socket.
  *
@@ -214,11 +296,54 @@ HTTP_Err http_parser_headers(HTTP_Parser *p);
  */
 HTTP_Err http_parser_stream_body(HTTP_Parser *p, char *chunk, size_t chunk_sz);
 
+/**
+ * Reads up to `len` bytes of body into `buf`, using parser `p`.
+ *
+ * Unlike http_parser_stream_body(), this function serves the bytes already
+ * buffered by the parser first, and then reads the rest straight from the
+ * socket into `buf`, until `buf` is full or the body is over.
+ *
+ * Returns the number of bytes read, 0 once the body is consumed, or a
+ * negative HTTP_Err on failure.
+ *
+ * NOTE: Calling this function automatically advances parser's stage.
+ */
+ssize_t http_parser_read_body(HTTP_Parser *p, char *buf, size_t len);
+
+/**
+ * Vectored version of http_parser_read_body(), that scatters the body into
+ * `iovcnt` regions `iov`.
+ */
+ssize_t http_parser_readv_body(HTTP_Parser *p, const plex iovec *iov, int iovcnt);
+
+/**
+ * Moves the rest of the body into file descriptor `out_fd` (a file, a memfd,
+ * a socket, etc.), using parser `p`. The number of bytes moved is saved into
+ * `written`.
+ *
+ * Bytes already buffered by the parser are written first, the rest is moved
+ * without copying it to user space, where the platform allows that (see
+ * io_reader_splice()). Exactly Content-Length bytes of body are moved.
+ *
+ * NOTE: Calling this function automatically advances parser's stage.
+ */
+HTTP_Err http_parser_splice_body(HTTP_Parser *p, int out_fd, size_t *written);
+
 /**
  * Checks whether parser `p` is done parsing.
  */
 bool http_parser_is_finished(HTTP_Parser *p);
 
+/**
+ * Resets parser `p`, so it could be reused to parse the next message from the
+ * same connection.
+ *
+ * Parsed message data (URL, headers) that wasn't taken by the caller is
+ * freed. The internal buffer is kept along with any bytes already read from
+ * the connection, that belong to the next message.
+ */
+HTTP_Err http_parser_reset(HTTP_Parser *p);
+
 /**
  * Frees parser `p`.
  */
@@ -232,17 +357,14 @@ HTTP_Err http_parser_free(HTTP_Parser *p);
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "da.h"
 #include "log.h"
 
-#ifndef HTTP_PARSER_BUF_SZ
-/* #  define HTTP_PARSER_BUF_SZ 64*1<<10 */
-#  define HTTP_PARSER_BUF_SZ 5
-#endif // HTTP_PARSER_BUF_SZ
-
 #ifndef http_return_defer
 #  define http_return_defer(value) do { result = (value); goto defer; } while(0)
 #endif // http_return_defer
@@ -259,6 +381,11 @@ typedef plex {
     char *items;
     // parser
     size_t pos;
+    // When the line is contiguous in the receive buffer, `items` points
+    // straight into it, and the owned storage is stashed here.
+    bool _is_view;
+    char *_storage;
+    size_t _storage_cap;
 } HTTP_Parser_Message;
 
 typedef enum {
@@ -293,6 +420,10 @@ static void _advance_stage(HTTP_Parser *p) {
 }
 
 HTTP_Err http_parser_init(HTTP_Parser *p, HTTP_ParserKind pk, int connfd) {
+    return http_parser_init_with_buffer(p, pk, connfd, NULL);
+}
+
+HTTP_Err http_parser_init_with_buffer(HTTP_Parser *p, HTTP_ParserKind pk, int connfd, IO_Buffer *b) {
     p->kind = pk;
     p->stage = HTTP_PS_START_LINE;
 
@@ -308,20 +439,77 @@ HTTP_Err http_parser_init(HTTP_Parser *p, HTTP_ParserKind pk, int connfd) {
     p->headers        = (HTTP_Headers) {0};
     p->content_length = 0;
 
+    p->buf_sz     = HTTP_PARSER_BUF_SZ;
+    p->buf_max_sz = HTTP_PARSER_BUF_MAX_SZ;
+    p->limits = (HTTP_ParserLimits) {
+        .url_max_len        = HTTP_PARSER_URL_MAX_LEN,
+        .header_line_max_sz = HTTP_PARSER_HEADER_LINE_MAX_SZ,
+        .headers_max_sz     = HTTP_PARSER_HEADERS_MAX_SZ,
+        .headers_max_count  = HTTP_PARSER_HEADERS_MAX_COUNT,
+    };
+
     io_buffer_free(&p->_buffer);
     IO_Err err;
-    if ((err = io_buffer_init(&p->_buffer, HTTP_PARSER_BUF_SZ)) && err != IO_ERR_OK)
+    if (b != NULL) {
+        p->_buffer = *b;
+        io_buffer_reset(&p->_buffer);
+        *b = (IO_Buffer) {0};
+    } else if ((err = io_buffer_init(&p->_buffer, p->buf_sz)) && err != IO_ERR_OK) {
         return io_err_to_http_err(err);
+    }
     if ((err = io_reader_init(&p->_reader, &p->_buffer, connfd)) && err != IO_ERR_OK)
         return io_err_to_http_err(err);
 
+    p->_syscalls_base = 0;
     p->_last_reader_pos = p->_reader.pos;
+    p->_headers_sz = 0;
     p->_body_start_pos = -1;
     p->_ignore_lf = false;
 
     return HTTP_ERR_OK;
 }
 
+/**
+ * Grows receive buffer of parser `p` geometrically, respecting its maximum
+ * size.
+ *
+ * Returns false, if the buffer can't grow anymore.
+ */
+static bool _grow_buffer(HTTP_Parser *p) {
+    size_t cap = p->_buffer.cap;
+    if (cap >= p->buf_max_sz) return false;
+
+    size_t new_cap = (cap > 0) ? cap * 2 : HTTP_PARSER_BUF_SZ;
+    if (new_cap > p->buf_max_sz) new_cap = p->buf_max_sz;
+    return io_buffer_resize(&p->_buffer, new_cap) == IO_ERR_OK;
+}
+
+/**
+ * Shrinks receive buffer of parser `p` back to its initial size, if the
+ * buffered data allows that.
+ */
+static void _shrink_buffer(HTTP_Parser *p) {
+    if (p->_buffer.cap <= p->buf_sz) return;
+    if (io_buffer_len(&p->_buffer) > p->buf_sz) return;
+    io_buffer_resize(&p->_buffer, p->buf_sz);
+}
+
+HTTP_Err http_parser_set_buf_sz(HTTP_Parser *p, size_t buf_sz, size_t buf_max_sz) {
+    if (buf_sz == 0 || buf_max_sz < buf_sz) return HTTP_ERR_OOB;
+    p->buf_sz = buf_sz;
+    p->buf_max_sz = buf_max_sz;
+
+    if (p->_buffer.cap != buf_sz && io_buffer_len(&p->_buffer) <= buf_sz) {
+        IO_Err err = io_buffer_resize(&p->_buffer, buf_sz);
+        if (err != IO_ERR_OK) return io_err_to_http_err(err);
+    }
+    return HTTP_ERR_OK;
+}
+
+size_t http_parser_syscalls(HTTP_Parser *p) {
+    return p->_reader.nsyscalls - p->_syscalls_base;
+}
+
 size_t http_parser_last_read(HTTP_Parser *p) {
     return p->_reader.pos - p->_last_reader_pos;
 }
@@ -334,16 +522,47 @@ size_t http_parser_body_size(HTTP_Parser *p) {
     if (p->_body_start_pos == -1) {
         return 0;
     }
-    return p->_reader.nread - (size_t) p->_body_start_pos;
+    return p->_reader.pos - (size_t) p->_body_start_pos;
 }
 
 bool http_parser_is_finished(HTTP_Parser *p) {
     return p->stage >= HTTP_PS_DONE;
 }
 
+HTTP_Err http_parser_reset(HTTP_Parser *p) {
+    p->stage = HTTP_PS_START_LINE;
+
+    p->method      = HTTP_Method_UNKNOWN;
+    p->status      = HTTP_Status_UNKNOWN;
+    p->httpver.maj = 0;
+    p->httpver.min = 0;
+    if (p->url_str) HTTP_FREE(p->url_str);
+    p->url_str     = NULL;
+
+    http_headers_free(&p->headers);
+    p->headers        = (HTTP_Headers) {0};
+    p->content_length = 0;
+
+    _shrink_buffer(p);
+    p->_syscalls_base = p->_reader.nsyscalls;
+    p->_last_reader_pos = p->_reader.pos;
+    p->_headers_sz = 0;
+    p->_body_start_pos = -1;
+    p->_ignore_lf = false;
+
+    return HTTP_ERR_OK;
+}
+
+HTTP_Err http_parser_take_buffer(HTTP_Parser *p, IO_Buffer *b) {
+    io_reader_discard(&p->_reader);
+    *b = p->_buffer;
+    p->_buffer = (IO_Buffer) {0};
+    return HTTP_ERR_OK;
+}
+
 HTTP_Err http_parser_free(HTTP_Parser *p) {
     http_headers_free(&p->headers);
-    if (p->url_str) free(p->url_str);
+    if (p->url_str) HTTP_FREE(p->url_str);
     io_buffer_free(&p->_buffer);
 
     return HTTP_ERR_OK;
@@ -466,19 +685,17 @@ static inline bool _token_cmp_cstr(HTTP_Parser_Token *t, const char *cstr) {
     http_return_defer(strcmp(repr, cstr) == 0);
 
  defer:
-    free(repr);
+    HTTP_FREE(repr);
     return result;
 }
 //////////////////// END:   Lexer ////////////////////
 
 //////////////////// BEGIN: Parser ////////////////////
-static HTTP_Err _prefetch(HTTP_Parser *p) {
-    IO_Err err = io_reader_prefetch(&p->_reader, p->_buffer.cap);
-    return io_err_to_http_err(err);
-}
-
-static HTTP_Err _peek(HTTP_Parser *p, char *dest, size_t n) {
-    IO_Err err = io_reader_npeek(&p->_reader, dest, n);
+static HTTP_Err _fill(HTTP_Parser *p) {
+    // Client, that trickles the head in, would never time out otherwise,
+    // since the socket's timeout only limits each read
+    if (p->head_deadline > 0 && http_clock_ns() >= p->head_deadline) return HTTP_ERR_TIMEOUT;
+    IO_Err err = io_reader_fill(&p->_reader);
     return io_err_to_http_err(err);
 }
 
@@ -488,56 +705,172 @@ static HTTP_Err _read(HTTP_Parser *p, char *dest, size_t n) {
     return io_err_to_http_err(err);
 }
 
+/**
+ * Moves `n` buffered bytes into `msg`, using parser `p`.
+ */
+static void _consume_msg(HTTP_Parser *p, HTTP_Parser_Message *msg, size_t n) {
+    http_da_reserve(msg, msg->len + n + 1);
+    io_reader_nconsume(&p->_reader, msg->items + msg->len, n);
+    msg->len += n;
+    msg->items[msg->len] = '\0';
+}
+
+/**
+ * Switches `msg` back to its owned storage, if it is a view into the receive
+ * buffer.
+ */
+static void _msg_own(HTTP_Parser_Message *msg) {
+    if (!msg->_is_view) return;
+    msg->items = msg->_storage;
+    msg->cap = msg->_storage_cap;
+    msg->len = 0;
+    msg->_is_view = false;
+}
+
+static void _msg_free(HTTP_Parser_Message *msg) {
+    _msg_own(msg);
+    HTTP_FREE(msg->items);
+}
+
+/**
+ * Takes a complete line of `n` bytes from the receive buffer of parser `p`
+ * into `msg`.
+ *
+ * If the line is contiguous in the buffer, `msg` becomes a view into it
+ * instead of a copy. The view stays valid until the buffer is filled again.
+ * NOTE: The view is not NUL-terminated, but it always ends with CR or LF.
+ */
+static void _take_msg(HTTP_Parser *p, HTTP_Parser_Message *msg, size_t n) {
+    char *data;
+    if (msg->len == 0 && io_reader_borrow(&p->_reader, &data) >= n) {
+        msg->_storage = msg->items;
+        msg->_storage_cap = msg->cap;
+        msg->_is_view = true;
+        msg->items = data;
+        msg->len = msg->cap = n;
+        io_reader_nconsume(&p->_reader, NULL, n);
+        return;
+    }
+    _consume_msg(p, msg, n);
+}
+
+/**
+ * Returns offset of the first CR or LF within `n` bytes of `s`, or `n`.
+ */
+static size_t _memeol(const char *s, size_t n) {
+    const char *lf = memchr(s, LF, n);
+    size_t end = lf ? (size_t)(lf - s) : n;
+    const char *cr = memchr(s, CR, end);
+    return cr ? (size_t)(cr - s) : end;
+}
+
+/**
+ * Returns position of the first CR or LF in the receive buffer of parser
+ * `p`, starting from position `from`, or the number of buffered bytes, if
+ * there is none.
+ */
+static size_t _find_eol(HTTP_Parser *p, size_t from) {
+    plex iovec iov[2];
+    int iovcnt = io_buffer_data_iov(&p->_buffer, iov);
+
+    size_t base = 0;
+    for (int k = 0; k < iovcnt; k++) {
+        size_t n = iov[k].iov_len;
+        if (from < base + n) {
+            size_t off = from - base;
+            size_t i = off + _memeol((char *)iov[k].iov_base + off, n - off);
+            if (i < n) return base + i;
+            from = base + n;
+        }
+        base += n;
+    }
+    return base;
+}
+
 /**
  * Reads a line of HTTP Message from socket into `msg`, using parser `p`.
  *
+ * The line is accumulated in the receive buffer, which grows if the line
+ * doesn't fit into it. Only when the buffer reaches its maximum size, the
+ * line is moved into `msg` piece by piece.
+ *
+ * If the line (without its terminator) turns out to be longer than `max_len`
+ * bytes, fails with `too_long` as soon as that is known.
+ *
  * NOTE: This function is not intended for reading body.
  */
-static HTTP_Err _receive_msg(HTTP_Parser *p, HTTP_Parser_Message *msg) {
+static HTTP_Err _receive_msg(HTTP_Parser *p, HTTP_Parser_Message *msg, size_t max_len, HTTP_Err too_long) {
     HTTP_Err result = HTTP_ERR_OK;
+    _msg_own(msg);
     http_da_reset(msg);
     msg->pos = 0;
     p->_last_reader_pos = p->_reader.pos;
 
+    size_t i = 0;
     for (;;) {
-        HTTP_Err err = _prefetch(p);
-        if (err != HTTP_ERR_OK) http_return_defer(err);
-
         size_t buffered = io_buffer_len(&p->_buffer);
-        char *temp = HTTP_REALLOC(NULL, buffered);
-        size_t i = 0;
-        for (;i < buffered;) {
-            char c = io_buffer_at(&p->_buffer, i++);
-            if (c == CR || c == LF) {
-                io_reader_nconsume(&p->_reader, temp, i);
-                http_da_append_carr(msg, temp, i);
-                if (c == CR) {
-                    err = _peek(p, &c, 1);
-                    if (err != HTTP_ERR_OK) http_return_defer(err);
-                }
-                if (c == LF) {
-                    http_da_append(msg, c);
-                    io_reader_nconsume(&p->_reader, NULL, 1);
-                }
+        i = _find_eol(p, i);
+        if (msg->len + i > max_len) http_return_defer(too_long);
+        if (i < buffered) {
+            char c = io_buffer_at(&p->_buffer, i);
+            // CR may be followed by LF, that is not received yet
+            if (c != CR || i + 1 < buffered) {
+                size_t n = i + 1;
+                if (c == CR && io_buffer_at(&p->_buffer, i + 1) == LF) n++;
+                _take_msg(p, msg, n);
                 http_return_defer(HTTP_ERR_OK);
             }
         }
-        io_reader_nconsume(&p->_reader, temp, i);
-        http_da_append_carr(msg, temp, i);
+
+        if (buffered == p->_buffer.cap && !_grow_buffer(p)) {
+            // The line doesn't fit into the buffer. Keep trailing CR in the
+            // buffer to recognize CRLF later.
+            size_t n = (i < buffered) ? i : buffered;
+            _consume_msg(p, msg, n);
+            i = 0;
+        }
+
+        HTTP_Err err = _fill(p);
+        if (err != HTTP_ERR_OK) http_return_defer(err);
     }
  defer:
     return result;
 }
 
 /**
- * Parses HTTP version from input string `s` into `hv`.
+ * Parses decimal number from at most `len` characters of `s` into `dst`.
+ *
+ * Returns number of characters read, or -1 if there are no digits.
+ */
+static int _parse_version_num(const char *s, size_t len, unsigned short *dst) {
+    size_t i = 0;
+    int v = 0;
+    for (; i < len && isdigit((unsigned char)s[i]); i++) {
+        v = v*10 + (s[i] - '0');
+        if (v > USHRT_MAX) return -1;
+    }
+    if (i == 0) return -1;
+    *dst = (unsigned short)v;
+    return (int)i;
+}
+
+/**
+ * Parses HTTP version from at most `len` characters of input string `s` into
+ * `hv`.
  *
  * Returns number of characters read, or -1 if failed to parse.
  */
-static int _parse_version(const char *s, HTTP_Version *hv) {
-    int n;
-    if (sscanf(s, "HTTP/%hd.%hd%n", &hv->maj, &hv->min, &n) == 2) return n;
-    return -1;
+static int _parse_version(const char *s, size_t len, HTTP_Version *hv) {
+    static const char prefix[] = "HTTP/";
+    size_t i = sizeof(prefix) - 1;
+    if (len < i || memcmp(s, prefix, i) != 0) return -1;
+
+    int n = _parse_version_num(s + i, len - i, &hv->maj);
+    if (n == -1) return -1;
+    i += n;
+    if (i >= len || s[i++] != '.') return -1;
+    if ((n = _parse_version_num(s + i, len - i, &hv->min)) == -1) return -1;
+    return (int)(i + n);
 }
 
 HTTP_Err http_parser_start_line(HTTP_Parser *p) {
@@ -555,7 +888,10 @@ HTTP_Err http_parser_request_line(HTTP_Parser *p) {
     HTTP_Parser_Token t = {0};
     char *t_cstr = NULL;
 
-    _receive_msg(p, &msg);
+    // Request-Line is allowed to exceed Request-URI limit by the length of
+    // the method, HTTP version and separators
+    HTTP_Err err = _receive_msg(p, &msg, p->limits.url_max_len + 32, HTTP_ERR_URL_TOO_LONG);
+    if (err != HTTP_ERR_OK) http_return_defer(err);
 
     // Method
     {
@@ -569,14 +905,14 @@ HTTP_Err http_parser_request_line(HTTP_Parser *p) {
     {
         _skipws(&msg);
         size_t n = 0;
-        for (;n < HTTP_PARSER_URL_MAX_LEN + 1 && msg.pos + n < msg.len; n++) {
+        for (;n < p->limits.url_max_len + 1 && msg.pos + n < msg.len; n++) {
             if (_iscrlf(msg.items[msg.pos + n]) || _islws(msg.items[msg.pos + n]))
                 break;
         }
 
+        if (n > p->limits.url_max_len) http_return_defer(HTTP_ERR_URL_TOO_LONG);
         if (_iscrlf(msg.items[msg.pos+n])) http_return_defer(HTTP_ERR_FAILED_PARSE);
-        if (n == HTTP_PARSER_URL_MAX_LEN) http_return_defer(HTTP_ERR_URL_TOO_LONG);
-        p->url_str = strndup(&msg.items[msg.pos], n);
+        p->url_str = HTTP_STRNDUP(&msg.items[msg.pos], n);
         _adv_n_chars(&msg, n);
     }
 
@@ -584,7 +920,7 @@ HTTP_Err http_parser_request_line(HTTP_Parser *p) {
     {
         _skipws(&msg);
         int n;
-        if ((n = _parse_version(&msg.items[msg.pos], &p->httpver)) == -1)
+        if ((n = _parse_version(&msg.items[msg.pos], msg.len - msg.pos, &p->httpver)) == -1)
             http_return_defer(HTTP_ERR_FAILED_PARSE);
         _adv_n_chars(&msg, n);
     }
@@ -594,8 +930,8 @@ HTTP_Err http_parser_request_line(HTTP_Parser *p) {
 
  defer:
     _advance_stage(p);
-    free(msg.items);
-    free(t_cstr);
+    _msg_free(&msg);
+    HTTP_FREE(t_cstr);
     return result;
 }
 
@@ -607,17 +943,45 @@ HTTP_Err http_parser_status_line(HTTP_Parser *p) {
     return HTTP_ERR_NOT_IMPLEMENTED;
 }
 
+/**
+ * Parses value `v` of Content-Length header into `len`.
+ *
+ * Returns false, unless the value is a plain decimal number, that fits.
+ */
+static bool _parse_content_length(const char *v, uint64_t *len) {
+    uint64_t n = 0;
+    const char *d = v;
+    for (; *d >= '0' && *d <= '9'; d++) {
+        if (n > (UINT64_MAX - (*d - '0')) / 10) return false;
+        n = n*10 + (*d - '0');
+    }
+    if (d == v) return false;
+    while (*d == ' ' || *d == '\t') d++;
+    if (*d != '\0') return false;
+    *len = n;
+    return true;
+}
+
 HTTP_Err http_parser_headers(HTTP_Parser *p) {
     if (p->stage != HTTP_PS_HEADERS) return HTTP_ERR_WRONG_STAGE;
     HTTP_Err result = HTTP_ERR_OK;
 
     HTTP_Parser_Message msg = {0};
     HTTP_Parser_Token t = {0};
+    bool has_length = false, has_coding = false;
 
     for (;;) {
-        _receive_msg(p, &msg);
+        size_t max_len = p->limits.header_line_max_sz;
+        size_t left = (p->limits.headers_max_sz > p->_headers_sz) ? p->limits.headers_max_sz - p->_headers_sz : 0;
+        if (max_len > left) max_len = left;
+
+        HTTP_Err err = _receive_msg(p, &msg, max_len, HTTP_ERR_HEADERS_TOO_LARGE);
+        if (err != HTTP_ERR_OK) http_return_defer(err);
         if (_iscrlf(msg.items[msg.pos])) break;
 
+        p->_headers_sz += msg.len;
+        if (p->headers.len >= p->limits.headers_max_count) http_return_defer(HTTP_ERR_HEADERS_TOO_LARGE);
+
         HTTP_Header h = {0};
 
         // Field name
@@ -634,18 +998,28 @@ HTTP_Err http_parser_headers(HTTP_Parser *p) {
         _skipws(&msg);
         size_t n = 0;
         for (;msg.pos + n < msg.len && !_iscrlf(msg.items[msg.pos + n]); n++);
-        h.v = strndup(&msg.items[msg.pos], n);
-
-        if (strcmp(h.k, "Content-Length") == 0 && sscanf(h.v, "%ld", &p->content_length) != 1) {
-            HTTP_WARN("Failed to parse Content-Length");
-        }
+        h.v = HTTP_STRNDUP(&msg.items[msg.pos], n);
 
         http_da_append(&p->headers, h);
+
+        // Body, that is framed ambiguously, might carry the next request, so
+        // such messages are rejected (RFC 7230, section 3.3.3)
+        if (strcasecmp(h.k, "Content-Length") == 0) {
+            uint64_t len;
+            if (!_parse_content_length(h.v, &len) || (has_length && len != p->content_length))
+                http_return_defer(HTTP_ERR_FAILED_PARSE);
+            p->content_length = len;
+            has_length = true;
+        }
+        if (strcasecmp(h.k, "Transfer-Encoding") == 0) has_coding = true;
     }
+    // TODO: Support chunked message body
+    if (has_coding) http_return_defer(has_length ? HTTP_ERR_FAILED_PARSE : HTTP_ERR_NOT_IMPLEMENTED);
+    _shrink_buffer(p);
 
  defer:
     _advance_stage(p);
-    free(msg.items);
+    _msg_free(&msg);
     return result;
 }
 
@@ -671,6 +1045,54 @@ HTTP_Err http_parser_stream_body(HTTP_Parser *p, char *chunk, size_t chunk_sz) {
     if (body_sz == p->content_length) _advance_stage(p);
     return HTTP_ERR_OK;
 }
+
+ssize_t http_parser_read_body(HTTP_Parser *p, char *buf, size_t len) {
+    plex iovec iov = { .iov_base = buf, .iov_len = len };
+    return http_parser_readv_body(p, &iov, 1);
+}
+
+ssize_t http_parser_readv_body(HTTP_Parser *p, const plex iovec *iov, int iovcnt) {
+    if (p->stage == HTTP_PS_DONE) return 0;
+    if (p->stage != HTTP_PS_BODY) return HTTP_ERR_WRONG_STAGE;
+    if (p->_body_start_pos == -1) p->_body_start_pos = p->_reader.pos;
+    p->_last_reader_pos = p->_reader.pos;
+
+    // Don't read past the body, it may be followed by a pipelined request
+    size_t body_sz = http_parser_body_size(p);
+    HTTP_ASSERT(body_sz <= p->content_length && "Read more than Content-Length");
+    size_t body_rest = p->content_length - body_sz;
+
+    plex iovec v[IO_IOV_MAX];
+    int cnt = 0;
+    for (int i = 0; i < iovcnt && cnt < IO_IOV_MAX && body_rest > 0; i++) {
+        v[cnt] = iov[i];
+        if (v[cnt].iov_len > body_rest) v[cnt].iov_len = body_rest;
+        body_rest -= v[cnt++].iov_len;
+    }
+
+    size_t n = 0;
+    IO_Err err = (cnt > 0) ? io_reader_readv(&p->_reader, v, cnt, &n) : IO_ERR_OK;
+    if (err != IO_ERR_OK && err != IO_ERR_PARTIAL && n == 0) return io_err_to_http_err(err);
+
+    if (http_parser_body_size(p) == p->content_length) _advance_stage(p);
+    return n;
+}
+
+HTTP_Err http_parser_splice_body(HTTP_Parser *p, int out_fd, size_t *written) {
+    *written = 0;
+    if (p->stage == HTTP_PS_DONE) return HTTP_ERR_OK;
+    if (p->stage != HTTP_PS_BODY) return HTTP_ERR_WRONG_STAGE;
+    if (p->_body_start_pos == -1) p->_body_start_pos = p->_reader.pos;
+    p->_last_reader_pos = p->_reader.pos;
+
+    size_t body_sz = http_parser_body_size(p);
+    HTTP_ASSERT(body_sz <= p->content_length && "Read more than Content-Length");
+
+    IO_Err err = io_reader_splice(&p->_reader, out_fd, p->content_length - body_sz, written);
+    if (http_parser_body_size(p) == p->content_length) _advance_stage(p);
+    if (err == IO_ERR_PARTIAL) return HTTP_ERR_EOF;
+    return io_err_to_http_err(err);
+}
 //////////////////// END:   Parser ////////////////////
 
 #  endif // HTTP_PARSER_IMPL_GUARD
@@ -74,9 +74,9 @@ static bool _pc_parse(const char *path, size_t path_len, HTTP_PathComponents **p
 
     if (path_len == 0) {
         if (is_root) {
-            *pc = malloc(sizeof(HTTP_PathComponents));
+            *pc = HTTP_REALLOC(NULL, sizeof(HTTP_PathComponents));
             if (*pc == NULL) return false;
-            (*pc)->value = strdup("");
+            (*pc)->value = HTTP_STRDUP("");
             (*pc)->next = NULL;
             (*pc)->wc_idx = -1;
         } else {
@@ -85,21 +85,21 @@ static bool _pc_parse(const char *path, size_t path_len, HTTP_PathComponents **p
         return true;
     }
 
-    *pc = malloc(sizeof(HTTP_PathComponents));
+    *pc = HTTP_REALLOC(NULL, sizeof(HTTP_PathComponents));
     if (*pc == NULL) return false;
 
     size_t pos = 0;
     while (pos < path_len && path[pos] != '/') pos++;
 
-    (*pc)->value = strndup(path, pos);
+    (*pc)->value = HTTP_STRNDUP(path, pos);
     if (strcmp((*pc)->value, WILDCARD_CSTR) == 0) (*pc)->wc_idx = ++wc_idx;
     else (*pc)->wc_idx = -1;
 
     HTTP_ASSERT(path_len >= pos);
     bool res = _pc_parse(path + pos, path_len - pos, &((*pc)->next), false, wc_idx);
     if (!res) {
-        free((*pc)->value);
-        free(*pc);
+        HTTP_FREE((*pc)->value);
+        HTTP_FREE(*pc);
 
         return false;
     }
@@ -134,8 +134,8 @@ HTTP_Err http_pc_init(HTTP_PathComponents **pc, const char *path) {
 HTTP_Err http_pc_free(HTTP_PathComponents *pc) {
     while (pc != NULL) {
         HTTP_PathComponents *next = pc->next;
-        free(pc->value);
-        free(pc);
+        HTTP_FREE(pc->value);
+        HTTP_FREE(pc);
         pc = next;
     }
     return HTTP_ERR_OK;
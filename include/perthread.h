@@ -0,0 +1,125 @@
+/*
+ * perthread.h - Per-thread objects.
+ *
+ * Lets every thread update its own object without locking (e.g. counters or
+ * log buffers), while some other thread still gets to all of them by walking
+ * the list.
+ */
+#ifndef HTTP_PERTHREAD_H
+#  define HTTP_PERTHREAD_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+
+/**
+ * Objects of `size` bytes, that every thread gets its own one of, when it
+ * first asks for it (see http_per_thread_get()), linked into a list through
+ * their `next` pointers at `next_off`. Objects stay in the list after their
+ * threads exit, so nothing they hold is lost, until http_per_thread_free().
+ */
+typedef plex {
+    size_t size, next_off;
+    pthread_key_t key;     // object of the calling thread
+    pthread_mutex_t lock;  // guards `head`
+    void *head;
+} HTTP_PerThread;
+
+/**
+ * Initializes per-thread objects `pt` of `size` bytes with `next` pointers at
+ * `next_off`.
+ *
+ * Returns false, if failed to allocate the key or the lock.
+ */
+bool http_per_thread_init(HTTP_PerThread *pt, size_t size, size_t next_off);
+
+/**
+ * Returns zeroed object of `pt` of the calling thread, or NULL, if failed to
+ * allocate it.
+ */
+void *http_per_thread_get(HTTP_PerThread *pt);
+
+/**
+ * Returns the first object of `pt`. Objects are only prepended, so the rest
+ * of the list, that starts there, may be walked without the lock.
+ */
+void *http_per_thread_list(HTTP_PerThread *pt);
+
+/**
+ * Frees all objects of `pt`, that no thread may use anymore.
+ */
+void http_per_thread_free(HTTP_PerThread *pt);
+
+#endif // HTTP_PERTHREAD_H
+
+#ifdef HTTP_PERTHREAD_IMPL
+#  ifndef HTTP_PERTHREAD_IMPL_GUARD
+#    define HTTP_PERTHREAD_IMPL_GUARD
+
+#include <stdlib.h>
+
+bool http_per_thread_init(HTTP_PerThread *pt, size_t size, size_t next_off) {
+    *pt = (HTTP_PerThread) { .size = size, .next_off = next_off };
+    if (pthread_key_create(&pt->key, NULL) != 0) return false;
+    if (pthread_mutex_init(&pt->lock, NULL) != 0) {
+        pthread_key_delete(pt->key);
+        return false;
+    }
+    return true;
+}
+
+void *http_per_thread_get(HTTP_PerThread *pt) {
+    void *obj = pthread_getspecific(pt->key);
+    if (obj != NULL) return obj;
+    if ((obj = calloc(1, pt->size)) == NULL) return NULL;
+    pthread_setspecific(pt->key, obj);
+    pthread_mutex_lock(&pt->lock);
+    *(void **)((char *)obj + pt->next_off) = pt->head;
+    pt->head = obj;
+    pthread_mutex_unlock(&pt->lock);
+    return obj;
+}
+
+void *http_per_thread_list(HTTP_PerThread *pt) {
+    pthread_mutex_lock(&pt->lock);
+    void *head = pt->head;
+    pthread_mutex_unlock(&pt->lock);
+    return head;
+}
+
+void http_per_thread_free(HTTP_PerThread *pt) {
+    while (pt->head != NULL) {
+        void *next = *(void **)((char *)pt->head + pt->next_off);
+        free(pt->head);
+        pt->head = next;
+    }
+    pthread_mutex_destroy(&pt->lock);
+    pthread_key_delete(pt->key);
+}
+
+#  endif // HTTP_PERTHREAD_IMPL_GUARD
+#endif // HTTP_PERTHREAD_IMPL
+
+/*
+ * Copyright (c) 2025 Artem Darizhapov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
@@ -0,0 +1,73 @@
+/*
+ * phase.h - Moments in the life of a request.
+ */
+#ifndef HTTP_PHASE_H
+#  define HTTP_PHASE_H
+
+#include "common.h"
+
+// Moments in the life of a request, that the server may record (see `phases`
+// of HTTP_Server): number, name, the moment, and what the request was doing
+// since the previous one, that was recorded
+#define HTTP_PHASE_MAP(XX)                                              \
+    XX(0, ACCEPT,       "accept",       "accept")                       \
+    XX(1, READ_START,   "read start",   "wait for request")             \
+    XX(2, REQUEST_LINE, "request line", "read request line")            \
+    XX(3, HEADERS,      "headers",      "read headers")                 \
+    XX(4, HANDLER,      "handler",      "dispatch")                     \
+    XX(5, HEADERS_SENT, "headers sent", "handler")                      \
+    XX(6, LAST_BYTE,    "last byte",    "send body")                    \
+    XX(7, CLOSE,        "close",        "close")
+
+typedef enum {
+#define XX(num, name, ...) HTTP_Phase_##name = num,
+    HTTP_PHASE_MAP(XX)
+#undef XX
+} HTTP_Phase;
+
+#define XX(...) + 1
+enum { HTTP_PHASES = 0 HTTP_PHASE_MAP(XX) };
+#undef XX
+
+/**
+ * Returns what moment `phase` is, e.g. "headers".
+ */
+char *http_phase_to_cstr(HTTP_Phase phase);
+
+#endif // HTTP_PHASE_H
+
+#ifdef HTTP_PHASE_IMPL
+#  ifndef HTTP_PHASE_IMPL_GUARD
+#    define HTTP_PHASE_IMPL_GUARD
+
+char *http_phase_to_cstr(HTTP_Phase phase) {
+#define XX(num, name, repr, ...) if (num == phase) return repr;
+    HTTP_PHASE_MAP(XX)
+#undef XX
+    return "UNKNOWN";
+}
+
+#  endif // HTTP_PHASE_IMPL_GUARD
+#endif // HTTP_PHASE_IMPL
+
+/*
+ * Copyright (c) 2025 Artem Darizhapov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
@@ -0,0 +1,448 @@
+/*
+ * pool.h - Pool of fixed-size IO buffers.
+ *
+ * The pool carves buffers out of large slabs and never returns them to the
+ * system allocator until the pool itself is freed, so connection churn
+ * doesn't hit malloc() and doesn't fragment the heap.
+ *
+ * Released buffers are first kept in a small cache of the releasing thread,
+ * which is served without any locking. When the cache is full (or belongs to
+ * another pool), buffers go to the global free list, that is shared by all
+ * threads and protected by a mutex.
+ *
+ * The pool may be limited to reserve at most `max_sz` bytes. Once the limit is
+ * reached, acquiring a buffer fails with `HTTP_ERR_BUSY`, letting the caller
+ * apply backpressure instead of running out of memory. Limited pools don't
+ * cache buffers per thread, so a buffer released by one thread may always be
+ * acquired by another one:
+ *
+ * ```c
+ * HTTP_BufferPool pool = {0};
+ * http_buffer_pool_init(&pool, 4096, 64*1<<20);
+ *
+ * IO_Buffer b = {0};
+ * if (http_buffer_pool_acquire(&pool, &b) == HTTP_ERR_BUSY) {
+ *     // ... try again, once some buffer is released ...
+ * }
+ * // ... use `b` ...
+ * http_buffer_pool_release(&pool, &b);
+ *
+ * http_buffer_pool_free(&pool);
+ * ```
+ *
+ * NOTE: Pooled buffers don't own their storage (see io_buffer_init_with()).
+ *       If such buffer was resized, it doesn't refer to the pooled storage
+ *       anymore, so the storage must be returned with http_buffer_pool_put().
+ */
+#ifndef HTTP_POOL_H
+#  define HTTP_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "err.h"
+#include "io.h"
+
+// Size of a slab, buffers are carved from
+#ifndef HTTP_POOL_SLAB_SZ
+#  define HTTP_POOL_SLAB_SZ (256*1<<10)
+#endif // HTTP_POOL_SLAB_SZ
+
+// Size of a slab, when the pool is backed by huge pages
+#ifndef HTTP_POOL_HUGE_SLAB_SZ
+#  define HTTP_POOL_HUGE_SLAB_SZ (2*1<<20)
+#endif // HTTP_POOL_HUGE_SLAB_SZ
+
+// Maximum number of buffers cached by a single thread
+#ifndef HTTP_POOL_THREAD_CACHE_MAX
+#  define HTTP_POOL_THREAD_CACHE_MAX 32
+#endif // HTTP_POOL_THREAD_CACHE_MAX
+
+typedef plex http_pool_slab_s {
+    plex http_pool_slab_s *next;
+    char *mem;
+    size_t sz;
+    bool mapped, huge;
+} HTTP_PoolSlab;
+
+typedef plex {
+    /* Options. May be changed between http_buffer_pool_init() and the first
+       acquisition */
+    size_t thread_cache; // buffers cached by each thread (none, if `max_sz` is set)
+    bool   hugepages;    // back slabs by huge pages, if possible
+
+    size_t buf_sz;       // capacity of every pooled buffer
+    size_t max_sz;       // bytes the pool may reserve, 0 means unlimited
+
+    pthread_mutex_t _lock;
+    char *_free;         // global free list, linked through the buffers
+    size_t _nfree;
+    HTTP_PoolSlab *_slabs;
+    size_t _nslabs, _nbufs;
+    size_t _reserved;
+    size_t _stride;
+
+    atomic_size_t _in_use, _in_use_peak;
+    atomic_size_t _cached;
+    atomic_size_t _exhausted;
+} HTTP_BufferPool;
+
+typedef plex {
+    size_t buf_sz;           // capacity of every pooled buffer
+    size_t max_sz;           // bytes the pool may reserve, 0 means unlimited
+    size_t reserved_sz;      // bytes reserved by slabs
+    size_t slabs;            // number of slabs
+    size_t slabs_huge;       // slabs backed by huge pages
+    size_t bufs_total;       // buffers carved out of slabs
+    size_t bufs_in_use;      // buffers currently acquired
+    size_t bufs_in_use_peak; // the most buffers acquired at once
+    size_t bufs_free;        // buffers in the global free list
+    size_t bufs_cached;      // buffers in per-thread caches
+    size_t exhausted;        // acquisitions refused due to `max_sz`
+} HTTP_BufferPoolStats;
+
+/**
+ * Initializes pool `p` of buffers with `buf_sz` capacity, that may reserve at
+ * most `max_sz` bytes (0 means unlimited).
+ *
+ * No memory is reserved until the first acquisition.
+ */
+HTTP_Err http_buffer_pool_init(HTTP_BufferPool *p, size_t buf_sz, size_t max_sz);
+
+/**
+ * Takes storage of a single buffer (`buf_sz` + 1 bytes) from pool `p`.
+ *
+ * Returns NULL if the pool has reached its memory limit, or failed to reserve
+ * a new slab.
+ */
+char *http_buffer_pool_get(HTTP_BufferPool *p);
+
+/**
+ * Returns storage `buf`, that was taken with http_buffer_pool_get(), to pool
+ * `p`.
+ */
+void http_buffer_pool_put(HTTP_BufferPool *p, char *buf);
+
+/**
+ * Initializes IO buffer `b` on top of storage taken from pool `p`.
+ *
+ * Returns `HTTP_ERR_BUSY`, if the pool has reached its memory limit.
+ */
+HTTP_Err http_buffer_pool_acquire(HTTP_BufferPool *p, IO_Buffer *b);
+
+/**
+ * Returns storage of IO buffer `b` to pool `p`. Buffers, that own their
+ * storage, are simply freed.
+ */
+void http_buffer_pool_release(HTTP_BufferPool *p, IO_Buffer *b);
+
+/**
+ * Moves buffers cached by the calling thread back to the global free list of
+ * pool `p`. Threads should call it before they exit.
+ */
+void http_buffer_pool_flush_thread(HTTP_BufferPool *p);
+
+/**
+ * Returns true, if a buffer may be acquired from pool `p` right now, i.e. the
+ * global free list is not empty, or the pool may still grow.
+ */
+bool http_buffer_pool_available(HTTP_BufferPool *p);
+
+/**
+ * Returns usage statistics of pool `p`.
+ */
+HTTP_BufferPoolStats http_buffer_pool_stats(HTTP_BufferPool *p);
+
+/**
+ * Frees pool `p` with all of its slabs. Every buffer taken from the pool
+ * becomes invalid.
+ */
+void http_buffer_pool_free(HTTP_BufferPool *p);
+
+#endif // HTTP_POOL_H
+
+#ifdef HTTP_POOL_IMPL
+#  ifndef HTTP_POOL_IMPL_GUARD
+#    define HTTP_POOL_IMPL_GUARD
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#  include <sys/mman.h>
+#endif // __linux__
+
+// Buffers are aligned to cache lines, so that neighbours don't share them
+#define _HTTP_POOL_ALIGN 64
+
+typedef plex {
+    HTTP_BufferPool *pool;
+    size_t len;
+    char *items[HTTP_POOL_THREAD_CACHE_MAX];
+} _HTTP_PoolCache;
+
+static _Thread_local _HTTP_PoolCache _http_pool_cache = {0};
+
+static inline char *_pool_next(char *buf) {
+    char *next;
+    memcpy(&next, buf, sizeof(next));
+    return next;
+}
+
+static inline void _pool_push(HTTP_BufferPool *p, char *buf) {
+    memcpy(buf, &p->_free, sizeof(p->_free));
+    p->_free = buf;
+    p->_nfree++;
+}
+
+static inline char *_pool_pop(HTTP_BufferPool *p) {
+    char *buf = p->_free;
+    if (buf == NULL) return NULL;
+    p->_free = _pool_next(buf);
+    p->_nfree--;
+    return buf;
+}
+
+/**
+ * Reserves `sz` bytes for a slab of pool `p`. Huge pages are tried first, if
+ * requested, falling back to regular pages.
+ */
+static char *_pool_map(HTTP_BufferPool *p, size_t sz, bool *mapped, bool *huge) {
+    *mapped = *huge = false;
+#ifdef __linux__
+#  ifdef MAP_HUGETLB
+    if (p->hugepages && sz % HTTP_POOL_HUGE_SLAB_SZ == 0) {
+        char *mem = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            *mapped = *huge = true;
+            return mem;
+        }
+    }
+#  endif // MAP_HUGETLB
+    char *mem = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+#  ifdef MADV_HUGEPAGE
+    // Let the kernel back the slab by transparent huge pages instead
+    if (p->hugepages) madvise(mem, sz, MADV_HUGEPAGE);
+#  endif // MADV_HUGEPAGE
+    *mapped = true;
+    return mem;
+#else
+    HTTP_UNUSED(p);
+    return malloc(sz);
+#endif // __linux__
+}
+
+/**
+ * Reserves a new slab for pool `p` and puts its buffers into the global free
+ * list. Must be called with the pool locked.
+ *
+ * Returns false, if the memory limit is reached or failed to reserve memory.
+ */
+static bool _pool_grow(HTTP_BufferPool *p) {
+    size_t sz = p->hugepages ? HTTP_POOL_HUGE_SLAB_SZ : HTTP_POOL_SLAB_SZ;
+    if (sz < p->_stride) sz = p->_stride;
+
+    if (p->max_sz > 0) {
+        size_t left = (p->max_sz > p->_reserved) ? p->max_sz - p->_reserved : 0;
+        if (left < p->_stride) return false;
+        if (sz > left) sz = left / p->_stride * p->_stride;
+    }
+
+    HTTP_PoolSlab *slab = malloc(sizeof(HTTP_PoolSlab));
+    if (slab == NULL) return false;
+    slab->sz = sz;
+    slab->mem = _pool_map(p, sz, &slab->mapped, &slab->huge);
+    if (slab->mem == NULL) {
+        free(slab);
+        return false;
+    }
+
+    slab->next = p->_slabs;
+    p->_slabs = slab;
+    p->_nslabs++;
+    p->_reserved += sz;
+
+    size_t n = sz / p->_stride;
+    for (size_t i = n; i > 0; i--) _pool_push(p, slab->mem + (i - 1) * p->_stride);
+    p->_nbufs += n;
+    return true;
+}
+
+HTTP_Err http_buffer_pool_init(HTTP_BufferPool *p, size_t buf_sz, size_t max_sz) {
+    if (buf_sz == 0) return HTTP_ERR_OOB;
+
+    p->thread_cache = HTTP_POOL_THREAD_CACHE_MAX;
+    p->hugepages = false;
+
+    p->buf_sz = buf_sz;
+    p->_stride = (buf_sz + 1 + _HTTP_POOL_ALIGN - 1) / _HTTP_POOL_ALIGN * _HTTP_POOL_ALIGN;
+    // The pool must be able to hand out at least a single buffer
+    p->max_sz = (max_sz > 0 && max_sz < p->_stride) ? p->_stride : max_sz;
+
+    if (pthread_mutex_init(&p->_lock, NULL) != 0) return HTTP_ERR_OOM;
+    p->_free = NULL;
+    p->_nfree = 0;
+    p->_slabs = NULL;
+    p->_nslabs = p->_nbufs = 0;
+    p->_reserved = 0;
+
+    atomic_init(&p->_in_use, 0);
+    atomic_init(&p->_in_use_peak, 0);
+    atomic_init(&p->_cached, 0);
+    atomic_init(&p->_exhausted, 0);
+    return HTTP_ERR_OK;
+}
+
+static void _pool_count_acquired(HTTP_BufferPool *p) {
+    size_t in_use = atomic_fetch_add(&p->_in_use, 1) + 1;
+    size_t peak = atomic_load(&p->_in_use_peak);
+    while (in_use > peak && !atomic_compare_exchange_weak(&p->_in_use_peak, &peak, in_use));
+}
+
+char *http_buffer_pool_get(HTTP_BufferPool *p) {
+    _HTTP_PoolCache *cache = &_http_pool_cache;
+    if (cache->pool == p && cache->len > 0) {
+        atomic_fetch_sub(&p->_cached, 1);
+        _pool_count_acquired(p);
+        return cache->items[--cache->len];
+    }
+
+    pthread_mutex_lock(&p->_lock);
+    char *buf = _pool_pop(p);
+    if (buf == NULL && _pool_grow(p)) buf = _pool_pop(p);
+    pthread_mutex_unlock(&p->_lock);
+
+    if (buf == NULL) {
+        atomic_fetch_add(&p->_exhausted, 1);
+        return NULL;
+    }
+    _pool_count_acquired(p);
+    return buf;
+}
+
+void http_buffer_pool_put(HTTP_BufferPool *p, char *buf) {
+    if (buf == NULL) return;
+    atomic_fetch_sub(&p->_in_use, 1);
+
+    _HTTP_PoolCache *cache = &_http_pool_cache;
+    if (cache->pool == NULL) cache->pool = p;
+    size_t cache_max = (p->thread_cache < HTTP_POOL_THREAD_CACHE_MAX) ? p->thread_cache : HTTP_POOL_THREAD_CACHE_MAX;
+    // Buffer, that is cached by this thread, can't be acquired by the others,
+    // which might be refused then, because of the limit
+    if (p->max_sz > 0) cache_max = 0;
+    if (cache->pool == p && cache->len < cache_max) {
+        cache->items[cache->len++] = buf;
+        atomic_fetch_add(&p->_cached, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&p->_lock);
+    _pool_push(p, buf);
+    pthread_mutex_unlock(&p->_lock);
+}
+
+HTTP_Err http_buffer_pool_acquire(HTTP_BufferPool *p, IO_Buffer *b) {
+    char *buf = http_buffer_pool_get(p);
+    if (buf == NULL) return HTTP_ERR_BUSY;
+    return io_err_to_http_err(io_buffer_init_with(b, buf, p->buf_sz));
+}
+
+void http_buffer_pool_release(HTTP_BufferPool *p, IO_Buffer *b) {
+    if (b->buf == NULL) return;
+    if (b->foreign) http_buffer_pool_put(p, b->buf);
+    else io_buffer_free(b);
+    *b = (IO_Buffer) {0};
+}
+
+void http_buffer_pool_flush_thread(HTTP_BufferPool *p) {
+    _HTTP_PoolCache *cache = &_http_pool_cache;
+    if (cache->pool != p) return;
+
+    atomic_fetch_sub(&p->_cached, cache->len);
+    pthread_mutex_lock(&p->_lock);
+    while (cache->len > 0) _pool_push(p, cache->items[--cache->len]);
+    pthread_mutex_unlock(&p->_lock);
+
+    cache->pool = NULL;
+}
+
+bool http_buffer_pool_available(HTTP_BufferPool *p) {
+    pthread_mutex_lock(&p->_lock);
+    bool available = p->_nfree > 0 || p->max_sz == 0 || p->max_sz - p->_reserved >= p->_stride;
+    pthread_mutex_unlock(&p->_lock);
+    return available;
+}
+
+HTTP_BufferPoolStats http_buffer_pool_stats(HTTP_BufferPool *p) {
+    HTTP_BufferPoolStats st = {0};
+    st.buf_sz = p->buf_sz;
+    st.max_sz = p->max_sz;
+
+    pthread_mutex_lock(&p->_lock);
+    st.reserved_sz = p->_reserved;
+    st.slabs = p->_nslabs;
+    for (HTTP_PoolSlab *s = p->_slabs; s != NULL; s = s->next) st.slabs_huge += s->huge;
+    st.bufs_total = p->_nbufs;
+    st.bufs_free = p->_nfree;
+    pthread_mutex_unlock(&p->_lock);
+
+    st.bufs_in_use = atomic_load(&p->_in_use);
+    st.bufs_in_use_peak = atomic_load(&p->_in_use_peak);
+    st.bufs_cached = atomic_load(&p->_cached);
+    st.exhausted = atomic_load(&p->_exhausted);
+    return st;
+}
+
+void http_buffer_pool_free(HTTP_BufferPool *p) {
+    // NOTE: Only the cache of the calling thread is dropped here. Other
+    //       threads must flush their caches before the pool is freed.
+    _HTTP_PoolCache *cache = &_http_pool_cache;
+    if (cache->pool == p) {
+        cache->pool = NULL;
+        cache->len = 0;
+    }
+
+    HTTP_PoolSlab *s = p->_slabs;
+    while (s != NULL) {
+        HTTP_PoolSlab *next = s->next;
+#ifdef __linux__
+        if (s->mapped) munmap(s->mem, s->sz);
+        else free(s->mem);
+#else
+        free(s->mem);
+#endif // __linux__
+        free(s);
+        s = next;
+    }
+    pthread_mutex_destroy(&p->_lock);
+    memset(p, 0, sizeof(*p));
+}
+
+#  endif // HTTP_POOL_IMPL_GUARD
+#endif // HTTP_POOL_IMPL
+
+/*
+ * Copyright (c) 2025 Artem Darizhapov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
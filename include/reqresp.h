@@ -4,37 +4,127 @@
 #include <stdbool.h>
 
 #include "err.h"
+#include "clock.h"
 #include "common.h"
+#include "compress.h"
+#include "date.h"
+#include "etag.h"
+#include "headers.h"
+#include "phase.h"
+#include "da.h"
+
+// Number of headers, that a response stores without allocating
+#ifndef HTTP_RESPONSE_INLINE_HEADERS
+#  define HTTP_RESPONSE_INLINE_HEADERS 8
+#endif // HTTP_RESPONSE_INLINE_HEADERS
+
+// Response head, that fits into this many bytes, is serialized on the stack
+#ifndef HTTP_RESPONSE_HEAD_BUF_SZ
+#  define HTTP_RESPONSE_HEAD_BUF_SZ (2*1<<10)
+#endif // HTTP_RESPONSE_HEAD_BUF_SZ
+
+// Larger bodies are not held back to get their ETag, and are sent without it
+#ifndef HTTP_RESPONSE_ETAG_MAX_SZ
+#  define HTTP_RESPONSE_ETAG_MAX_SZ (1*1<<20)
+#endif // HTTP_RESPONSE_ETAG_MAX_SZ
 
 typedef plex {
     HTTP_Method          method;
     HTTP_Version         httpver;
     HTTP_URL             url;
+    char                *url_str; // Request-URI as it was received
     HTTP_PathComponents *pc;
 
     HTTP_Headers headers;
     uint64_t     content_length;
 
     int connfd;
+    /* Per-connection arena, if enabled by the server (NULL otherwise). Handlers
+       may use it for their own scratch memory, see http_request_alloc() */
+    HTTP_Arena *arena;
+    /* Monotonic time (see http_clock_ns()) of each phase of the request, that
+       has passed, if the server records them (see `phases` of HTTP_Server),
+       0 otherwise */
+    uint64_t phases[HTTP_PHASES];
     /* Server will use this to parse the incoming request */
     HTTP_Parser *_parser;
+    /* Decoding of the body, that is set up by the server (NULL otherwise),
+       and the decompressor, that is acquired once the body is read */
+    HTTP_Decompression *_decompression;
+    HTTP_Decompressor *_decompressor;
+    size_t _last_read; // decoded bytes returned by the last chunk read
 } HTTP_Request;
 
+/**
+ * Copy of a response, that is made while the response is sent. Connection
+ * specific headers (`Connection`) are left out.
+ */
+typedef plex {
+    HTTP_StringBuilder sb;
+    size_t max_sz;    // capturing is abandoned, once the copy exceeds this
+    size_t head_len;  // see HTTP_SerializedResponse
+    size_t date_off;
+    bool   failed;    // the copy is incomplete
+} HTTP_ResponseCapture;
+
 typedef plex {
     HTTP_Status  status;
     HTTP_Version httpver;
 
+    /* NOTE: The first HTTP_RESPONSE_INLINE_HEADERS headers are stored in
+             `_inline_headers`, so the response must not be moved after a
+             header was added. Add headers with http_response_add_header*() */
     HTTP_Headers headers;
+    HTTP_Header  _inline_headers[HTTP_RESPONSE_INLINE_HEADERS];
     uint64_t     content_length;
 
     int connfd;
+    uint64_t bytes_sent; // head and body bytes written to the connection
     /* Client will use this to parse the incoming response */
     HTTP_Parser *_parser;
 
+    /* Value of "Connection" header, that is added on send, unless the header
+       was set explicitly. Server uses it to manage persistent connections */
+    const char *_connection;
+    /* Headers, that are added to every response by the server (see
+       `date_header` and `common_headers` of HTTP_Server) */
+    bool _date;
+    const char *_common_head; // serialized ahead of time
+    size_t _common_head_len;
+    /* Phases of the request, that get the time the head and the last byte
+       of the response are written (NULL, if not recorded) */
+    uint64_t *_phases;
+    /* Server will use this to cache the response (NULL otherwise) */
+    HTTP_ResponseCapture *_capture;
+    /* Compression, that the client accepts (NULL otherwise), and the
+       compressor of the body, if it's decided to compress it on send */
+    HTTP_Compression *_compression;
+    HTTP_Compressor *_compressor;
+    /* ETag mode, that is set up by the server (see `etag` of
+       HTTP_HandlerOpts): the body is held back and hashed as it's written,
+       and is sent with its ETag on finish, unless `If-None-Match` of the
+       request (may be NULL) matches it, so 304 is sent instead */
+    bool _etag;
+    const char *_if_none_match;
+    bool _held;         // head and body are held back to get the ETag
+    bool _not_modified; // 304 was sent, so the body is dropped
+    HTTP_Hash _hash;
+    HTTP_StringBuilder _held_body;
+    char _etag_value[HTTP_ETAG_MAX_LEN];
     bool _was_sent;
 } HTTP_Response;
 
 HTTP_Err http_request_init(HTTP_Request *req, int connfd);
+
+/**
+ * Fills request `req` with the message parsed by parser `p`.
+ *
+ * The request takes ownership of the parser's headers and URL string without
+ * copying them. Parser must have parsed the headers already. It keeps its
+ * stage, so the body is still read through it; once the request is done,
+ * reset the parser with http_parser_reset() to reuse it for the next message.
+ */
+HTTP_Err http_request_from_parser(HTTP_Request *req, HTTP_Parser *p);
 HTTP_Err http_response_init(HTTP_Response *resp, int connfd);
 HTTP_Err http_request_free(HTTP_Request *req);
 HTTP_Err http_response_free(HTTP_Response *resp);
@@ -52,14 +142,80 @@ HTTP_Version http_request_httpver(HTTP_Request *req);
 HTTP_Headers http_request_headers(HTTP_Request *req);
 uint64_t     http_request_content_length(HTTP_Request *req);
 
+/**
+ * Returns the number of read() calls performed on the connection to receive
+ * request `req` so far.
+ */
+size_t http_request_syscalls(HTTP_Request *req);
+
 /**
  * Stream body of HTTP Request `req` into buffer `chunk` of size `chunk_sz`.
+ * Use http_request_last_read() to get the number of bytes put into `chunk`.
+ *
+ * If the server decodes the request (see `decompress` of HTTP_Server), the
+ * body is inflated into `chunk` as it's read, and `content_length` is the
+ * size of the encoded body. Bodies, that turn out larger than allowed, fail
+ * with HTTP_ERR_BODY_TOO_LARGE, and corrupted ones with
+ * HTTP_ERR_FAILED_PARSE.
  *
  * On successful read returns HTTP_ERR_CONT. Once consumed successfully,
  * returns HTTP_ERR_OK.
  */
 HTTP_Err http_request_read_body_chunk(HTTP_Request *req, char *chunk, size_t chunk_sz);
 
+/**
+ * Returns the number of bytes put into the chunk by the last call to
+ * http_request_read_body_chunk().
+ */
+size_t http_request_last_read(HTTP_Request *req);
+
+/**
+ * Reads up to `len` bytes of body of HTTP Request `req` into `buf`.
+ *
+ * Bytes already received together with the headers are served first, the rest
+ * is read straight from the socket into `buf`, until it is full or the body
+ * is over. Prefer it over http_request_read_body_chunk() for large bodies.
+ *
+ * If the server decodes the request (see `decompress` of HTTP_Server), the
+ * body is inflated into `buf`, same as with http_request_read_body_chunk().
+ *
+ * Returns the number of bytes read, 0 once the body is consumed, or a
+ * negative HTTP_Err on failure.
+ */
+ssize_t http_request_read_body(HTTP_Request *req, char *buf, size_t len);
+
+/**
+ * Vectored version of http_request_read_body(), that scatters the body into
+ * `iovcnt` regions `iov`.
+ *
+ * Doesn't decode the body: if the server decodes the request, fails with
+ * HTTP_ERR_ENCODED_BODY.
+ */
+ssize_t http_request_readv_body(HTTP_Request *req, const plex iovec *iov, int iovcnt);
+
+/**
+ * Moves the rest of the body of HTTP Request `req` into file descriptor
+ * `out_fd`, saving the number of bytes moved into `written`.
+ *
+ * The body is moved without copying it through user space, where possible
+ * (see http_parser_splice_body()). Useful for upload endpoints, that store the
+ * body into a file or pass it to another socket.
+ *
+ * Doesn't decode the body: if the server decodes the request, fails with
+ * HTTP_ERR_ENCODED_BODY.
+ */
+HTTP_Err http_request_splice_body(HTTP_Request *req, int out_fd, size_t *written);
+
+/**
+ * Allocates `n` bytes of scratch memory, that lives until the end of the
+ * request `req`.
+ *
+ * If the server has arena enabled, the memory comes from request's arena and
+ * is released automatically. Otherwise, it's allocated with `HTTP_REALLOC`
+ * and must be freed by the caller with `HTTP_FREE`.
+ */
+void *http_request_alloc(HTTP_Request *req, size_t n);
+
 /**
  * Returns request's (`req`) path variable that matches handler's pattern at
  * position `pos`.
@@ -73,15 +229,53 @@ HTTP_Err http_request_read_body_chunk(HTTP_Request *req, char *chunk, size_t chu
 HTTP_PathComponents *http_request_pathvar(HTTP_Request *req, size_t pos);
 HTTP_PathComponents *http_request_path_components(HTTP_Request *req);
 HTTP_Err             http_response_add_header(HTTP_Response *resp, const char *hname, const char *hval);
+
+/**
+ * Same as http_response_add_header(), but stores `hname` and `hval` without
+ * copying them. Both must stay valid until the response is freed.
+ */
+HTTP_Err http_response_add_header_borrowed(HTTP_Response *resp, const char *hname, const char *hval);
+
+/**
+ * Same as http_response_add_header_borrowed() for string literals `hname` and
+ * `hval`, whose lengths are known at compile time.
+ */
+#define http_response_add_header_static(resp, hname, hval)              \
+    _http_response_add_header_n((resp), "" hname, sizeof(hname) - 1,    \
+                                "" hval, sizeof(hval) - 1)
+HTTP_Err _http_response_add_header_n(HTTP_Response *resp, const char *hname, size_t hname_len,
+                                     const char *hval, size_t hval_len);
 HTTP_Err             http_response_set_status_code(HTTP_Response *resp, uint16_t sc);
 HTTP_Err             http_response_set_content_length(HTTP_Response *resp, uint64_t content_length);
 HTTP_Err             http_response_send(HTTP_Response *resp, uint16_t sc);
+
+/**
+ * Completes the body of response `resp`, once all of it was written with
+ * http_response_write_body_chunk().
+ *
+ * If the server decided to compress the body (see `compress` of
+ * HTTP_Server), the body is sent in chunks of unknown size, so it has to be
+ * terminated. If the body was held back to get its ETag (see `etag` of
+ * HTTP_HandlerOpts), it's sent only now. Server calls it after the handler
+ * returns.
+ */
+HTTP_Err http_response_finish(HTTP_Response *resp);
+
+/**
+ * Sends interim `100 Continue` response over the connection of response
+ * `resp`, telling the client to proceed with sending the request body.
+ *
+ * The final response still has to be sent with http_response_send().
+ */
+HTTP_Err http_response_send_continue(HTTP_Response *resp);
 #endif // HTTP_REQRESP_H
 
 #ifdef HTTP_REQRESP_IMPL
 #  ifndef HTTP_REQRESP_IMPL_GUARD
 #    define HTTP_REQRESP_IMPL_GUARD
 
+#include <strings.h>
+
 #include "io.h"
 #include "parser.h"
 #define HTTP_SOCK_IMPL
@@ -92,13 +286,41 @@ HTTP_Err http_request_init(HTTP_Request *req, int connfd) {
     req->httpver = (HTTP_Version) {.maj = 1, .min = 1};
     http_url_free(&req->url);
     req->url = (HTTP_URL) {0};
+    req->url_str = NULL;
     req->pc = NULL;
 
     req->headers = (HTTP_Headers) {0};
     req->content_length = 0;
 
     req->connfd = connfd;
+    req->arena = http_arena_current();
+    req->_decompression = NULL;
+    req->_decompressor = NULL;
+    req->_last_read = 0;
+    memset(req->phases, 0, sizeof(req->phases));
+
+    return HTTP_ERR_OK;
+}
+
+HTTP_Err http_request_from_parser(HTTP_Request *req, HTTP_Parser *p) {
+    if (p->stage < HTTP_PS_BODY) return HTTP_ERR_WRONG_STAGE;
+    HTTP_Err err;
 
+    req->method  = p->method;
+    req->httpver = p->httpver;
+    req->content_length = p->content_length;
+
+    http_headers_free(&req->headers);
+    req->headers = p->headers;
+    p->headers = (HTTP_Headers) {0};
+
+    if (req->url_str) HTTP_FREE(req->url_str);
+    req->url_str = p->url_str;
+    p->url_str = NULL;
+    if (req->url_str == NULL) return HTTP_ERR_FAILED_PARSE;
+    if ((err = http_request_set_url(req, req->url_str))) return err;
+
+    req->_parser = p;
     return HTTP_ERR_OK;
 }
 
@@ -121,7 +343,7 @@ HTTP_PathComponents *http_request_pathvar(HTTP_Request *req, size_t pos) {
         if (cur->wc_idx == (ssize_t)pos) {
             HTTP_PathComponents **pv = (last == NULL) ? &root : &last->next;
             *pv = HTTP_REALLOC(NULL, sizeof(HTTP_PathComponents));
-            (*pv)->value = strdup(cur->value);
+            (*pv)->value = HTTP_STRDUP(cur->value);
             (*pv)->next = NULL;
             (*pv)->wc_idx = cur->wc_idx;
 
@@ -133,17 +355,87 @@ HTTP_PathComponents *http_request_pathvar(HTTP_Request *req, size_t pos) {
     return root;
 }
 
+/**
+ * Pulls encoded body of request, that is parsed by parser `ctx`, for its
+ * decompressor.
+ */
+static HTTP_Err _request_read_encoded(void *ctx, char *buf, size_t sz, size_t *len) {
+    ssize_t n = http_parser_read_body((HTTP_Parser *)ctx, buf, sz);
+    if (n < 0) return (HTTP_Err)n;
+    *len = n;
+    return HTTP_ERR_OK;
+}
+
+/**
+ * Inflates body of request `req` into buffer `chunk` of size `chunk_sz`.
+ */
+static HTTP_Err _request_read_decoded(HTTP_Request *req, char *chunk, size_t chunk_sz) {
+    HTTP_Decompression *dc = req->_decompression;
+    if (req->_decompressor == NULL &&
+        (req->_decompressor = http_decompressor_acquire(dc->pool, dc->encoding)) == NULL)
+        return HTTP_ERR_OOM;
+
+    HTTP_Decompressor *d = req->_decompressor;
+    HTTP_Err err = http_decompressor_read(d, chunk, chunk_sz, &req->_last_read, _request_read_encoded, req->_parser);
+    if (dc->max_sz > 0 && d->total_out > dc->max_sz) return HTTP_ERR_BODY_TOO_LARGE;
+    return err;
+}
+
 HTTP_Err http_request_read_body_chunk(HTTP_Request *req, char *chunk, size_t chunk_sz) {
+    req->_last_read = 0;
+    if (req->_decompression) return _request_read_decoded(req, chunk, chunk_sz);
     if (req->_parser->stage == HTTP_PS_DONE) return HTTP_ERR_OK;
 
     HTTP_Err err = http_parser_stream_body(req->_parser, chunk, chunk_sz);
+    req->_last_read = http_parser_last_read(req->_parser);
 
     if (err == HTTP_ERR_OK) return HTTP_ERR_CONT;
     return err;
 }
 
+size_t http_request_last_read(HTTP_Request *req) {
+    return req->_last_read;
+}
+
+ssize_t http_request_read_body(HTTP_Request *req, char *buf, size_t len) {
+    if (req->_decompression == NULL) return http_parser_read_body(req->_parser, buf, len);
+
+    HTTP_Err err;
+    do {
+        req->_last_read = 0;
+        err = _request_read_decoded(req, buf, len);
+    } while (err == HTTP_ERR_CONT && req->_last_read == 0 && len > 0);
+    if (err == HTTP_ERR_CONT) return req->_last_read;
+    return err;
+}
+
+ssize_t http_request_readv_body(HTTP_Request *req, const plex iovec *iov, int iovcnt) {
+    if (req->_decompression) return HTTP_ERR_ENCODED_BODY;
+    return http_parser_readv_body(req->_parser, iov, iovcnt);
+}
+
+HTTP_Err http_request_splice_body(HTTP_Request *req, int out_fd, size_t *written) {
+    *written = 0;
+    if (req->_decompression) return HTTP_ERR_ENCODED_BODY;
+    return http_parser_splice_body(req->_parser, out_fd, written);
+}
+
+size_t http_request_syscalls(HTTP_Request *req) {
+    if (req->_parser == NULL) return 0;
+    return http_parser_syscalls(req->_parser);
+}
+
+void *http_request_alloc(HTTP_Request *req, size_t n) {
+    if (req->arena) return http_arena_alloc(req->arena, n);
+    return HTTP_REALLOC(NULL, n);
+}
+
 HTTP_Err http_request_free(HTTP_Request *req) {
+    if (req->_decompressor) http_decompressor_release(req->_decompression->pool, req->_decompressor);
+    req->_decompressor = NULL;
+    req->_decompression = NULL;
     http_url_free(&req->url);
+    if (req->url_str) HTTP_FREE(req->url_str);
     http_headers_free(&req->headers);
     http_pc_free(req->pc);
 
@@ -151,9 +443,9 @@ HTTP_Err http_request_free(HTTP_Request *req) {
 }
 
 HTTP_Err http_request_add_header(HTTP_Request *req, const char *hname, const char *hval) {
-    char *hn = strdup(hname);
+    char *hn = HTTP_STRDUP(hname);
     if (hn == NULL) return HTTP_ERR_OOM;
-    char *hv = strdup(hval);
+    char *hv = HTTP_STRDUP(hval);
     if (hv == NULL) return HTTP_ERR_OOM;
 
     http_da_append(&req->headers, ((HTTP_Header){ .k = hn, .v = hv }));
@@ -173,6 +465,21 @@ HTTP_Err http_response_init(HTTP_Response *resp, int connfd) {
     resp->content_length = 0;
 
     resp->connfd = connfd;
+    resp->bytes_sent = 0;
+    resp->_connection = NULL;
+    resp->_date = false;
+    resp->_common_head = NULL;
+    resp->_common_head_len = 0;
+    resp->_phases = NULL;
+    resp->_capture = NULL;
+    resp->_compression = NULL;
+    resp->_compressor = NULL;
+    resp->_etag = false;
+    resp->_if_none_match = NULL;
+    resp->_held = false;
+    resp->_not_modified = false;
+    resp->_held_body = (HTTP_StringBuilder) {0};
+    resp->_was_sent = false;
 
     return HTTP_ERR_OK;
 }
@@ -187,43 +494,346 @@ HTTP_Err http_response_set_content_length(HTTP_Response *resp, uint64_t content_
     return HTTP_ERR_OK;
 }
 
+/**
+ * Appends header `h` to response `resp`, keeping the first
+ * HTTP_RESPONSE_INLINE_HEADERS headers in the response itself.
+ */
+static HTTP_Err _response_push_header(HTTP_Response *resp, HTTP_Header h) {
+    HTTP_Headers *hs = &resp->headers;
+    if (hs->items == NULL) {
+        hs->items = resp->_inline_headers;
+        hs->cap = HTTP_RESPONSE_INLINE_HEADERS;
+    }
+    if (hs->len == hs->cap) {
+        size_t cap = hs->cap * 2;
+        bool is_inline = hs->items == resp->_inline_headers;
+        HTTP_Header *items = HTTP_REALLOC(is_inline ? NULL : hs->items, cap * sizeof(*items));
+        if (items == NULL) return HTTP_ERR_OOM;
+        if (is_inline) memcpy(items, hs->items, hs->len * sizeof(*items));
+        hs->items = items;
+        hs->cap = cap;
+    }
+    hs->items[hs->len++] = h;
+    return HTTP_ERR_OK;
+}
+
 HTTP_Err http_response_add_header(HTTP_Response *resp, const char *hname, const char *hval) {
-    char *hn = strdup(hname);
-    if (hn == NULL) return HTTP_ERR_OOM;
-    char *hv = strdup(hval);
-    if (hv == NULL) return HTTP_ERR_OOM;
+    HTTP_Err result = HTTP_ERR_OK;
+    size_t kl = strlen(hname), vl = strlen(hval);
+    char *hn = HTTP_STRNDUP(hname, kl);
+    char *hv = HTTP_STRNDUP(hval, vl);
+    if (hn == NULL || hv == NULL) http_return_defer(HTTP_ERR_OOM);
+
+    HTTP_Err err = _response_push_header(resp, (HTTP_Header){ .k = hn, .v = hv, .kl = kl, .vl = vl });
+    if (err != HTTP_ERR_OK) http_return_defer(err);
+    return HTTP_ERR_OK;
 
-    http_da_append(&resp->headers, ((HTTP_Header){ .k = hn, .v = hv }));
+ defer:
+    if (hn) HTTP_FREE(hn);
+    if (hv) HTTP_FREE(hv);
+    return result;
+}
+
+HTTP_Err _http_response_add_header_n(HTTP_Response *resp, const char *hname, size_t hname_len,
+                                     const char *hval, size_t hval_len) {
+    // NOTE: Borrowed strings are never written to, nor freed
+    return _response_push_header(resp, (HTTP_Header){
+        .k = (char *)hname, .v = (char *)hval, .kl = hname_len, .vl = hval_len, .borrowed = true,
+    });
+}
+
+HTTP_Err http_response_add_header_borrowed(HTTP_Response *resp, const char *hname, const char *hval) {
+    return _http_response_add_header_n(resp, hname, strlen(hname), hval, strlen(hval));
+}
+
+HTTP_Err http_response_send_continue(HTTP_Response *resp) {
+    char line[32];
+    int n = snprintf(line, sizeof(line), "HTTP/%hu.%hu 100 Continue\r\n\r\n",
+                     resp->httpver.maj, resp->httpver.min);
+    if (write(resp->connfd, line, n) != n) return HTTP_ERR_FAILED_WRITE;
+    resp->bytes_sent += n;
     return HTTP_ERR_OK;
 }
 
-HTTP_Err http_response_send(HTTP_Response *resp, uint16_t sc) {
-    if (resp->_was_sent) {
-        char peer_addr[HTTP_ADDR_REPR_MAX_LEN] = {0};
-        http_sock_get_repr(resp->connfd, peer_addr, HTTP_ADDR_REPR_MAX_LEN, true);
-        HTTP_WARN("Duplicate call to http_response_send(). The response was headed to \"%s\". Ignoring this call...", peer_addr);
-        return HTTP_ERR_OK;
+/**
+ * Returns status line of HTTP/1.1 response with status code `sc`, saving its
+ * length into `len`, or NULL if the status code is unknown.
+ *
+ * The lines are serialized at compile time.
+ */
+static const char *_status_line(uint16_t sc, size_t *len) {
+    switch (sc) {
+#define XX(num, name, phrase)                                           \
+    case num:                                                           \
+        *len = sizeof("HTTP/1.1 " #num " " phrase "\r\n") - 1;          \
+        return "HTTP/1.1 " #num " " phrase "\r\n";
+    HTTP_STATUS_MAP(XX)
+#undef XX
+    default: return NULL;
     }
+}
+
+// Length of "HTTP/1.1", that is replaced, if the response is of other version
+#define _STATUS_LINE_VERSION_LEN 8
+// Longest decimal representation of uint64_t
+#define _UTOA_MAX_LEN 20
+
+#define _REASON_PHRASE_MAX_LEN 32
+#define XX(num, name, phrase) \
+    _Static_assert(sizeof(phrase) - 1 <= _REASON_PHRASE_MAX_LEN, "Too long reason phrase of " #num);
+HTTP_STATUS_MAP(XX)
+#undef XX
+
+/**
+ * Writes decimal representation of `v` into `dest`, that must have room for
+ * _UTOA_MAX_LEN bytes.
+ *
+ * Returns pointer past the last written byte.
+ */
+static char *_utoa(uint64_t v, char *dest) {
+    char tmp[_UTOA_MAX_LEN];
+    size_t n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+    while (n > 0) *dest++ = tmp[--n];
+    return dest;
+}
+
+// Headers, that were appended to the list directly, may lack lengths
+static inline size_t _header_klen(HTTP_Header *h) { return h->kl ? h->kl : strlen(h->k); }
+static inline size_t _header_vlen(HTTP_Header *h) { return h->vl ? h->vl : strlen(h->v); }
+
+static inline char *_put(char *dest, const char *src, size_t n) {
+    memcpy(dest, src, n);
+    return dest + n;
+}
+
+#define _put_lit(dest, lit) _put((dest), (lit), sizeof(lit) - 1)
 
-    HTTP_StringBuilder sb = {0};
-    http_sb_append_format(&sb, "HTTP/%hu.%hu %u %s\r\n",
-                          resp->httpver.maj, resp->httpver.min, sc, http_reason_phrase(sc));
+/**
+ * Serializes status line and headers of response `resp` with status code
+ * `sc` into `dest`, that must have room for the number of bytes returned by
+ * _response_head_sz().
+ *
+ * Returns pointer past the last written byte, and saves offset of `Date`
+ * header value into `date_off`, if it's added.
+ */
+static char *_response_head_write(HTTP_Response *resp, uint16_t sc, const char *conn, bool date,
+                                  char *dest, size_t *date_off) {
+    char *w = dest;
+
+    size_t line_len = 0;
+    const char *line = _status_line(sc, &line_len);
+    bool is_http11 = resp->httpver.maj == 1 && resp->httpver.min == 1;
+    if (line && is_http11) {
+        w = _put(w, line, line_len);
+    } else {
+        w = _put_lit(w, "HTTP/");
+        w = _utoa(resp->httpver.maj, w);
+        *w++ = '.';
+        w = _utoa(resp->httpver.min, w);
+        if (line) {
+            w = _put(w, line + _STATUS_LINE_VERSION_LEN, line_len - _STATUS_LINE_VERSION_LEN);
+        } else {
+            *w++ = ' ';
+            w = _utoa(sc, w);
+            w = _put_lit(w, " UNKNOWN\r\n");
+        }
+    }
 
-    http_sb_append_format(&sb, "Content-Length: %zu\r\n", resp->content_length);
+    if (resp->_compressor) {
+        // Size of the compressed body is unknown, until it's compressed
+        w = _put_lit(w, "Transfer-Encoding: chunked\r\nContent-Encoding: ");
+        const char *enc = http_encoding_to_cstr(resp->_compressor->encoding);
+        w = _put(w, enc, strlen(enc));
+        w = _put_lit(w, "\r\nVary: Accept-Encoding\r\n");
+    } else {
+        w = _put_lit(w, "Content-Length: ");
+        w = _utoa(resp->content_length, w);
+        w = _put_lit(w, "\r\n");
+    }
+    if (conn) {
+        w = _put_lit(w, "Connection: ");
+        w = _put(w, conn, strlen(conn));
+        w = _put_lit(w, "\r\n");
+    }
+    if (date) {
+        w = _put_lit(w, "Date: ");
+        if (date_off) *date_off = w - dest;
+        w = _put(w, http_date_now(), HTTP_DATE_LEN);
+        w = _put_lit(w, "\r\n");
+    }
+    if (resp->_common_head_len > 0) w = _put(w, resp->_common_head, resp->_common_head_len);
     // TODO: Compose a list of values, if there are more than one values that
     //       correspond to the header key
     // TODO: Convert header key to canonical form for header's field name
     for (size_t i = 0; i < resp->headers.len; i++) {
-        if (strcmp(resp->headers.items[i].k, "Content-Length") == 0) continue;
-        http_sb_append_format(&sb, "%s: %s\r\n",
-                              resp->headers.items[i].k, resp->headers.items[i].v);
+        HTTP_Header *h = &resp->headers.items[i];
+        size_t kl = _header_klen(h);
+        if (kl == sizeof("Content-Length") - 1 && strcasecmp(h->k, "Content-Length") == 0) continue;
+        w = _put(w, h->k, kl);
+        w = _put_lit(w, ": ");
+        w = _put(w, h->v, _header_vlen(h));
+        w = _put_lit(w, "\r\n");
+    }
+    return _put_lit(w, "\r\n");
+}
+
+/**
+ * Returns the upper bound of the size of the head of response `resp`, and
+ * saves value of `Connection` header, that has to be added, into `conn`, and
+ * whether `Date` header has to be added into `date`.
+ */
+static size_t _response_head_sz(HTTP_Response *resp, const char **conn, bool *date) {
+    // Status line of any version and status code
+    size_t sz = sizeof("HTTP/.  \r\n") - 1 + 3*_UTOA_MAX_LEN + _REASON_PHRASE_MAX_LEN;
+    sz += sizeof("Content-Length: \r\n") - 1 + _UTOA_MAX_LEN;
+    if (resp->_compressor) sz += sizeof("Transfer-Encoding: chunked\r\nContent-Encoding: \r\nVary: Accept-Encoding\r\n") - 1 +
+                                 strlen(http_encoding_to_cstr(resp->_compressor->encoding));
+
+    *conn = resp->_connection;
+    *date = resp->_date;
+    for (size_t i = 0; i < resp->headers.len; i++) {
+        HTTP_Header *h = &resp->headers.items[i];
+        size_t kl = _header_klen(h);
+        if (kl == sizeof("Connection") - 1 && strcasecmp(h->k, "Connection") == 0) *conn = NULL;
+        if (kl == sizeof("Date") - 1 && strcasecmp(h->k, "Date") == 0) *date = false;
+        sz += kl + sizeof(": \r\n") - 1 + _header_vlen(h);
+    }
+    if (*conn) sz += sizeof("Connection: \r\n") - 1 + strlen(*conn);
+    if (*date) sz += sizeof("Date: \r\n") - 1 + HTTP_DATE_LEN;
+    sz += resp->_common_head_len;
+
+    return sz + sizeof("\r\n") - 1;
+}
+
+/**
+ * Copies head of response `resp` into capture `c`, leaving `Connection`
+ * header out. `sz` is the upper bound of the head size.
+ */
+static void _response_capture_head(HTTP_ResponseCapture *c, HTTP_Response *resp, uint16_t sc, bool date, size_t sz) {
+    if (sz > c->max_sz) {
+        c->failed = true;
+        return;
     }
-    http_sb_append_cstr(&sb, "\r\n");
-    http_sb_finalize(&sb);
-    if (write(resp->connfd, sb.items, sb.len) == -1) return HTTP_ERR_FAILED_WRITE;
-    http_sb_free(&sb);
+    http_da_reserve(&c->sb, sz);
+    c->date_off = 0;
+    c->sb.len = _response_head_write(resp, sc, NULL, date, c->sb.items, &c->date_off) - c->sb.items;
+    c->head_len = c->sb.len - (sizeof("\r\n") - 1);
+}
+
+/**
+ * Decides whether body of response `resp` with status code `sc` should be
+ * compressed.
+ */
+static bool _response_compressible(HTTP_Response *resp, uint16_t sc) {
+    HTTP_Compression *c = resp->_compression;
+    // These responses have no body (RFC 2616, section 4.3)
+    if (sc < 200 || sc == HTTP_Status_NO_CONTENT || sc == HTTP_Status_NOT_MODIFIED) return false;
+    if (resp->content_length == 0 || resp->content_length < c->min_sz) return false;
+    if (http_headers_get(&resp->headers, "Content-Encoding")) return false;
+    char *ct = http_headers_get(&resp->headers, "Content-Type");
+    return ct != NULL && http_content_type_compressible(ct);
+}
+
+/**
+ * Counts `n` bytes of response `resp`, that were just written, and the time
+ * the last of them was written, if the phases are recorded.
+ */
+static inline void _response_count_sent(HTTP_Response *resp, size_t n) {
+    resp->bytes_sent += n;
+    if (resp->_phases) resp->_phases[HTTP_Phase_LAST_BYTE] = http_clock_ns();
+}
+
+/**
+ * Sends head of response `resp` with status code `sc`.
+ */
+static HTTP_Err _response_send_head(HTTP_Response *resp, uint16_t sc) {
+    // Head is serialized with plain copies into a buffer, that is sized up
+    // front, so it never has to grow
+    const char *conn = NULL;
+    bool date = false;
+    size_t sz = _response_head_sz(resp, &conn, &date);
+    char stack_buf[HTTP_RESPONSE_HEAD_BUF_SZ];
+    char *buf = (sz <= sizeof(stack_buf)) ? stack_buf : HTTP_REALLOC(NULL, sz);
+    if (buf == NULL) return HTTP_ERR_OOM;
+
+    size_t len = _response_head_write(resp, sc, conn, date, buf, NULL) - buf;
+    HTTP_ASSERT(len <= sz && "Response head exceeds its estimated size");
+    ssize_t n = write(resp->connfd, buf, len);
+    if (buf != stack_buf) HTTP_FREE(buf);
+    if (n != (ssize_t)len) return HTTP_ERR_FAILED_WRITE;
+    _response_count_sent(resp, n);
+    if (resp->_phases) resp->_phases[HTTP_Phase_HEADERS_SENT] = resp->_phases[HTTP_Phase_LAST_BYTE];
+    resp->status = sc;
     resp->_was_sent = true;
 
+    // NOTE: Only identity responses are captured, since captured responses
+    //       are served to any client
+    if (resp->_capture && resp->_compressor) resp->_capture->failed = true;
+    else if (resp->_capture) _response_capture_head(resp->_capture, resp, sc, date, sz);
+    return HTTP_ERR_OK;
+}
+
+/**
+ * Sends 304 instead of response `resp`, dropping its body.
+ */
+static HTTP_Err _response_send_not_modified(HTTP_Response *resp) {
+    if (resp->_compressor) http_compressor_release(resp->_compression->pool, resp->_compressor);
+    resp->_compressor = NULL;
+    // Client's copy is not what the others should get
+    if (resp->_capture) resp->_capture->failed = true;
+    resp->_capture = NULL;
+    resp->_not_modified = true;
+    return _response_send_head(resp, HTTP_Status_NOT_MODIFIED);
+}
+
+HTTP_Err http_response_send(HTTP_Response *resp, uint16_t sc) {
+    if (resp->_was_sent) {
+        char peer_addr[HTTP_ADDR_REPR_MAX_LEN] = {0};
+        http_sock_get_repr(resp->connfd, peer_addr, HTTP_ADDR_REPR_MAX_LEN, true);
+        HTTP_WARN("Duplicate call to http_response_send(). The response was headed to \"%s\". Ignoring this call...", peer_addr);
+        return HTTP_ERR_OK;
+    }
+    // Falls back to sending the body as is, if no compressor is available
+    if (resp->_compression && _response_compressible(resp, sc))
+        resp->_compressor = http_compressor_acquire(resp->_compression->pool, resp->_compression->encoding);
+
+    if (resp->_etag && sc == HTTP_Status_OK) {
+        // ETag, that the handler knows, is checked right away
+        char *etag = http_headers_get(&resp->headers, "ETag");
+        if (etag) {
+            if (resp->_if_none_match && http_etag_match(resp->_if_none_match, etag, strlen(etag)))
+                return _response_send_not_modified(resp);
+        } else if (resp->content_length > 0 && resp->content_length <= HTTP_RESPONSE_ETAG_MAX_SZ) {
+            resp->status = sc;
+            resp->_was_sent = true;
+            resp->_held = true;
+            http_hash_init(&resp->_hash);
+            http_da_reserve(&resp->_held_body, resp->content_length);
+            return HTTP_ERR_OK;
+        }
+    }
+    return _response_send_head(resp, sc);
+}
+
+/**
+ * Writes `len` bytes of `data` to the connection of response `ctx` as a
+ * single chunk (RFC 2616, section 3.6.1).
+ */
+static HTTP_Err _response_write_chunk(void *ctx, const char *data, size_t len) {
+    HTTP_Response *resp = ctx;
+    char size_line[32];
+    int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+    plex iovec iov[] = {
+        { size_line, n },
+        { (char *)data, len },
+        { "\r\n", 2 },
+    };
+    if (writev(resp->connfd, iov, 3) != (ssize_t)(n + len + 2)) return HTTP_ERR_FAILED_WRITE;
+    _response_count_sent(resp, n + len + 2);
     return HTTP_ERR_OK;
 }
 
@@ -236,13 +846,81 @@ HTTP_Err http_response_write_body_chunk(HTTP_Response *resp, char *chunk, size_t
                   " to \"%s\". Ignoring this call... (call http_response_send() first!)", peer_addr);
         return HTTP_ERR_OK;
     }
+    if (resp->_not_modified) return HTTP_ERR_OK;
+    if (resp->_held) {
+        http_hash_update(&resp->_hash, chunk, chunk_sz);
+        http_da_append_carr(&resp->_held_body, chunk, chunk_sz);
+        return HTTP_ERR_OK;
+    }
+
+    if (resp->_compressor)
+        return http_compressor_write(resp->_compressor, chunk, chunk_sz, false, _response_write_chunk, resp);
+    ssize_t n = write(resp->connfd, chunk, chunk_sz);
+    if (n == -1) return HTTP_ERR_FAILED_WRITE;
+    _response_count_sent(resp, n);
+
+    HTTP_ResponseCapture *c = resp->_capture;
+    if (c && !c->failed) {
+        if (c->sb.len + chunk_sz > c->max_sz) c->failed = true;
+        else http_da_append_carr(&c->sb, chunk, chunk_sz);
+    }
+    return HTTP_ERR_OK;
+}
+
+/**
+ * Sends response `resp`, that was held back, with its ETag, or 304, if the
+ * client has it already.
+ */
+static HTTP_Err _response_release_held(HTTP_Response *resp) {
+    HTTP_Err err;
+    resp->_held = false;
+    resp->_was_sent = false;
+
+    // Body, that turned out shorter or longer than promised, gets no ETag
+    HTTP_StringBuilder *b = &resp->_held_body;
+    if (b->len == resp->content_length) {
+        const char *enc = resp->_compressor ? http_encoding_to_cstr(resp->_compressor->encoding) : NULL;
+        size_t len = http_etag_format(http_hash_final(&resp->_hash), enc, resp->_etag_value);
+        if (len > 0) {
+            // 304 must carry the ETag too (RFC 7232, section 4.1)
+            if ((err = _http_response_add_header_n(resp, "ETag", 4, resp->_etag_value, len))) return err;
+            if (resp->_if_none_match && http_etag_match(resp->_if_none_match, resp->_etag_value, len))
+                return _response_send_not_modified(resp);
+        }
+    }
+    if ((err = _response_send_head(resp, resp->status))) return err;
+    if (b->len == 0) return HTTP_ERR_OK;
+    return http_response_write_body_chunk(resp, b->items, b->len);
+}
+
+HTTP_Err http_response_finish(HTTP_Response *resp) {
+    HTTP_Err err;
+    if (resp->_held && (err = _response_release_held(resp))) return err;
+
+    HTTP_Compressor *c = resp->_compressor;
+    if (c == NULL) return HTTP_ERR_OK;
+
+    err = http_compressor_write(c, NULL, 0, true, _response_write_chunk, resp);
+    http_compressor_release(resp->_compression->pool, c);
+    resp->_compressor = NULL;
+    if (err) return err;
 
-    if (write(resp->connfd, chunk, chunk_sz) == -1) return HTTP_ERR_FAILED_WRITE;
+    // The last chunk, with no trailers
+    if (write(resp->connfd, "0\r\n\r\n", 5) != 5) return HTTP_ERR_FAILED_WRITE;
+    _response_count_sent(resp, 5);
     return HTTP_ERR_OK;
 }
 
 HTTP_Err http_response_free(HTTP_Response *resp) {
-    http_headers_free(&resp->headers);
+    // Body was never finished, so the compressor is reused without flushing
+    if (resp->_compressor) http_compressor_release(resp->_compression->pool, resp->_compressor);
+    resp->_compressor = NULL;
+    http_sb_free(&resp->_held_body);
+    resp->_held_body = (HTTP_StringBuilder) {0};
+    HTTP_Headers *hs = &resp->headers;
+    for (size_t i = 0; i < hs->len; i++) http_header_free(&hs->items[i]);
+    if (hs->items && hs->items != resp->_inline_headers) HTTP_FREE(hs->items);
+    *hs = (HTTP_Headers) {0};
     return HTTP_ERR_OK;
 }
 
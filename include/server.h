@@ -1,14 +1,139 @@
 #ifndef HTTP_SERVER_H
 #  define HTTP_SERVER_H
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "accesslog.h"
+#include "cache.h"
+#include "clock.h"
 #include "common.h"
+#include "compress.h"
+#include "date.h"
+#include "etag.h"
+#include "headers.h"
+#include "metrics.h"
+#include "phase.h"
+#include "pool.h"
 #include "reqresp.h"
 #include "socket.h"
 #include "path.h"
 
+#ifndef HTTP_SERVER_KEEP_ALIVE_TIMEOUT
+#  define HTTP_SERVER_KEEP_ALIVE_TIMEOUT 60 // seconds
+#endif // HTTP_SERVER_KEEP_ALIVE_TIMEOUT
+
+// Memory the receive buffer pool may reserve, 0 means unlimited
+#ifndef HTTP_SERVER_POOL_MAX_SZ
+#  define HTTP_SERVER_POOL_MAX_SZ (64*1<<20)
+#endif // HTTP_SERVER_POOL_MAX_SZ
+
+// Unread request body up to this size is discarded to keep connection alive,
+// otherwise connection is closed
+#ifndef HTTP_SERVER_DRAIN_MAX_SZ
+#  define HTTP_SERVER_DRAIN_MAX_SZ (64*1<<10)
+#endif // HTTP_SERVER_DRAIN_MAX_SZ
+
+// Seconds the head of a started request may take to arrive, and a read of its
+// body may stall, before the request is answered with 408
+#ifndef HTTP_SERVER_REQUEST_TIMEOUT
+#  define HTTP_SERVER_REQUEST_TIMEOUT 10
+#endif // HTTP_SERVER_REQUEST_TIMEOUT
+
+// Request body may be at most this large, unless the route says otherwise
+#ifndef HTTP_SERVER_MAX_BODY_SZ
+#  define HTTP_SERVER_MAX_BODY_SZ (64*1<<20)
+#endif // HTTP_SERVER_MAX_BODY_SZ
+
+// Memory the response cache may take
+#ifndef HTTP_SERVER_CACHE_MAX_SZ
+#  define HTTP_SERVER_CACHE_MAX_SZ (32*1<<20)
+#endif // HTTP_SERVER_CACHE_MAX_SZ
+
+// zlib compression level of responses, 1 (fastest) to 9 (smallest)
+#ifndef HTTP_SERVER_COMPRESS_LEVEL
+#  define HTTP_SERVER_COMPRESS_LEVEL 6
+#endif // HTTP_SERVER_COMPRESS_LEVEL
+
+// Smaller response bodies are not worth compressing
+#ifndef HTTP_SERVER_COMPRESS_MIN_SZ
+#  define HTTP_SERVER_COMPRESS_MIN_SZ 1024
+#endif // HTTP_SERVER_COMPRESS_MIN_SZ
+
+// Larger decoded request bodies are rejected, however small the encoded ones
+#ifndef HTTP_SERVER_DECOMPRESS_MAX_SZ
+#  define HTTP_SERVER_DECOMPRESS_MAX_SZ (64*1<<20)
+#endif // HTTP_SERVER_DECOMPRESS_MAX_SZ
+
+// Seconds a file, that doesn't change, is kept in the cache
+#ifndef HTTP_SERVER_FILE_CACHE_TTL
+#  define HTTP_SERVER_FILE_CACHE_TTL (24*60*60)
+#endif // HTTP_SERVER_FILE_CACHE_TTL
+
+// Largest response, that is shared with the requests coalesced into it
+#ifndef HTTP_SERVER_COALESCE_MAX_SZ
+#  define HTTP_SERVER_COALESCE_MAX_SZ (1*1<<20)
+#endif // HTTP_SERVER_COALESCE_MAX_SZ
+
+// Memory the server spends on a single idle connection (see HTTP_Conn)
+#ifndef HTTP_SERVER_IDLE_CONN_MAX_SZ
+#  define HTTP_SERVER_IDLE_CONN_MAX_SZ 64
+#endif // HTTP_SERVER_IDLE_CONN_MAX_SZ
+
+/**
+ * Per-route options of a handler (see http_server_add_handler_ex()).
+ *
+ * They are applied once the headers are parsed, before any body bytes are
+ * read, so a rejected request costs neither upload bandwidth nor handler
+ * time. If the client sent `Expect: 100-continue`, it gets `100 Continue`
+ * only when the request passes the checks, otherwise it gets the final
+ * response right away.
+ */
+typedef plex {
+    /* Request body may be at most this large, 0 means the server's limit
+       (see `max_body_sz` of HTTP_Server). Larger requests are answered with
+       413 */
+    uint64_t max_body_sz;
+    /* Decides whether the request may proceed (e.g. checks authorization).
+       Returns HTTP_Status_CONTINUE to accept it, or a final status code to
+       respond with. May be NULL */
+    uint16_t (*precheck)(HTTP_Request *req);
+    /* Seconds responses to GET are cached for, 0 disables caching (see
+       `cache_max_sz` of HTTP_Server) */
+    int cache_ttl;
+    /* NULL-terminated names of request headers, that select the response
+       among the cached ones (as `Vary` does). May be NULL */
+    const char *const *cache_vary;
+    /* Identical GETs (same key as in the cache), that arrive while one of
+       them is being handled, wait for it and get a copy of its response
+       instead of calling the handler again. Takes effect only when the
+       server has `workers` */
+    bool coalesce;
+    /* Responses to GET get strong ETag, that is made by hashing the body
+       as the handler writes it (bodies up to HTTP_RESPONSE_ETAG_MAX_SZ are
+       held back for that), and clients, that have the same body already
+       (`If-None-Match`), get 304 without it */
+    bool etag;
+} HTTP_HandlerOpts;
+
 typedef plex {
     HTTP_PathPattern pattern;
     void (*handler)(HTTP_Response *resp, HTTP_Request *req);
+    HTTP_HandlerOpts opts;
+    /* Response, that is serialized once and served instead of calling
+       `handler`, if set (see http_server_add_static_response()), and its
+       gzip-encoded variant, if it's worth compressing */
+    HTTP_SerializedResponse static_resp;
+    HTTP_SerializedResponse static_gz;
+    /* File, that is served instead of calling `handler`, if set (see
+       http_server_add_file()), and its media type */
+    char *file_path;
+    char *file_type;
+    /* Metrics of the server are served instead of calling `handler`, if set
+       (see http_server_add_metrics()) */
+    bool metrics;
+    char *route; // pattern, that the route is registered with
 } HTTP_Handler;
 
 typedef plex {
@@ -16,18 +141,192 @@ typedef plex {
     HTTP_Handler *items;
 } HTTP_Handlers;
 
+/**
+ * State of a persistent connection, that waits for the next request.
+ *
+ * Idle connections don't hold any buffers: the receive buffer is returned to
+ * the server's pool, once a request is served, and is re-acquired only when
+ * the socket becomes readable again.
+ */
+typedef plex http_conn_s {
+    plex http_conn_s *prev, *next; // idle connections, least recent first
+    time_t idle_since;
+    uint64_t accepted; // see HTTP_Phase_ACCEPT, 0 if not recorded
+    uint32_t nrequests;
+    int fd;
+    bool paused; // waits for a receive buffer to become available
+    bool hup;    // peer has hung up, or the socket has failed
+} HTTP_Conn;
+
+/**
+ * Empty response, that is serialized once, when the server is initialized,
+ * and is written with a single syscall, when needed.
+ */
+typedef plex {
+    uint16_t status;
+    char *data;        // keeps the connection open
+    size_t len;
+    char *data_close;  // same, but with `Connection: close`
+    size_t len_close;
+} HTTP_CannedResponse;
+
+#define HTTP_SERVER_CANNED_MAX 10
+
+/**
+ * Handler invocation, that is in progress, and the requests, that wait for
+ * its response (see `coalesce` of HTTP_HandlerOpts).
+ */
+typedef plex http_flight_s {
+    plex http_flight_s *next;
+    char *key;
+    size_t key_len;
+    size_t refs;  // the leading request and the waiting ones
+    bool done;    // the leading request has been responded to
+    /* Response to the leading request, if it may be shared (`data` is NULL
+       otherwise, and the waiting requests call the handler on their own) */
+    HTTP_SerializedResponse resp;
+} HTTP_Flight;
+
+typedef plex http_server_s HTTP_Server;
+
+/**
+ * Thread, that serves connections, which have become readable, with its own
+ * arena.
+ */
 typedef plex {
+    pthread_t thread;
+    HTTP_Server *s;
+    HTTP_Arena arena;
+} HTTP_Worker;
+
+typedef plex {
+    size_t conns_idle;     // connections waiting for the next request
+    size_t conns_paused;   // connections waiting for a receive buffer
+    size_t idle_conn_sz;   // bytes held by the server per idle connection
+    HTTP_BufferPoolStats pool; // receive buffer pool
+    HTTP_CacheStats cache;     // response cache
+    HTTP_AccessLogStats access_log;
+    HTTP_AccessLogStats trace;
+} HTTP_ServerStats;
+
+plex http_server_s {
     char addr[HTTP_ADDR_REPR_MAX_LEN];
 
+    /* Options. May be changed between http_server_init() and
+       http_server_run() */
+    bool   use_arena;          // allocate per-connection memory from an arena
+    size_t arena_chunk_sz;     // size of a single arena chunk
+    size_t recv_buf_sz;        // initial size of a connection's receive buffer
+    size_t recv_buf_max_sz;    // receive buffer may grow up to this size
+    bool   keep_alive;         // support persistent connections
+    int    keep_alive_timeout; // seconds an idle connection is kept open
+    int    request_timeout;    // seconds the head of a started request may take,
+                               // and a read of its body may stall (408)
+    size_t pool_max_sz;        // memory the receive buffer pool may reserve
+    bool   pool_hugepages;     // back the receive buffer pool by huge pages
+    bool   mirrored_buffers;   // use double-mapped receive buffers (Linux)
+    HTTP_ParserLimits limits;  // bound memory spent on headers (414, 431)
+    uint64_t max_body_sz;      // larger request bodies are rejected (413)
+    bool   date_header;        // add `Date` header to handlers' responses
+    HTTP_Headers common_headers; // added to handlers' responses (e.g. `Server`)
+    size_t cache_max_sz;       // memory the response cache may take
+    size_t workers;            // threads serving connections, 0 serves them in http_server_run()
+    bool   compress;           // compress textual responses, if the client accepts it
+    int    compress_level;     // zlib compression level, 1 (fastest) to 9 (smallest)
+    size_t compress_min_sz;    // smaller response bodies are sent as is
+    bool   metrics;            // count requests and their latencies per route
+    bool   access_log;         // log served requests (see accesslog.h)
+    int    access_log_fd;      // file, that the access log is written to
+    uint32_t access_log_sample; // log every n-th request of a thread, 1 logs all
+    bool   phases;             // record time of each phase of requests (see HTTP_Request)
+    int    trace_fd;           // file, that requests are traced to (implies `phases`), -1 disables it
+    uint32_t trace_sample;     // trace every n-th request of a thread, 1 traces all
+    bool   decompress;         // inflate encoded request bodies as handlers read them
+    uint64_t decompress_max_sz; // larger decoded request bodies fail to read, 0 means no limit
+
     HTTP_Handlers _handlers;
+    HTTP_Arena _arena;
+    HTTP_BufferPool _pool;
+    HTTP_Cache _cache;
+    HTTP_CompressorPool _compressors;
+    HTTP_DecompressorPool _decompressors;
+    HTTP_Metrics _metrics;     // routes are followed by requests, that matched none
+    const char **_route_names;
+    HTTP_AccessLog _access_log;
+    HTTP_AccessLog _trace;
+    HTTP_CannedResponse _canned[HTTP_SERVER_CANNED_MAX];
+    HTTP_StringBuilder _common_head; // serialized `common_headers`
+    HTTP_Conn *_idle_head, *_idle_tail;
+    size_t _conns_idle, _conns_paused;
+    int _epollfd;
     int _sockfd;
-} HTTP_Server;
+
+    /* Connections are passed to the workers through `_ready`, and are
+       returned through `_served` to be polled again */
+    HTTP_Worker *_workers;
+    pthread_mutex_t _queue_lock;
+    pthread_cond_t _queue_cond;
+    HTTP_Conn *_ready_head, *_ready_tail;
+    HTTP_Conn *_served;
+    int _wakefd; // signals, that `_served` is not empty
+    bool _stopping;
+
+    pthread_mutex_t _flights_lock;
+    pthread_cond_t _flights_cond;
+    HTTP_Flight *_flights;
+};
 
 HTTP_Err http_server_init(HTTP_Server *s, const char *addr);
 HTTP_Err http_server_add_handler(HTTP_Server *s, const char *pattern, void (*handler)(HTTP_Response *resp, HTTP_Request *req));
+
+/**
+ * Same as http_server_add_handler(), but also sets options `opts` of the
+ * route (see HTTP_HandlerOpts). `opts` may be NULL.
+ */
+HTTP_Err http_server_add_handler_ex(HTTP_Server *s, const char *pattern,
+                                    void (*handler)(HTTP_Response *resp, HTTP_Request *req),
+                                    const HTTP_HandlerOpts *opts);
+
+/**
+ * Registers response with status code `sc`, headers `headers` (may be NULL)
+ * and body `body` of length `body_len` to be served for `pattern`.
+ *
+ * The response is serialized once, so serving it takes a single writev().
+ * `Content-Length` is set automatically. If `headers` contain `Date`, its
+ * value is updated on every request.
+ */
+HTTP_Err http_server_add_static_response(HTTP_Server *s, const char *pattern, uint16_t sc,
+                                         HTTP_Headers *headers, const char *body, size_t body_len);
+
+/**
+ * Registers file at `path` with media type `content_type` to be served for
+ * `pattern` in response to GET and HEAD.
+ *
+ * The file is read into the response cache (see `cache_max_sz` of
+ * HTTP_Server) together with its gzip-encoded variant, which is taken from
+ * `<path>.gz`, if there is such file and it's not older, or is compressed
+ * once. Both are served with a single writev() and re-read, once the file
+ * changes. Files, that don't fit into the cache, are read on every request.
+ */
+HTTP_Err http_server_add_file(HTTP_Server *s, const char *pattern, const char *path, const char *content_type);
+
+/**
+ * Registers metrics of server `s` to be served for `pattern` in Prometheus
+ * text format, and enables them (see `metrics` of HTTP_Server).
+ *
+ * Requests are counted per route and status code, together with the bytes
+ * received and sent, and the time spent parsing the head, in the handler, and
+ * serving the whole request (as histograms).
+ */
+HTTP_Err http_server_add_metrics(HTTP_Server *s, const char *pattern);
 HTTP_Err http_server_run(HTTP_Server *s);
 HTTP_Err http_server_free(HTTP_Server *s);
 
+/**
+ * Returns memory usage statistics of server `s`.
+ */
+HTTP_ServerStats http_server_stats(HTTP_Server *s);
+
 #endif // HTTP_SERVER_H
 
 #ifdef HTTP_SERVER_IMPL
@@ -35,18 +334,32 @@ HTTP_Err http_server_free(HTTP_Server *s);
 #    define HTTP_SERVER_IMPL_GUARD
 
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "da.h"
 #include "path.h"
 
-// TODO: Make it thread-safe
-static bool should_run = false;
+_Static_assert(sizeof(HTTP_Conn) <= HTTP_SERVER_IDLE_CONN_MAX_SZ,
+               "Idle connection state exceeds HTTP_SERVER_IDLE_CONN_MAX_SZ");
+
+// Checked by the workers as well, so it's atomic
+static atomic_bool should_run = false;
 static void _sigint_handler(int signo) {
     HTTP_UNUSED(signo);
-    should_run = true;
+    should_run = false;
 }
 
 static HTTP_Handler *_match_handler(HTTP_Server *s, HTTP_PathComponents *path) {
@@ -55,12 +368,77 @@ static HTTP_Handler *_match_handler(HTTP_Server *s, HTTP_PathComponents *path) {
 
     for (size_t i = 0; i < s->_handlers.len; i++) ptrns[i] = s->_handlers.items[i].pattern;
     ssize_t res = http_match_patterns(ptrns, s->_handlers.len, path);
-    free(ptrns);
+    HTTP_FREE(ptrns);
 
     if (res == -1) return NULL;
     return &s->_handlers.items[res];
 }
 
+/**
+ * Statuses of the responses, that the server sends on its own, when a request
+ * can't be passed to a handler.
+ */
+static const uint16_t _canned_statuses[HTTP_SERVER_CANNED_MAX] = {
+    HTTP_Status_BAD_REQUEST,
+    HTTP_Status_NOT_FOUND,
+    HTTP_Status_METHOD_NOT_ALLOWED,
+    HTTP_Status_REQUEST_TIMEOUT,
+    HTTP_Status_PAYLOAD_TOO_LARGE,
+    HTTP_Status_URI_TOO_LONG,
+    HTTP_Status_REQUEST_HEADER_FIELDS_TOO_LARGE,
+    HTTP_Status_INTERNAL_SERVER_ERROR,
+    HTTP_Status_NOT_IMPLEMENTED,
+    HTTP_Status_SERVICE_UNAVAILABLE,
+};
+
+static char *_canned_serialize(uint16_t sc, bool close, size_t *len) {
+    HTTP_StringBuilder sb = {0};
+    http_sb_append_format(&sb, "HTTP/1.1 %u %s\r\n", sc, http_reason_phrase(sc));
+    // 405 response MUST list the methods, that are supported (RFC 2616,
+    // section 10.4.6)
+    if (sc == HTTP_Status_METHOD_NOT_ALLOWED) {
+        http_sb_append_cstr(&sb, "Allow: ");
+        for (HTTP_Method m = HTTP_Method_OPTIONS; m <= HTTP_Method_CONNECT; m++)
+            http_sb_append_format(&sb, "%s%s", m == HTTP_Method_OPTIONS ? "" : ", ", http_method_to_cstr(m));
+        http_sb_append_cstr(&sb, "\r\n");
+    }
+    http_sb_append_cstr(&sb, "Content-Length: 0\r\n");
+    if (close) http_sb_append_cstr(&sb, "Connection: close\r\n");
+    http_sb_append_cstr(&sb, "\r\n");
+
+    *len = sb.len;
+    return sb.items;
+}
+
+static HTTP_Err _canned_init(HTTP_Server *s) {
+    for (size_t i = 0; i < HTTP_SERVER_CANNED_MAX; i++) {
+        HTTP_CannedResponse *c = &s->_canned[i];
+        c->status = _canned_statuses[i];
+        c->data = _canned_serialize(c->status, false, &c->len);
+        c->data_close = _canned_serialize(c->status, true, &c->len_close);
+        if (c->data == NULL || c->data_close == NULL) return HTTP_ERR_OOM;
+    }
+    return HTTP_ERR_OK;
+}
+
+static HTTP_CannedResponse *_find_canned(HTTP_Server *s, uint16_t sc) {
+    for (size_t i = 0; i < HTTP_SERVER_CANNED_MAX; i++)
+        if (s->_canned[i].status == sc) return &s->_canned[i];
+    return NULL;
+}
+
+/**
+ * Writes canned response `c` into connection `fd` with a single write().
+ */
+static HTTP_Err _send_canned(int fd, HTTP_CannedResponse *c, bool keep_alive) {
+    char *data = keep_alive ? c->data : c->data_close;
+    size_t len = keep_alive ? c->len : c->len_close;
+    // NOTE: Canned responses are much smaller than a socket send buffer, so
+    //       a short write means the connection is broken anyway
+    if (write(fd, data, len) != (ssize_t)len) return HTTP_ERR_FAILED_WRITE;
+    return HTTP_ERR_OK;
+}
+
 HTTP_Err http_server_init(HTTP_Server *s, const char *addr) {
     HTTP_Err err;
     if ((err = http_sock_create_and_listen(&s->_sockfd, addr))) return err;
@@ -68,93 +446,1756 @@ HTTP_Err http_server_init(HTTP_Server *s, const char *addr) {
     plex sigaction act = {0};
     act.sa_handler = &_sigint_handler;
     HTTP_ASSERT(sigaction(SIGINT, &act, NULL) == 0 && "Failed to bind SIGINT signal handler");
+    // Writing to a connection, that was reset by the peer, must fail only
+    // for this connection, instead of killing the whole server
+    act.sa_handler = SIG_IGN;
+    HTTP_ASSERT(sigaction(SIGPIPE, &act, NULL) == 0 && "Failed to ignore SIGPIPE signal");
 
     http_sock_get_repr(s->_sockfd, s->addr, HTTP_ADDR_REPR_MAX_LEN, false);
     should_run = true;
 
+    s->use_arena = false;
+    s->arena_chunk_sz = HTTP_ARENA_CHUNK_SZ;
+    s->recv_buf_sz = HTTP_PARSER_BUF_SZ;
+    s->recv_buf_max_sz = HTTP_PARSER_BUF_MAX_SZ;
+    s->keep_alive = true;
+    s->keep_alive_timeout = HTTP_SERVER_KEEP_ALIVE_TIMEOUT;
+    s->request_timeout = HTTP_SERVER_REQUEST_TIMEOUT;
+    s->pool_max_sz = HTTP_SERVER_POOL_MAX_SZ;
+    s->pool_hugepages = false;
+    s->mirrored_buffers = false;
+    s->limits = (HTTP_ParserLimits) {
+        .url_max_len        = HTTP_PARSER_URL_MAX_LEN,
+        .header_line_max_sz = HTTP_PARSER_HEADER_LINE_MAX_SZ,
+        .headers_max_sz     = HTTP_PARSER_HEADERS_MAX_SZ,
+        .headers_max_count  = HTTP_PARSER_HEADERS_MAX_COUNT,
+    };
+    s->max_body_sz = HTTP_SERVER_MAX_BODY_SZ;
+    s->date_header = true;
+    s->common_headers = (HTTP_Headers) {0};
+    s->cache_max_sz = HTTP_SERVER_CACHE_MAX_SZ;
+    s->workers = 0;
+    s->compress = false;
+    s->compress_level = HTTP_SERVER_COMPRESS_LEVEL;
+    s->compress_min_sz = HTTP_SERVER_COMPRESS_MIN_SZ;
+    s->decompress = false;
+    s->decompress_max_sz = HTTP_SERVER_DECOMPRESS_MAX_SZ;
+    s->metrics = false;
+    s->access_log = false;
+    s->access_log_fd = STDOUT_FILENO;
+    s->access_log_sample = 1;
+    s->phases = false;
+    s->trace_fd = -1;
+    s->trace_sample = 1;
+    if ((err = _canned_init(s))) return err;
+    s->_route_names = NULL;
+    s->_access_log._started = false;
+    s->_trace._started = false;
+
+    s->_idle_head = s->_idle_tail = NULL;
+    s->_conns_idle = s->_conns_paused = 0;
+    s->_epollfd = -1;
+
+    s->_workers = NULL;
+    s->_ready_head = s->_ready_tail = s->_served = NULL;
+    s->_wakefd = -1;
+    s->_flights = NULL;
+    if (pthread_mutex_init(&s->_queue_lock, NULL) != 0 || pthread_cond_init(&s->_queue_cond, NULL) != 0 ||
+        pthread_mutex_init(&s->_flights_lock, NULL) != 0 || pthread_cond_init(&s->_flights_cond, NULL) != 0)
+        return HTTP_ERR_OOM;
+
     return HTTP_ERR_OK;
 }
 
 // TODO: Check if such pattern is already handled
-HTTP_Err http_server_add_handler(HTTP_Server *s, const char *pattern, void (*handler)(HTTP_Response *resp, HTTP_Request *req)) {
+/**
+ * Registers route `h` of server `s` for `pattern`. On failure, `h` is left
+ * for the caller to free.
+ */
+static HTTP_Err _add_route(HTTP_Server *s, const char *pattern, HTTP_Handler *h) {
     HTTP_Err err;
+    if ((h->route = HTTP_STRDUP(pattern)) == NULL) return HTTP_ERR_OOM;
+    if ((err = http_pattern_init(&h->pattern, pattern))) {
+        HTTP_FREE(h->route);
+        h->route = NULL;
+        return err;
+    }
+    http_da_append(&s->_handlers, *h);
+    return HTTP_ERR_OK;
+}
+
+HTTP_Err http_server_add_handler(HTTP_Server *s, const char *pattern, void (*handler)(HTTP_Response *resp, HTTP_Request *req)) {
+    return http_server_add_handler_ex(s, pattern, handler, NULL);
+}
+
+HTTP_Err http_server_add_handler_ex(HTTP_Server *s, const char *pattern,
+                                    void (*handler)(HTTP_Response *resp, HTTP_Request *req),
+                                    const HTTP_HandlerOpts *opts) {
     HTTP_Handler h = {0};
 
     h.handler = handler;
-    if ((err = http_pattern_init(&h.pattern, pattern)) && err != HTTP_ERR_OK) return err;
-    http_da_append(&s->_handlers, h);
+    if (opts != NULL) h.opts = *opts;
+    return _add_route(s, pattern, &h);
+}
+
+/**
+ * Serializes response with status code `sc`, headers `headers` (may be
+ * NULL), that are followed by `extra` (may be NULL), and body `body` of
+ * length `body_len` into `sr`. `Content-Length` is set automatically, `Date`
+ * gets a placeholder to be updated on send.
+ */
+static HTTP_Err _serialize_response(uint16_t sc, HTTP_Headers *headers, const char *extra,
+                                    const char *body, size_t body_len, HTTP_SerializedResponse *sr) {
+    *sr = (HTTP_SerializedResponse) {0};
 
+    HTTP_StringBuilder sb = {0};
+    http_sb_append_format(&sb, "HTTP/1.1 %u %s\r\n", sc, http_reason_phrase(sc));
+    http_sb_append_format(&sb, "Content-Length: %zu\r\n", body_len);
+    for (size_t i = 0; headers && i < headers->len; i++) {
+        HTTP_Header *hd = &headers->items[i];
+        // These are set by the server
+        if (strcasecmp(hd->k, "Content-Length") == 0 || strcasecmp(hd->k, "Connection") == 0) continue;
+        if (strcasecmp(hd->k, "Date") == 0) {
+            http_sb_append_cstr(&sb, "Date: ");
+            sr->date_off = sb.len;
+            char date[HTTP_DATE_LEN];
+            http_date_format(time(NULL), date);
+            http_da_append_carr(&sb, date, HTTP_DATE_LEN);
+            http_sb_append_cstr(&sb, "\r\n");
+            continue;
+        }
+        http_sb_append_format(&sb, "%s: %s\r\n", hd->k, hd->v);
+    }
+    if (extra) http_sb_append_cstr(&sb, extra);
+    sr->head_len = sb.len;
+    http_sb_append_cstr(&sb, "\r\n");
+    if (body_len > 0) http_da_append_carr(&sb, body, body_len);
+    if (sb.items == NULL) return HTTP_ERR_OOM;
+    sr->data = sb.items;
+    sr->len = sb.len;
     return HTTP_ERR_OK;
 }
 
-// TODO: Maybe should respond with 500 Internal Server Error, instead of
-//       simply closing connection
-HTTP_Err http_server_run(HTTP_Server *s) {
+#define _VARY_ACCEPT_ENCODING "Vary: Accept-Encoding\r\n"
+#define _CONTENT_ENCODING_GZIP "Content-Encoding: gzip\r\n" _VARY_ACCEPT_ENCODING
+
+/**
+ * Serializes response with status code `sc`, headers `headers` and body
+ * `body` of length `body_len` into `identity`, and its variant with body
+ * `gz` of length `gz_len` (gzip-encoded `body`) into `gzip`. If `gz` is
+ * NULL, the body is compressed, if it's worth it, otherwise `gzip` is left
+ * empty.
+ */
+static HTTP_Err _serialize_variants(HTTP_Server *s, uint16_t sc, HTTP_Headers *headers,
+                                    const char *body, size_t body_len, const char *gz, size_t gz_len,
+                                    HTTP_SerializedResponse *identity, HTTP_SerializedResponse *gzip) {
     HTTP_Err err;
+    *gzip = (HTTP_SerializedResponse) {0};
 
-    for (;should_run;)  {
-        int connfd;
-        char peer[HTTP_ADDR_REPR_MAX_LEN];
-        if ((err = http_sock_accept_conn(s->_sockfd, &connfd, peer, HTTP_ADDR_REPR_MAX_LEN)))
-            return err;
-
-        /* parse */
-        HTTP_Parser parser = {0};
-        if ((err = http_parser_init(&parser, HTTP_PK_REQ, connfd)))
-            return err;
-        // TODO: Check for HTTP_ERR_URI_TOO_LONG and respond with 414
-        if ((err = http_parser_start_line(&parser))) {
-            http_parser_free(&parser);
-            close(connfd);
-            return err;
-        }
-        if ((err = http_parser_headers(&parser))) {
-            http_parser_free(&parser);
-            close(connfd);
-            return err;
-        }
-
-        /* create request */
-        HTTP_Request req = {0};
-        http_request_init(&req, connfd);
-        req._parser = &parser;
-        http_request_set_method(&req, parser.method);
-        http_request_set_url(&req, parser.url_str);
-        for (size_t i = 0; i < parser.headers.len; i++)
-            http_request_add_header(&req, parser.headers.items[i].k, parser.headers.items[i].v);
-        http_request_set_content_length(&req, parser.content_length);
-
-        /* create response */
-        HTTP_Response resp = {0};
-        http_response_init(&resp, connfd);
-        http_response_set_status_code(&resp, HTTP_Status_OK);
-
-        /* handle request */
-        HTTP_Handler *h = _match_handler(s, req.pc);
-        // TODO: Respond with 404
-        if (h == NULL) {
-            HTTP_INFO("No matching handler was registered to handle \"%s\"", req.url.path);
-            close(connfd);
-            http_request_free(&req);
-            http_response_free(&resp);
+    char *compressed = NULL;
+    if (gz == NULL && body_len >= s->compress_min_sz) {
+        char *ct = headers ? http_headers_get(headers, "Content-Type") : NULL;
+        bool encoded = headers && http_headers_get(headers, "Content-Encoding");
+        if (ct && http_content_type_compressible(ct) && !encoded &&
+            http_compress(HTTP_Encoding_GZIP, s->compress_level, body, body_len, &compressed, &gz_len) == HTTP_ERR_OK) {
+            // Not worth it, if it saves next to nothing
+            if (gz_len < body_len - body_len/16) gz = compressed;
+        }
+    }
+
+    // Variants get their own ETags, unless there is one already
+    char extra[sizeof(_CONTENT_ENCODING_GZIP "ETag: \r\n") + HTTP_ETAG_MAX_LEN], etag[HTTP_ETAG_MAX_LEN];
+    bool with_etag = sc == HTTP_Status_OK && !(headers && http_headers_get(headers, "ETag"));
+    uint64_t hash = 0;
+    if (with_etag) {
+        HTTP_Hash hs;
+        http_hash_init(&hs);
+        http_hash_update(&hs, body, body_len);
+        hash = http_hash_final(&hs);
+    }
+
+    etag[0] = '\0';
+    if (with_etag) http_etag_format(hash, NULL, etag);
+    snprintf(extra, sizeof(extra), "%s%s%s%s", gz ? _VARY_ACCEPT_ENCODING : "",
+             etag[0] ? "ETag: " : "", etag, etag[0] ? "\r\n" : "");
+    if ((err = _serialize_response(sc, headers, extra, body, body_len, identity))) {
+        free(compressed);
+        return err;
+    }
+    if (with_etag) http_etag_format(hash, "gzip", etag);
+    snprintf(extra, sizeof(extra), "%s%s%s%s", _CONTENT_ENCODING_GZIP,
+             etag[0] ? "ETag: " : "", etag, etag[0] ? "\r\n" : "");
+    if (gz && (err = _serialize_response(sc, headers, extra, gz, gz_len, gzip))) {
+        HTTP_FREE(identity->data);
+        *identity = (HTTP_SerializedResponse) {0};
+    }
+    free(compressed);
+    return err;
+}
+
+HTTP_Err http_server_add_static_response(HTTP_Server *s, const char *pattern, uint16_t sc,
+                                         HTTP_Headers *headers, const char *body, size_t body_len) {
+    HTTP_Err err;
+    HTTP_Handler h = {0};
+
+    if ((err = _serialize_variants(s, sc, headers, body, body_len, NULL, 0, &h.static_resp, &h.static_gz)))
+        return err;
+    if ((err = _add_route(s, pattern, &h))) {
+        HTTP_FREE(h.static_resp.data);
+        if (h.static_gz.data) HTTP_FREE(h.static_gz.data);
+        return err;
+    }
+    return HTTP_ERR_OK;
+}
+
+HTTP_Err http_server_add_file(HTTP_Server *s, const char *pattern, const char *path, const char *content_type) {
+    HTTP_Err err;
+    HTTP_Handler h = {0};
+
+    if ((h.file_path = HTTP_STRDUP(path)) == NULL) return HTTP_ERR_OOM;
+    if ((h.file_type = HTTP_STRDUP(content_type)) == NULL) {
+        HTTP_FREE(h.file_path);
+        return HTTP_ERR_OOM;
+    }
+    if ((err = _add_route(s, pattern, &h))) {
+        HTTP_FREE(h.file_path);
+        HTTP_FREE(h.file_type);
+        return err;
+    }
+    return HTTP_ERR_OK;
+}
+
+HTTP_Err http_server_add_metrics(HTTP_Server *s, const char *pattern) {
+    HTTP_Handler h = { .metrics = true };
+    s->metrics = true;
+    return _add_route(s, pattern, &h);
+}
+
+HTTP_ServerStats http_server_stats(HTTP_Server *s) {
+    HTTP_ServerStats st = {0};
+    st.conns_idle = s->_conns_idle;
+    st.conns_paused = s->_conns_paused;
+    st.idle_conn_sz = sizeof(HTTP_Conn);
+    if (s->_pool.buf_sz > 0) st.pool = http_buffer_pool_stats(&s->_pool);
+    if (s->_cache.nshards > 0) st.cache = http_cache_stats(&s->_cache);
+    st.access_log = http_access_log_stats(&s->_access_log);
+    st.trace = http_access_log_stats(&s->_trace);
+    return st;
+}
+
+//////////////////// BEGIN: Buffer pool ////////////////////
+/**
+ * Acquires receive buffer `b` for a connection of server `s`.
+ *
+ * Returns `HTTP_ERR_BUSY`, if the pool has reached its memory limit.
+ */
+static HTTP_Err _acquire_buffer(HTTP_Server *s, IO_Buffer *b) {
+    // NOTE: Mirrored buffers are mapped per connection and bypass the pool
+    if (s->mirrored_buffers) return io_err_to_http_err(io_buffer_init_mirrored(b, s->recv_buf_sz));
+    return http_buffer_pool_acquire(&s->_pool, b);
+}
+
+/**
+ * Releases receive buffer `b` of server `s`, that was initially backed by
+ * pooled `storage`.
+ */
+static void _release_buffer(HTTP_Server *s, IO_Buffer *b, char *storage) {
+    // The buffer might have outgrown the pooled storage
+    if (b->buf != storage && !b->mirrored) {
+        io_buffer_free(b);
+        *b = (IO_Buffer) {0};
+        http_buffer_pool_put(&s->_pool, storage);
+        return;
+    }
+    http_buffer_pool_release(&s->_pool, b);
+}
+//////////////////// END:   Buffer pool ////////////////////
+
+//////////////////// BEGIN: Connections ////////////////////
+/**
+ * Returns events, that connections of server `s` are polled for.
+ */
+static uint32_t _conn_events(HTTP_Server *s) {
+    // Connection, that is being served by a worker, must not be reported
+    // again, until it's returned to the loop
+    return EPOLLIN | EPOLLRDHUP | (s->workers > 0 ? EPOLLONESHOT : 0);
+}
+
+static void _idle_remove(HTTP_Server *s, HTTP_Conn *c) {
+    if (c->prev) c->prev->next = c->next;
+    else s->_idle_head = c->next;
+    if (c->next) c->next->prev = c->prev;
+    else s->_idle_tail = c->prev;
+    c->prev = c->next = NULL;
+    s->_conns_idle--;
+}
+
+static void _idle_append(HTTP_Server *s, HTTP_Conn *c) {
+    c->idle_since = time(NULL);
+    c->next = NULL;
+    c->prev = s->_idle_tail;
+    if (s->_idle_tail) s->_idle_tail->next = c;
+    else s->_idle_head = c;
+    s->_idle_tail = c;
+    s->_conns_idle++;
+}
+
+static void _conn_close(HTTP_Server *s, HTTP_Conn *c) {
+    if (c->paused) s->_conns_paused--;
+    close(c->fd);
+    HTTP_FREE(c);
+}
+
+/**
+ * Stops polling connection `c` (and the listening socket) of server `s`,
+ * until a receive buffer is released.
+ */
+static void _conn_pause(HTTP_Server *s, HTTP_Conn *c) {
+    // With workers, the buffers might have been released (and the paused
+    // connections resumed) since the connection was refused one, so nothing
+    // would resume it
+    if (http_buffer_pool_available(&s->_pool)) {
+        c->paused = false;
+        plex epoll_event ev = { .events = _conn_events(s), .data.ptr = c };
+        epoll_ctl(s->_epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+        return;
+    }
+    plex epoll_event ev = { .events = 0, .data.ptr = c };
+    epoll_ctl(s->_epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+    if (s->_conns_paused++ == 0) {
+        HTTP_WARN("Receive buffer pool is exhausted, pausing connections");
+        ev.data.ptr = NULL;
+        epoll_ctl(s->_epollfd, EPOLL_CTL_MOD, s->_sockfd, &ev);
+    }
+}
+
+/**
+ * Resumes polling every paused connection of server `s`, as well as the
+ * listening socket.
+ */
+static void _resume_paused_conns(HTTP_Server *s) {
+    for (HTTP_Conn *c = s->_idle_head; c != NULL && s->_conns_paused > 0; c = c->next) {
+        if (!c->paused) continue;
+        plex epoll_event ev = { .events = _conn_events(s), .data.ptr = c };
+        epoll_ctl(s->_epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->paused = false;
+        s->_conns_paused--;
+    }
+    plex epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(s->_epollfd, EPOLL_CTL_MOD, s->_sockfd, &ev);
+}
+
+/**
+ * Closes connections of server `s`, that were idle for too long.
+ */
+static void _close_expired_conns(HTTP_Server *s) {
+    time_t now = time(NULL);
+    while (s->_idle_head && now - s->_idle_head->idle_since >= s->keep_alive_timeout) {
+        HTTP_Conn *c = s->_idle_head;
+        _idle_remove(s, c);
+        _conn_close(s, c);
+    }
+}
+
+/**
+ * Decides whether connection may be kept open after request `req` is served,
+ * according to RFC 2616, section 8.1.
+ */
+static bool _request_wants_keep_alive(HTTP_Request *req) {
+    char *conn = http_headers_get(&req->headers, "Connection");
+    if (req->httpver.maj > 1 || (req->httpver.maj == 1 && req->httpver.min >= 1))
+        return conn == NULL || strcasecmp(conn, "close") != 0;
+    return conn != NULL && strcasecmp(conn, "keep-alive") == 0;
+}
+
+/**
+ * Discards the rest of the request body, that was left unread by the
+ * handler.
+ *
+ * Returns false, if the body is too large to be discarded or failed to read
+ * it.
+ */
+static bool _drain_body(HTTP_Parser *p) {
+    char chunk[4096];
+    size_t drained = 0;
+
+    while (!http_parser_is_finished(p)) {
+        if (http_parser_stream_body(p, chunk, sizeof(chunk)) != HTTP_ERR_OK) return false;
+        drained += http_parser_last_read(p);
+        if (drained > HTTP_SERVER_DRAIN_MAX_SZ) return false;
+    }
+    return true;
+}
+
+/**
+ * Applies options of handler `h` (and limits of server `s`) to request `req`,
+ * before its body is read.
+ *
+ * Returns HTTP_Status_CONTINUE, if the request may be passed to the handler,
+ * or the status code of the final response otherwise.
+ */
+static uint16_t _precheck_request(HTTP_Server *s, HTTP_Handler *h, HTTP_Request *req) {
+    char *expect = http_headers_get(&req->headers, "Expect");
+    if (expect && strcasecmp(expect, "100-continue") != 0) return HTTP_Status_EXPECTATION_FAILED;
+
+    uint64_t max_body_sz = h->opts.max_body_sz > 0 ? h->opts.max_body_sz : s->max_body_sz;
+    if (max_body_sz > 0 && req->content_length > max_body_sz)
+        return HTTP_Status_PAYLOAD_TOO_LARGE;
+    if (h->opts.precheck) {
+        uint16_t sc = h->opts.precheck(req);
+        if (sc != HTTP_Status_CONTINUE) return sc;
+    }
+    return HTTP_Status_CONTINUE;
+}
+
+/**
+ * Counts request to route `route` of server `s`, that was answered with
+ * response `resp`, having received `bytes_in` bytes. The request started at
+ * `t_start`, its head was parsed at `t_parsed` (0 if it failed to parse),
+ * and its handler took `handler_ns` (0 if it wasn't called).
+ */
+static void _metrics_record(HTTP_Server *s, size_t route, HTTP_Response *resp, uint64_t bytes_in,
+                            uint64_t t_start, uint64_t t_parsed, uint64_t handler_ns) {
+    HTTP_RouteMetrics *r = http_metrics_route(&s->_metrics, route);
+    if (r == NULL) return;
+    uint64_t now = http_clock_ns();
+    http_metrics_count(&s->_metrics, r, resp->bytes_sent > 0 ? resp->status : 0, bytes_in, resp->bytes_sent);
+    http_histogram_record(&r->parse, (t_parsed ? t_parsed : now) - t_start);
+    if (handler_ns > 0) http_histogram_record(&r->handler, handler_ns);
+    http_histogram_record(&r->total, now - t_start);
+}
+
+/**
+ * Logs request `req` into `log`, that was answered with response `resp`,
+ * having received `bytes_in` bytes, and started at `t_start`.
+ */
+static void _access_log_record(HTTP_AccessLog *log, HTTP_Request *req, HTTP_Response *resp, uint64_t bytes_in,
+                               uint64_t t_start) {
+    HTTP_AccessRecord *r = http_access_log_reserve(log);
+    if (r == NULL) return;
+    plex timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    r->latency_ns = http_clock_ns() - t_start;
+    r->time_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec - r->latency_ns;
+    r->bytes_in = bytes_in;
+    r->bytes_out = resp->bytes_sent;
+    r->status = resp->bytes_sent > 0 ? resp->status : 0;
+    r->conn = req->connfd;
+    memcpy(r->phases, req->phases, sizeof(r->phases));
+
+    // The peer is looked up only for the requests, that are logged
+    plex sockaddr_storage sa;
+    socklen_t sa_len = sizeof(sa);
+    if (getpeername(req->connfd, (plex sockaddr *)&sa, &sa_len) == 0) {
+        if (sa.ss_family == AF_INET) {
+            plex sockaddr_in *in = (plex sockaddr_in *)&sa;
+            memcpy(r->addr, &in->sin_addr, sizeof(in->sin_addr));
+            r->port = ntohs(in->sin_port);
+            r->family = AF_INET;
+        } else if (sa.ss_family == AF_INET6) {
+            plex sockaddr_in6 *in6 = (plex sockaddr_in6 *)&sa;
+            memcpy(r->addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+            r->port = ntohs(in6->sin6_port);
+            r->family = AF_INET6;
+        }
+    }
+    if (req->url_str != NULL) {
+        strncpy(r->method, http_method_to_cstr(req->method), sizeof(r->method) - 1);
+        strncpy(r->path, req->url_str, sizeof(r->path) - 1);
+        r->path[sizeof(r->path) - 1] = '\0';
+    }
+    http_access_log_commit(log, r);
+}
+
+/**
+ * Returns status code of the response to a request, that failed to parse with
+ * error `err`, or 0, if there is no one to respond to.
+ */
+static uint16_t _parse_err_status(HTTP_Err err) {
+    switch (err) {
+    case HTTP_ERR_FAILED_PARSE:       return HTTP_Status_BAD_REQUEST;
+    case HTTP_ERR_TIMEOUT:            return HTTP_Status_REQUEST_TIMEOUT;
+    case HTTP_ERR_URL_TOO_LONG:       return HTTP_Status_URI_TOO_LONG;
+    case HTTP_ERR_HEADERS_TOO_LARGE:  return HTTP_Status_REQUEST_HEADER_FIELDS_TOO_LARGE;
+    case HTTP_ERR_OOM:                return HTTP_Status_INTERNAL_SERVER_ERROR;
+    case HTTP_ERR_NOT_IMPLEMENTED:    return HTTP_Status_NOT_IMPLEMENTED;
+    default:                          return 0;
+    }
+}
+
+/**
+ * Responds to a request, that failed to parse with error `err`. The rest of
+ * the connection can't be trusted, so it's always closed afterwards.
+ */
+static void _reject_malformed(HTTP_Server *s, HTTP_Parser *p, HTTP_Response *resp, HTTP_Err err) {
+    uint16_t sc = _parse_err_status(err);
+    HTTP_CannedResponse *c = sc != 0 ? _find_canned(s, sc) : NULL;
+    if (c == NULL || _send_canned(p->connfd, c, false)) return;
+    resp->status = sc;
+    resp->bytes_sent += c->len_close;
+}
+
+/**
+ * Returns true, if the body of request `req`, that is not going to be passed
+ * to a handler, may be discarded to keep the connection open.
+ */
+static bool _body_discardable(HTTP_Request *req) {
+    // If the client waits for 100 Continue, it won't send the body at all;
+    // otherwise the body is discarded after responding, if it's small enough
+    return http_headers_get(&req->headers, "Expect") == NULL &&
+           req->content_length <= HTTP_SERVER_DRAIN_MAX_SZ;
+}
+
+/**
+ * Responds to request `req`, that is not going to be passed to a handler,
+ * with empty response `resp` of status `sc`, and discards the request body.
+ *
+ * Returns true, if the connection should be kept open.
+ */
+static bool _reject_request(HTTP_Server *s, HTTP_Parser *p, HTTP_Request *req, HTTP_Response *resp,
+                            uint16_t sc, bool keep_alive) {
+    keep_alive = keep_alive && _body_discardable(req);
+
+    // HTTP/1.0 client needs explicit `Connection: keep-alive`, that canned
+    // responses don't have
+    HTTP_CannedResponse *c = _find_canned(s, sc);
+    if (c != NULL && (!keep_alive || resp->_connection == NULL)) {
+        if (_send_canned(p->connfd, c, keep_alive)) return false;
+        resp->status = sc;
+        resp->bytes_sent += keep_alive ? c->len : c->len_close;
+    } else {
+        if (!keep_alive) resp->_connection = "close";
+        http_response_set_content_length(resp, 0);
+        if (http_response_send(resp, sc)) return false;
+    }
+    return keep_alive && _drain_body(p);
+}
+
+/**
+ * Returns true, if request `req` is conditional, and serialized response
+ * `sr` is 200 with ETag, that the request lists in `If-None-Match`.
+ */
+static bool _serialized_not_modified(HTTP_Request *req, HTTP_SerializedResponse *sr) {
+    if (req->method != HTTP_Method_GET && req->method != HTTP_Method_HEAD) return false;
+    char *inm = http_headers_get(&req->headers, "If-None-Match");
+    if (inm == NULL || sr->head_len < 12 || memcmp(sr->data + 8, " 200 ", 5) != 0) return false;
+
+    // Header lines of the head are scanned only for conditional requests
+    const char *line = memchr(sr->data, '\n', sr->head_len);
+    const char *end = sr->data + sr->head_len;
+    while (line != NULL && ++line < end) {
+        const char *eol = memchr(line, '\r', end - line);
+        if (eol == NULL) break;
+        if (eol - line > 6 && strncasecmp(line, "ETag:", 5) == 0) {
+            const char *v = line + 5;
+            while (v < eol && *v == ' ') v++;
+            return http_etag_match(inm, v, eol - v);
+        }
+        line = memchr(eol, '\n', end - eol);
+    }
+    return false;
+}
+
+/**
+ * Responds to request `req` with serialized response `sr` (static or cached
+ * one), and discards the request body.
+ *
+ * Returns true, if the connection should be kept open.
+ */
+static bool _serve_serialized(HTTP_Parser *p, HTTP_Request *req, HTTP_Response *resp,
+                              HTTP_SerializedResponse *sr, bool keep_alive) {
+    keep_alive = keep_alive && _body_discardable(req);
+    const char *conn = keep_alive ? resp->_connection : "close";
+
+    plex iovec iov[6];
+    int iovcnt = 0;
+    size_t off = 0;
+    // Client, that has the body already, gets the same head as 304
+    bool not_modified = _serialized_not_modified(req, sr);
+    if (not_modified) {
+        static const char line[] = "HTTP/1.1 304 Not Modified\r\n";
+        iov[iovcnt++] = (plex iovec) { (char *)line, sizeof(line) - 1 };
+        off = (char *)memchr(sr->data, '\n', sr->head_len) - sr->data + 1;
+    }
+    if (sr->date_off > 0) {
+        iov[iovcnt++] = (plex iovec) { sr->data + off, sr->date_off - off };
+        iov[iovcnt++] = (plex iovec) { (char *)http_date_now(), HTTP_DATE_LEN };
+        off = sr->date_off + HTTP_DATE_LEN;
+    }
+    iov[iovcnt++] = (plex iovec) { sr->data + off, sr->head_len - off };
+    char conn_line[32];
+    if (conn != NULL) {
+        int n = snprintf(conn_line, sizeof(conn_line), "Connection: %s\r\n", conn);
+        iov[iovcnt++] = (plex iovec) { conn_line, n };
+    }
+    // Response to HEAD has no body, but the same headers (RFC 2616, section 9.4)
+    size_t tail_len = (req->method == HTTP_Method_HEAD || not_modified) ? 2 : sr->len - sr->head_len;
+    iov[iovcnt++] = (plex iovec) { sr->data + sr->head_len, tail_len };
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    if (writev(p->connfd, iov, iovcnt) != (ssize_t)total) return false;
+    resp->status = not_modified ? HTTP_Status_NOT_MODIFIED : strtoul(sr->data + 9, NULL, 10);
+    resp->bytes_sent += total;
+
+    return keep_alive && _drain_body(p);
+}
+
+/**
+ * Returns true, if request `req` may be answered with a gzip-encoded variant
+ * of the response by server `s`.
+ */
+static bool _request_wants_gzip(HTTP_Server *s, HTTP_Request *req) {
+    if (!s->compress) return false;
+    char *accept = http_headers_get(&req->headers, "Accept-Encoding");
+    return accept != NULL && http_encoding_accepted(accept, HTTP_Encoding_GZIP);
+}
+
+/**
+ * Lets response `resp` to request `req` be compressed by server `s` with
+ * compression `c`, if the client accepts it.
+ */
+static void _offer_compression(HTTP_Server *s, HTTP_Request *req, HTTP_Response *resp, HTTP_Compression *c) {
+    // Body of unknown size is sent in chunks, that HTTP/1.0 doesn't support
+    bool http11 = req->httpver.maj == 1 && req->httpver.min >= 1;
+    if (!s->compress || !http11 || req->method == HTTP_Method_HEAD) return;
+    char *accept = http_headers_get(&req->headers, "Accept-Encoding");
+    if (accept == NULL) return;
+
+    *c = (HTTP_Compression) {
+        .pool = &s->_compressors,
+        .encoding = http_encoding_negotiate(accept),
+        .min_sz = s->compress_min_sz,
+    };
+    if (c->encoding != HTTP_Encoding_IDENTITY) resp->_compression = c;
+}
+
+/**
+ * Lets body of request `req` be decoded by server `s` with decompression
+ * `d`, as the handler reads it, if it's sent encoded.
+ */
+static void _offer_decompression(HTTP_Server *s, HTTP_Request *req, HTTP_Decompression *d) {
+#ifdef HTTP_WITH_ZLIB
+    if (!s->decompress || req->content_length == 0) return;
+    char *coding = http_headers_get(&req->headers, "Content-Encoding");
+    if (coding == NULL) return;
+
+    // Unknown and stacked encodings are left for the handler
+    int e = http_encoding_from_cstr(coding);
+    if (e <= HTTP_Encoding_IDENTITY) return;
+    *d = (HTTP_Decompression) {
+        .pool = &s->_decompressors,
+        .encoding = e,
+        .max_sz = s->decompress_max_sz,
+    };
+    req->_decompression = d;
+#else
+    HTTP_UNUSED(s);
+    HTTP_UNUSED(req);
+    HTTP_UNUSED(d);
+#endif // HTTP_WITH_ZLIB
+}
+
+//////////////////// BEGIN: Files ////////////////////
+/**
+ * Builds key of variant `enc` of the file of route `h` with status `st` in
+ * the cache into `key`. The key changes with the file.
+ */
+static void _file_key(HTTP_Handler *h, plex stat *st, HTTP_Encoding enc, HTTP_StringBuilder *key) {
+    http_da_reset(key);
+    http_sb_append_format(key, "FILE %s\n%lld.%09ld %lld %llu\n%s", h->file_path,
+                          (long long)st->st_mtim.tv_sec, (long)st->st_mtim.tv_nsec,
+                          (long long)st->st_size, (unsigned long long)st->st_ino, http_encoding_to_cstr(enc));
+}
+
+/**
+ * Reads file at `path`, that is at most `max_sz` bytes large, into `data`,
+ * that is allocated with malloc(), saving its status into `st`.
+ *
+ * Returns `HTTP_ERR_OOB`, if the file is larger.
+ */
+static HTTP_Err _file_read(const char *path, plex stat *st, size_t max_sz, char **data) {
+    HTTP_Err result = HTTP_ERR_OK;
+    *data = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return HTTP_ERR_FAILED_READ;
+
+    if (fstat(fd, st) != 0 || !S_ISREG(st->st_mode)) http_return_defer(HTTP_ERR_FAILED_READ);
+    if ((size_t)st->st_size > max_sz) http_return_defer(HTTP_ERR_OOB);
+    if ((*data = malloc(st->st_size > 0 ? st->st_size : 1)) == NULL) http_return_defer(HTTP_ERR_OOM);
+
+    size_t off = 0;
+    while (off < (size_t)st->st_size) {
+        ssize_t n = read(fd, *data + off, st->st_size - off);
+        if (n <= 0) break;
+        off += n;
+    }
+    if (off != (size_t)st->st_size) {
+        free(*data);
+        *data = NULL;
+        http_return_defer(HTTP_ERR_FAILED_READ);
+    }
+
+ defer:
+    close(fd);
+    return result;
+}
+
+/**
+ * Reads the file of route `h` into the cache of server `s`, together with its
+ * gzip-encoded variant.
+ *
+ * Returns `HTTP_ERR_OOB`, if the file doesn't fit into the cache.
+ */
+static HTTP_Err _file_load(HTTP_Server *s, HTTP_Handler *h) {
+    HTTP_Err err;
+    // The variants outlive the request, so they don't belong to its arena
+    HTTP_Arena *prev = http_arena_use(NULL);
+
+    size_t max_sz = s->_cache.max_sz / s->_cache.nshards;
+    plex stat st, gz_st;
+    char *body = NULL, *gz = NULL;
+    HTTP_SerializedResponse identity = {0}, gzip = {0};
+    HTTP_StringBuilder key = {0};
+    if ((err = _file_read(h->file_path, &st, max_sz, &body))) goto defer;
+
+    // Sidecar, that is older than the file, is stale
+    char gz_path[PATH_MAX];
+    if (snprintf(gz_path, sizeof(gz_path), "%s.gz", h->file_path) < (int)sizeof(gz_path) &&
+        _file_read(gz_path, &gz_st, max_sz, &gz) == HTTP_ERR_OK &&
+        (gz_st.st_mtim.tv_sec < st.st_mtim.tv_sec ||
+         (gz_st.st_mtim.tv_sec == st.st_mtim.tv_sec && gz_st.st_mtim.tv_nsec < st.st_mtim.tv_nsec))) {
+        free(gz);
+        gz = NULL;
+    }
+
+    char last_modified[HTTP_DATE_LEN + 1] = {0};
+    http_date_format(st.st_mtime, last_modified);
+    HTTP_Header hs[] = {
+        { .k = "Content-Type", .v = h->file_type },
+        { .k = "Last-Modified", .v = last_modified },
+        { .k = "Date", .v = "" },
+    };
+    HTTP_Headers headers = { .len = s->date_header ? 3 : 2, .items = hs };
+    if ((err = _serialize_variants(s, HTTP_Status_OK, &headers, body, st.st_size, gz, gz ? gz_st.st_size : 0,
+                                   &identity, &gzip)))
+        goto defer;
+
+    if (gzip.data) {
+        _file_key(h, &st, HTTP_Encoding_GZIP, &key);
+        http_cache_put(&s->_cache, key.items, key.len, &gzip, HTTP_SERVER_FILE_CACHE_TTL);
+    }
+    _file_key(h, &st, HTTP_Encoding_IDENTITY, &key);
+    err = http_cache_put(&s->_cache, key.items, key.len, &identity, HTTP_SERVER_FILE_CACHE_TTL);
+
+ defer:
+    free(body);
+    free(gz);
+    if (identity.data) HTTP_FREE(identity.data);
+    if (gzip.data) HTTP_FREE(gzip.data);
+    http_sb_free(&key);
+    http_arena_use(prev);
+    return err;
+}
+
+/**
+ * Responds to request `req` with the file of route `h`, reading it from the
+ * disk, when it doesn't fit into the cache of server `s`.
+ *
+ * Returns true, if the connection should be kept open.
+ */
+static bool _file_stream(HTTP_Server *s, HTTP_Parser *p, HTTP_Request *req, HTTP_Response *resp,
+                         HTTP_Handler *h, bool keep_alive) {
+    int fd = open(h->file_path, O_RDONLY | O_CLOEXEC);
+    plex stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd != -1) close(fd);
+        return _reject_request(s, p, req, resp, HTTP_Status_NOT_FOUND, keep_alive);
+    }
+
+    char last_modified[HTTP_DATE_LEN + 1] = {0};
+    http_date_format(st.st_mtime, last_modified);
+    HTTP_Compression compression;
+    _offer_compression(s, req, resp, &compression);
+    http_response_add_header_borrowed(resp, "Content-Type", h->file_type);
+    http_response_add_header_borrowed(resp, "Last-Modified", last_modified);
+    http_response_set_content_length(resp, st.st_size);
+    bool ok = http_response_send(resp, HTTP_Status_OK) == HTTP_ERR_OK;
+
+    char buf[64*1<<10];
+    uint64_t left = (req->method == HTTP_Method_HEAD) ? 0 : (uint64_t)st.st_size;
+    while (ok && left > 0) {
+        ssize_t n = read(fd, buf, left < sizeof(buf) ? left : sizeof(buf));
+        ok = n > 0 && http_response_write_body_chunk(resp, buf, n) == HTTP_ERR_OK;
+        if (ok) left -= n;
+    }
+    close(fd);
+    if (ok) ok = http_response_finish(resp) == HTTP_ERR_OK;
+    // Compression doesn't outlive this call
+    if (resp->_compressor) http_compressor_release(compression.pool, resp->_compressor);
+    resp->_compressor = NULL;
+    resp->_compression = NULL;
+
+    // Connection is out of sync, if the body is incomplete
+    return ok && keep_alive && _drain_body(p);
+}
+
+/**
+ * Responds to request `req` with the file of route `h`, in the encoding the
+ * client accepts, taking it from the cache of server `s`.
+ *
+ * Returns true, if the connection should be kept open.
+ */
+static bool _serve_file(HTTP_Server *s, HTTP_Parser *p, HTTP_Request *req, HTTP_Response *resp,
+                        HTTP_Handler *h, bool keep_alive) {
+    if (req->method != HTTP_Method_GET && req->method != HTTP_Method_HEAD)
+        return _reject_request(s, p, req, resp, HTTP_Status_METHOD_NOT_ALLOWED, keep_alive);
+    if (s->_cache.nshards == 0) return _file_stream(s, p, req, resp, h, keep_alive);
+
+    plex stat st;
+    if (stat(h->file_path, &st) != 0 || !S_ISREG(st.st_mode))
+        return _reject_request(s, p, req, resp, HTTP_Status_NOT_FOUND, keep_alive);
+
+    // If the file has no gzip-encoded variant, only the identity one is there
+    HTTP_StringBuilder key = {0};
+    HTTP_CacheEntry *e = NULL;
+    for (int attempt = 0; attempt < 2 && e == NULL; attempt++) {
+        if (attempt > 0 && _file_load(s, h) != HTTP_ERR_OK) break;
+        if (_request_wants_gzip(s, req)) {
+            _file_key(h, &st, HTTP_Encoding_GZIP, &key);
+            e = http_cache_get(&s->_cache, key.items, key.len);
+        }
+        if (e == NULL) {
+            _file_key(h, &st, HTTP_Encoding_IDENTITY, &key);
+            e = http_cache_get(&s->_cache, key.items, key.len);
+        }
+    }
+    http_sb_free(&key);
+    if (e == NULL) return _file_stream(s, p, req, resp, h, keep_alive);
+
+    keep_alive = _serve_serialized(p, req, resp, &e->resp, keep_alive);
+    http_cache_release(&s->_cache, e);
+    return keep_alive;
+}
+//////////////////// END:   Files ////////////////////
+
+/**
+ * Responds to request `req` with metrics of server `s` in Prometheus text
+ * format.
+ *
+ * Returns true, if the connection should be kept open.
+ */
+static bool _serve_metrics(HTTP_Server *s, HTTP_Parser *p, HTTP_Request *req, HTTP_Response *resp, bool keep_alive) {
+    if (req->method != HTTP_Method_GET && req->method != HTTP_Method_HEAD)
+        return _reject_request(s, p, req, resp, HTTP_Status_METHOD_NOT_ALLOWED, keep_alive);
+
+    HTTP_StringBuilder sb = {0};
+    if (http_metrics_export(&s->_metrics, s->_route_names, &sb))
+        return _reject_request(s, p, req, resp, HTTP_Status_INTERNAL_SERVER_ERROR, keep_alive);
+    http_response_add_header_borrowed(resp, "Content-Type", "text/plain; version=0.0.4");
+    http_response_add_header_borrowed(resp, "Cache-Control", "no-store");
+    http_response_set_content_length(resp, sb.len);
+    bool ok = http_response_send(resp, HTTP_Status_OK) == HTTP_ERR_OK;
+    if (ok && req->method != HTTP_Method_HEAD && sb.len > 0)
+        ok = http_response_write_body_chunk(resp, sb.items, sb.len) == HTTP_ERR_OK;
+    http_sb_free(&sb);
+    return ok && keep_alive && _drain_body(p);
+}
+
+/**
+ * Appends URL component `s` to string builder `sb`, decoding percent-encoded
+ * unreserved characters and upper-casing the rest of the escapes (RFC 3986,
+ * section 6.2.2.2).
+ */
+static void _append_normalized_escapes(HTTP_StringBuilder *sb, const char *s) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (; *s; s++) {
+        if (*s != '%' || !isxdigit(s[1]) || !isxdigit(s[2])) {
+            http_sb_append_char(sb, *s);
             continue;
         }
-        h->handler(&resp, &req);
+        char hi = toupper(s[1]), lo = toupper(s[2]);
+        char c = ((isdigit(hi) ? hi - '0' : hi - 'A' + 10) << 4) | (isdigit(lo) ? lo - '0' : lo - 'A' + 10);
+        if (isalnum((unsigned char)c) || c == '-' || c == '.' || c == '_' || c == '~') {
+            http_sb_append_char(sb, c);
+        } else {
+            http_sb_append_char(sb, '%');
+            http_sb_append_char(sb, hex[(unsigned char)c >> 4]);
+            http_sb_append_char(sb, hex[c & 0xF]);
+        }
+        s += 2;
+    }
+}
+
+/**
+ * Removes "." and ".." segments from absolute path, that string builder `sb`
+ * holds from offset `start` on (RFC 3986, section 5.2.4).
+ */
+static void _remove_dot_segments(HTTP_StringBuilder *sb, size_t start) {
+    char *base = sb->items + start, *end = sb->items + sb->len;
+    if (base == end || *base != '/') return;
+
+    char *out = base;
+    for (char *in = base; in < end;) {
+        char *next = memchr(in + 1, '/', end - in - 1);
+        if (next == NULL) next = end;
+        size_t seg_len = next - in - 1;
+
+        if (seg_len == 1 && in[1] == '.') {
+            if (next == end) *out++ = '/';
+        } else if (seg_len == 2 && in[1] == '.' && in[2] == '.') {
+            while (out > base && *--out != '/');
+            if (next == end) *out++ = '/';
+        } else {
+            memmove(out, in, next - in);
+            out += next - in;
+        }
+        in = next;
+    }
+    sb->len = out - sb->items;
+}
+
+/**
+ * Builds key of the response to request `req` to route `h` in the cache into
+ * `key`.
+ *
+ * Path and query are normalized, so that equivalent URLs share the response.
+ */
+static void _cache_key(HTTP_Request *req, HTTP_Handler *h, HTTP_StringBuilder *key) {
+    // HEAD is answered with the head of the cached response to GET
+    http_sb_append_cstr(key, "GET ");
+    if (req->url.path) {
+        size_t start = key->len;
+        _append_normalized_escapes(key, req->url.path);
+        _remove_dot_segments(key, start);
+    }
+    if (req->url.query) {
+        http_sb_append_char(key, '?');
+        _append_normalized_escapes(key, req->url.query);
+    }
+    for (const char *const *name = h->opts.cache_vary; name && *name; name++) {
+        char *v = http_headers_get(&req->headers, *name);
+        http_sb_append_char(key, '\n');
+        if (v) http_sb_append_cstr(key, v);
+    }
+}
+
+/**
+ * Decides whether response `resp`, that was captured while it was sent, may
+ * be served to other clients.
+ */
+static bool _response_shareable(HTTP_Response *resp) {
+    HTTP_ResponseCapture *c = resp->_capture;
+    // Body might have been written bypassing http_response_write_body_chunk()
+    if (c->failed || c->sb.len - c->head_len - (sizeof("\r\n") - 1) != resp->content_length) return false;
+
+    char *cc = http_headers_get(&resp->headers, "Cache-Control");
+    if (cc && (http_cache_control_has(cc, "no-store") || http_cache_control_has(cc, "private"))) return false;
+    // Such responses are specific to the client or to the connection
+    if (http_headers_get(&resp->headers, "Set-Cookie")) return false;
+    if (http_headers_get(&resp->headers, "Connection")) return false;
+    return true;
+}
+
+// Variants are told apart by a byte, that can't be in a request line or header
+#define _CACHE_KEY_GZIP "\0gzip"
+
+/**
+ * Looks up the response to request `req` in the cache of server `s` by key
+ * `key`, preferring its gzip-encoded variant, if the client accepts it.
+ */
+static HTTP_CacheEntry *_cache_get(HTTP_Server *s, HTTP_Request *req, HTTP_StringBuilder *key) {
+    HTTP_CacheEntry *e = NULL;
+    if (_request_wants_gzip(s, req)) {
+        size_t len = key->len;
+        http_da_append_carr(key, _CACHE_KEY_GZIP, sizeof(_CACHE_KEY_GZIP) - 1);
+        e = http_cache_get(&s->_cache, key->items, key->len);
+        key->len = len;
+    }
+    if (e == NULL) e = http_cache_get(&s->_cache, key->items, key->len);
+    return e;
+}
+
+/**
+ * Serializes variant of response `resp`, that was captured while it was sent,
+ * with body `body` of length `body_len` into `sb` and `sr`. The head gets
+ * `extra` headers after `Content-Length`, and its `ETag` is replaced with
+ * `etag`, if the server has made one.
+ */
+static void _cache_variant(HTTP_Response *resp, const char *extra, const char *body, size_t body_len,
+                           const char *etag, HTTP_StringBuilder *sb, HTTP_SerializedResponse *sr) {
+    HTTP_ResponseCapture *c = resp->_capture;
+    // Captured head always starts with the status line and Content-Length
+    const char *head = c->sb.items, *head_end = head + c->head_len;
+    const char *line_end = memchr(head, '\n', c->head_len) + 1;
+    const char *rest = memchr(line_end, '\n', head_end - line_end) + 1;
+
+    http_da_append_carr(sb, head, line_end - head);
+    http_sb_append_format(sb, "Content-Length: %zu\r\n", body_len);
+    http_sb_append_cstr(sb, extra);
+    *sr = (HTTP_SerializedResponse) {0};
+    if (c->date_off > 0) sr->date_off = c->date_off - (rest - head) + sb->len;
+    for (const char *l = rest; l < head_end;) {
+        const char *next = memchr(l, '\n', head_end - l) + 1;
+        if (etag && resp->_etag_value[0] && strncmp(l, "ETag: ", 6) == 0) {
+            http_sb_append_format(sb, "ETag: %s\r\n", etag);
+        } else {
+            http_da_append_carr(sb, l, next - l);
+        }
+        l = next;
+    }
+    sr->head_len = sb->len;
+    http_sb_append_cstr(sb, "\r\n");
+    http_da_append_carr(sb, body, body_len);
+    sr->data = sb->items;
+    sr->len = sb->len;
+}
+
+/**
+ * Stores response `resp`, that was captured while it was sent, in the cache
+ * of server `s` by key `key`, if the response allows it, together with its
+ * gzip-encoded variant, if the server compresses responses.
+ */
+static void _cache_store(HTTP_Server *s, HTTP_Handler *h, HTTP_Response *resp, HTTP_StringBuilder *key) {
+    if (!http_cache_status_cacheable(resp->status) || !_response_shareable(resp)) return;
+
+    HTTP_ResponseCapture *c = resp->_capture;
+    HTTP_SerializedResponse sr = {
+        .data = c->sb.items, .len = c->sb.len, .head_len = c->head_len, .date_off = c->date_off,
+    };
+    const char *body = c->sb.items + c->head_len + (sizeof("\r\n") - 1);
+    size_t body_len = resp->content_length;
+    char *ct = http_headers_get(&resp->headers, "Content-Type");
+    char *gz = NULL;
+    size_t gz_len = 0;
+    if (s->compress && body_len > 0 && body_len >= s->compress_min_sz && ct && http_content_type_compressible(ct) &&
+        !http_headers_get(&resp->headers, "Content-Encoding") &&
+        http_compress(HTTP_Encoding_GZIP, s->compress_level, body, body_len, &gz, &gz_len) == HTTP_ERR_OK &&
+        // Not worth it, if it saves next to nothing
+        gz_len >= body_len - body_len/16) {
+        free(gz);
+        gz = NULL;
+    }
+    if (gz == NULL) {
+        http_cache_put(&s->_cache, key->items, key->len, &sr, h->opts.cache_ttl);
+        return;
+    }
+
+    // Both variants tell shared caches, that the response varies
+    HTTP_StringBuilder sb = {0};
+    char etag[HTTP_ETAG_MAX_LEN];
+    HTTP_Hash hs;
+    http_hash_init(&hs);
+    http_hash_update(&hs, body, body_len);
+    http_etag_format(http_hash_final(&hs), "gzip", etag);
+    _cache_variant(resp, _CONTENT_ENCODING_GZIP, gz, gz_len, etag, &sb, &sr);
+    size_t len = key->len;
+    http_da_append_carr(key, _CACHE_KEY_GZIP, sizeof(_CACHE_KEY_GZIP) - 1);
+    http_cache_put(&s->_cache, key->items, key->len, &sr, h->opts.cache_ttl);
+    key->len = len;
+    free(gz);
+
+    http_da_reset(&sb);
+    _cache_variant(resp, _VARY_ACCEPT_ENCODING, body, body_len, NULL, &sb, &sr);
+    http_cache_put(&s->_cache, key->items, key->len, &sr, h->opts.cache_ttl);
+    http_sb_free(&sb);
+}
+
+//////////////////// BEGIN: Coalescing ////////////////////
+// NOTE: Flights are shared by the workers, so they're allocated with malloc()
+//       rather than from the arena of the calling thread.
+
+/**
+ * Joins the flight of server `s` by key `key`, or starts a new one, if there
+ * is none. `leader` is set, if the caller has started the flight and must
+ * finish it with _flight_finish().
+ *
+ * Returns NULL, if failed to allocate a new flight, or if the flight has
+ * parked half of the workers already, so the rest are left for other routes.
+ */
+static HTTP_Flight *_flight_join(HTTP_Server *s, HTTP_StringBuilder *key, bool *leader) {
+    size_t max_waiting = s->workers > 1 ? s->workers / 2 : 1;
+    pthread_mutex_lock(&s->_flights_lock);
+    HTTP_Flight *f = s->_flights;
+    while (f && (f->key_len != key->len || memcmp(f->key, key->items, key->len) != 0)) f = f->next;
+    if (f != NULL && f->refs - 1 >= max_waiting) {
+        f = NULL;
+    } else if (f != NULL) {
+        f->refs++;
+        *leader = false;
+    } else if ((f = malloc(sizeof(HTTP_Flight) + key->len)) != NULL) {
+        memset(f, 0, sizeof(*f));
+        f->key = (char *)(f + 1);
+        memcpy(f->key, key->items, key->len);
+        f->key_len = key->len;
+        f->refs = 1;
+        f->next = s->_flights;
+        s->_flights = f;
+        *leader = true;
+    }
+    pthread_mutex_unlock(&s->_flights_lock);
+    return f;
+}
+
+/**
+ * Drops a reference to flight `f` of server `s`. Must be called with the
+ * flights locked.
+ */
+static void _flight_unref(HTTP_Flight *f) {
+    if (--f->refs > 0) return;
+    free(f->resp.data);
+    free(f);
+}
+
+/**
+ * Parks the calling thread, until the leader of flight `f` of server `s` has
+ * responded, but no longer than `request_timeout` of the server.
+ *
+ * Returns true, if the response of the leader may be shared.
+ */
+static bool _flight_wait(HTTP_Server *s, HTTP_Flight *f) {
+    plex timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += s->request_timeout;
+
+    pthread_mutex_lock(&s->_flights_lock);
+    int rc = 0;
+    while (!f->done && rc != ETIMEDOUT) {
+        if (s->request_timeout > 0) rc = pthread_cond_timedwait(&s->_flights_cond, &s->_flights_lock, &deadline);
+        else pthread_cond_wait(&s->_flights_cond, &s->_flights_lock);
+    }
+    // Response is written by the leader until the flight is done
+    bool shared = f->done && f->resp.data != NULL;
+    pthread_mutex_unlock(&s->_flights_lock);
+    return shared;
+}
+
+/**
+ * Leaves flight `f` of server `s`, once its response is no longer needed.
+ */
+static void _flight_leave(HTTP_Server *s, HTTP_Flight *f) {
+    pthread_mutex_lock(&s->_flights_lock);
+    _flight_unref(f);
+    pthread_mutex_unlock(&s->_flights_lock);
+}
+
+/**
+ * Finishes flight `f` of server `s`, sharing a copy of response `resp` (may
+ * be NULL) with the waiting requests, and wakes them up.
+ */
+static void _flight_finish(HTTP_Server *s, HTTP_Flight *f, const HTTP_SerializedResponse *resp) {
+    HTTP_SerializedResponse sr = {0};
+    if (resp && (sr.data = malloc(resp->len)) != NULL) {
+        memcpy(sr.data, resp->data, resp->len);
+        sr.len = resp->len;
+        sr.head_len = resp->head_len;
+        sr.date_off = resp->date_off;
+    }
+
+    pthread_mutex_lock(&s->_flights_lock);
+    // New requests must start a new flight from now on
+    for (HTTP_Flight **pf = &s->_flights; *pf; pf = &(*pf)->next) {
+        if (*pf != f) continue;
+        *pf = f->next;
+        break;
+    }
+    f->resp = sr;
+    f->done = true;
+    pthread_cond_broadcast(&s->_flights_cond);
+    _flight_unref(f);
+    pthread_mutex_unlock(&s->_flights_lock);
+}
+//////////////////// END:   Coalescing ////////////////////
+
+/**
+ * Records the time request `req` to server `s` has reached phase `ph`, if
+ * the phases are recorded.
+ */
+static inline void _record_phase(HTTP_Server *s, HTTP_Request *req, HTTP_Phase ph) {
+    if (s->phases) req->phases[ph] = http_clock_ns();
+}
+
+/**
+ * Parses a single request, using parser `p`, and passes it to the matching
+ * handler of server `s`.
+ *
+ * Returns true, if the connection should be kept open.
+ */
+static bool _serve_request(HTTP_Server *s, HTTP_Arena *arena, HTTP_Parser *p, uint64_t accepted) {
+    HTTP_Err err;
+    bool keep_alive = false;
+
+    // Everything allocated while serving the request is released at once,
+    // when the arena is reset
+    HTTP_Arena *prev = NULL;
+    if (s->use_arena) prev = http_arena_use(arena);
+    HTTP_StringBuilder cache_key = {0};
+    HTTP_ResponseCapture capture = {0};
+    HTTP_Flight *flight = NULL;
+    // Requests, that matched no route, are counted apart
+    size_t route = s->_handlers.len;
+    bool timed = s->metrics || s->access_log || s->phases || s->request_timeout > 0;
+    uint64_t t_start = timed ? http_clock_ns() : 0, t_parsed = 0, handler_ns = 0;
+    p->head_deadline = (s->request_timeout > 0) ? t_start + s->request_timeout * 1000000000ULL : 0;
+    size_t pos_start = p->_reader.pos;
+
+    HTTP_Request req = {0};
+    http_request_init(&req, p->connfd);
+    HTTP_Response resp = {0};
+    http_response_init(&resp, p->connfd);
+    http_response_set_status_code(&resp, HTTP_Status_OK);
+    resp._date = s->date_header;
+    resp._common_head = s->_common_head.items;
+    resp._common_head_len = s->_common_head.len;
+    if (s->phases) {
+        // The connection is served, once it has become readable, but bytes of
+        // pipelined requests might have arrived long before they're read
+        req.phases[HTTP_Phase_ACCEPT] = accepted;
+        req.phases[HTTP_Phase_READ_START] = t_start;
+        resp._phases = req.phases;
+    }
+
+    /* parse */
+    if ((err = http_parser_start_line(p))) {
+        // Client closing an idle connection is not an error
+        if (err == HTTP_ERR_EOF && http_parser_total_read(p) == 0) goto defer;
+        HTTP_WARN("Failed to parse request line: %s", http_err_to_cstr(err));
+        _reject_malformed(s, p, &resp, err);
+        goto defer;
+    }
+    _record_phase(s, &req, HTTP_Phase_REQUEST_LINE);
+    if ((err = http_parser_headers(p))) {
+        HTTP_WARN("Failed to parse headers: %s", http_err_to_cstr(err));
+        _reject_malformed(s, p, &resp, err);
+        goto defer;
+    }
+    _record_phase(s, &req, HTTP_Phase_HEADERS);
+    p->head_deadline = 0;
+
+    /* create request */
+    if ((err = http_request_from_parser(&req, p))) {
+        HTTP_WARN("Failed to create request: %s", http_err_to_cstr(err));
+        _reject_malformed(s, p, &resp, err);
+        goto defer;
+    }
+    if (s->metrics) t_parsed = http_clock_ns();
+
+    keep_alive = s->keep_alive && _request_wants_keep_alive(&req);
+    resp._connection = keep_alive ? (req.httpver.min == 0 ? "keep-alive" : NULL) : "close";
+
+    /* handle request */
+    if (req.method == HTTP_Method_UNKNOWN) {
+        keep_alive = _reject_request(s, p, &req, &resp, HTTP_Status_METHOD_NOT_ALLOWED, keep_alive);
+        goto defer;
+    }
+    HTTP_Handler *h = _match_handler(s, req.pc);
+    if (h == NULL) {
+        HTTP_INFO("No matching handler was registered to handle \"%s\"", req.url.path);
+        keep_alive = _reject_request(s, p, &req, &resp, HTTP_Status_NOT_FOUND, keep_alive);
+        goto defer;
+    }
+    route = h - s->_handlers.items;
+    if (h->metrics) {
+        keep_alive = _serve_metrics(s, p, &req, &resp, keep_alive);
+        goto defer;
+    }
+    if (h->static_resp.data != NULL) {
+        bool gzip = h->static_gz.data != NULL && _request_wants_gzip(s, &req);
+        keep_alive = _serve_serialized(p, &req, &resp, gzip ? &h->static_gz : &h->static_resp, keep_alive);
+        goto defer;
+    }
+    if (h->file_path != NULL) {
+        keep_alive = _serve_file(s, p, &req, &resp, h, keep_alive);
+        goto defer;
+    }
+
+    /* check the request before its body is read */
+    char *expect = http_headers_get(&req.headers, "Expect");
+    uint16_t sc = _precheck_request(s, h, &req);
+    if (sc != HTTP_Status_CONTINUE) {
+        keep_alive = _reject_request(s, p, &req, &resp, sc, keep_alive);
+        goto defer;
+    }
+    /* serve from the cache */
+    bool is_get = req.method == HTTP_Method_GET, cacheable = false;
+    if (h->opts.cache_ttl > 0 && s->_cache.nshards > 0 && (is_get || req.method == HTTP_Method_HEAD)) {
+        char *cc = http_headers_get(&req.headers, "Cache-Control");
+        bool no_store = cc && http_cache_control_has(cc, "no-store");
+        bool no_cache = cc && (no_store || http_cache_control_has(cc, "no-cache"));
+
+        _cache_key(&req, h, &cache_key);
+        HTTP_CacheEntry *e = no_cache ? NULL : _cache_get(s, &req, &cache_key);
+        if (e) {
+            keep_alive = _serve_serialized(p, &req, &resp, &e->resp, keep_alive);
+            http_cache_release(&s->_cache, e);
+            goto defer;
+        }
+        // Capture the response, so it could be cached
+        if ((cacheable = is_get && !no_store)) {
+            capture.max_sz = s->_cache.max_sz / s->_cache.nshards;
+            resp._capture = &capture;
+        }
+    }
+    /* wait for the identical request, that is in progress */
+    if (h->opts.coalesce && s->workers > 0 && is_get) {
+        if (cache_key.len == 0) _cache_key(&req, h, &cache_key);
+        bool leader = false;
+        flight = _flight_join(s, &cache_key, &leader);
+        if (flight && !leader) {
+            bool shared = _flight_wait(s, flight);
+            if (shared) keep_alive = _serve_serialized(p, &req, &resp, &flight->resp, keep_alive);
+            _flight_leave(s, flight);
+            flight = NULL;
+            if (shared) goto defer;
+            // The response can't be shared, or the leader takes too long, so
+            // the handler is called anyway
+        } else if (flight && cacheable) {
+            // The previous leader might have stored its response just after
+            // the cache was checked
+            HTTP_CacheEntry *e = _cache_get(s, &req, &cache_key);
+            if (e) {
+                keep_alive = _serve_serialized(p, &req, &resp, &e->resp, keep_alive);
+                _flight_finish(s, flight, &e->resp);
+                flight = NULL;
+                http_cache_release(&s->_cache, e);
+                goto defer;
+            }
+        } else if (flight && resp._capture == NULL) {
+            capture.max_sz = HTTP_SERVER_COALESCE_MAX_SZ;
+            resp._capture = &capture;
+        }
+    }
+    // Captured responses are served to any client, so they are not compressed
+    // (the cache makes their gzip-encoded variants on its own)
+    HTTP_Compression compression;
+    if (resp._capture == NULL) _offer_compression(s, &req, &resp, &compression);
+    HTTP_Decompression decompression;
+    _offer_decompression(s, &req, &decompression);
+    if (h->opts.etag && is_get) {
+        resp._etag = true;
+        resp._if_none_match = http_headers_get(&req.headers, "If-None-Match");
+    }
+    bool http11 = req.httpver.maj == 1 && req.httpver.min >= 1;
+
+    // Client, that has already started sending the body, doesn't need 100
+    // Continue (RFC 2616, section 8.2.3)
+    bool wants_continue = expect && http11;
+    if (wants_continue && req.content_length > 0 && io_reader_buffered(&p->_reader) == 0 &&
+        (err = http_response_send_continue(&resp))) {
+        HTTP_WARN("Failed to send 100 Continue: %s", http_err_to_cstr(err));
+        keep_alive = false;
+        goto defer;
+    }
+
+    uint64_t t_handler = s->metrics ? http_clock_ns() : 0;
+    _record_phase(s, &req, HTTP_Phase_HANDLER);
+    h->handler(&resp, &req);
+
+    if (!resp._was_sent) {
+        HTTP_WARN("Handler of \"%s\" did not respond", req.url.path);
+        keep_alive = _reject_request(s, p, &req, &resp, HTTP_Status_INTERNAL_SERVER_ERROR, keep_alive);
+        goto defer;
+    }
+    if ((err = http_response_finish(&resp))) {
+        HTTP_WARN("Failed to finish response: %s", http_err_to_cstr(err));
+        keep_alive = false;
+    }
+    if (s->metrics) handler_ns = http_clock_ns() - t_handler;
+    // Stored before the flight is finished, so the next identical request
+    // finds it in the cache instead of starting a new flight
+    if (cacheable) _cache_store(s, h, &resp, &cache_key);
+    if (flight) {
+        HTTP_SerializedResponse sr = {
+            .data = capture.sb.items, .len = capture.sb.len, .head_len = capture.head_len, .date_off = capture.date_off,
+        };
+        _flight_finish(s, flight, _response_shareable(&resp) ? &sr : NULL);
+        flight = NULL;
+    }
+    char *conn = http_headers_get(&resp.headers, "Connection");
+    if (conn && strcasecmp(conn, "close") == 0) keep_alive = false;
+    if (keep_alive) keep_alive = _drain_body(p);
+
+ defer:
+    // Requests, that wait for this one, must not wait forever
+    if (flight) _flight_finish(s, flight, NULL);
+    http_sb_free(&cache_key);
+    http_sb_free(&capture.sb);
+    if (s->phases) {
+        uint64_t *ph = req.phases, now = http_clock_ns();
+        // Prebuilt responses are written by the server with a single syscall
+        if (resp.bytes_sent > 0 && ph[HTTP_Phase_LAST_BYTE] == 0) ph[HTTP_Phase_LAST_BYTE] = now;
+        if (resp.bytes_sent > 0 && ph[HTTP_Phase_HEADERS_SENT] == 0) ph[HTTP_Phase_HEADERS_SENT] = ph[HTTP_Phase_LAST_BYTE];
+        if (!keep_alive) ph[HTTP_Phase_CLOSE] = now;
+    }
+    // Client closing an idle connection is not a request
+    if (p->_reader.pos != pos_start || resp.bytes_sent > 0) {
+        if (s->metrics) _metrics_record(s, route, &resp, p->_reader.pos - pos_start, t_start, t_parsed, handler_ns);
+        if (s->access_log) _access_log_record(&s->_access_log, &req, &resp, p->_reader.pos - pos_start, t_start);
+        if (s->_trace._started) _access_log_record(&s->_trace, &req, &resp, p->_reader.pos - pos_start, t_start);
+    }
+    http_request_free(&req);
+    http_response_free(&resp);
+    http_parser_reset(p);
+
+    if (s->use_arena) {
+        http_arena_use(prev);
+        http_arena_reset(arena);
+    }
+    return keep_alive;
+}
+
+/**
+ * Serves requests from connection `c`, while they are available without
+ * waiting.
+ *
+ * Returns true, if the connection should be kept open.
+ */
+static bool _serve_conn(HTTP_Server *s, HTTP_Arena *arena, HTTP_Conn *c) {
+    HTTP_Err err;
+    bool keep_alive = false;
+
+    IO_Buffer b = {0};
+    if ((err = _acquire_buffer(s, &b))) {
+        // Let the connection wait, until some buffer is released
+        if (err == HTTP_ERR_BUSY) {
+            c->paused = true;
+            return true;
+        }
+        HTTP_ERROR("Failed to acquire receive buffer: %s", http_err_to_cstr(err));
+        return false;
+    }
+    char *storage = b.buf;
+
+    HTTP_Parser parser = {0};
+    if ((err = http_parser_init_with_buffer(&parser, HTTP_PK_REQ, c->fd, &b)) ||
+        (err = http_parser_set_buf_sz(&parser, s->recv_buf_sz, s->recv_buf_max_sz))) {
+        HTTP_ERROR("Failed to initialize parser: %s", http_err_to_cstr(err));
+        goto defer;
+    }
+    parser.limits = s->limits;
+
+    // Pipelined requests are served right away
+    do {
+        keep_alive = _serve_request(s, arena, &parser, c->nrequests == 0 ? c->accepted : 0);
+        c->nrequests++;
+    } while (keep_alive && should_run && io_reader_buffered(&parser._reader) > 0);
+
+ defer:
+    http_parser_take_buffer(&parser, &b);
+    _release_buffer(s, &b, storage);
+    http_parser_free(&parser);
+    return keep_alive;
+}
+
+static HTTP_Err _accept_conn(HTTP_Server *s) {
+    HTTP_Err err;
+    int connfd;
+    if ((err = http_sock_accept_conn(s->_sockfd, &connfd, NULL, 0))) return err;
+
+    // Connection is served with blocking reads, so a client, that stalls in
+    // the middle of a request, must not hold the whole server (the parser
+    // bounds the head as a whole, see _serve_request())
+    if (s->request_timeout > 0) http_sock_set_recv_timeout(connfd, s->request_timeout * 1000);
 
-        /* free resources */
+    HTTP_Conn *c = HTTP_REALLOC(NULL, sizeof(HTTP_Conn));
+    if (c == NULL) {
+        _send_canned(connfd, _find_canned(s, HTTP_Status_SERVICE_UNAVAILABLE), false);
         close(connfd);
-        http_parser_free(&parser);
-        http_request_free(&req);
-        http_response_free(&resp);
+        return HTTP_ERR_OOM;
+    }
+    memset(c, 0, sizeof(*c));
+    c->fd = connfd;
+    if (s->phases) c->accepted = http_clock_ns();
+
+    plex epoll_event ev = { .events = _conn_events(s), .data.ptr = c };
+    if (epoll_ctl(s->_epollfd, EPOLL_CTL_ADD, connfd, &ev) == -1) {
+        _send_canned(connfd, _find_canned(s, HTTP_Status_SERVICE_UNAVAILABLE), false);
+        _conn_close(s, c);
+        return HTTP_ERR_BAD_SOCK;
+    }
+    _idle_append(s, c);
+    return HTTP_ERR_OK;
+}
+
+//////////////////// BEGIN: Workers ////////////////////
+static void *_worker_run(void *arg) {
+    HTTP_Worker *w = arg;
+    HTTP_Server *s = w->s;
+
+    pthread_mutex_lock(&s->_queue_lock);
+    for (;;) {
+        while (!s->_stopping && s->_ready_head == NULL) pthread_cond_wait(&s->_queue_cond, &s->_queue_lock);
+        if (s->_stopping) break;
+        HTTP_Conn *c = s->_ready_head;
+        s->_ready_head = c->next;
+        if (s->_ready_head == NULL) s->_ready_tail = NULL;
+        pthread_mutex_unlock(&s->_queue_lock);
+
+        if (c->hup || !_serve_conn(s, &w->arena, c)) c->hup = true;
+
+        pthread_mutex_lock(&s->_queue_lock);
+        c->next = s->_served;
+        s->_served = c;
+        uint64_t one = 1;
+        if (write(s->_wakefd, &one, sizeof(one)) == -1) HTTP_WARN("Failed to wake up the server");
+    }
+    pthread_mutex_unlock(&s->_queue_lock);
+
+    http_buffer_pool_flush_thread(&s->_pool);
+    return NULL;
+}
+
+/**
+ * Starts the workers of server `s`.
+ */
+static HTTP_Err _workers_start(HTTP_Server *s) {
+    size_t n = s->workers;
+    // Only the workers, that were actually started, are stopped on failure
+    s->workers = 0;
+    s->_stopping = false;
+
+    s->_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (s->_wakefd == -1) return HTTP_ERR_FAILED_SOCK;
+    plex epoll_event ev = { .events = EPOLLIN, .data.ptr = &s->_wakefd };
+    if (epoll_ctl(s->_epollfd, EPOLL_CTL_ADD, s->_wakefd, &ev) == -1) return HTTP_ERR_BAD_SOCK;
+
+    s->_workers = calloc(n, sizeof(HTTP_Worker));
+    if (s->_workers == NULL) return HTTP_ERR_OOM;
+    for (; s->workers < n; s->workers++) {
+        HTTP_Worker *w = &s->_workers[s->workers];
+        w->s = s;
+        if (s->use_arena) http_arena_init(&w->arena, s->arena_chunk_sz);
+        if (pthread_create(&w->thread, NULL, _worker_run, w) != 0) return HTTP_ERR_OOM;
+    }
+    return HTTP_ERR_OK;
+}
+
+/**
+ * Stops the workers of server `s`, waiting for them to finish the
+ * connections, they are serving. Connections, that are left in the queues,
+ * are moved to the idle list, so they're closed with the server.
+ */
+static void _workers_stop(HTTP_Server *s) {
+    pthread_mutex_lock(&s->_queue_lock);
+    s->_stopping = true;
+    pthread_cond_broadcast(&s->_queue_cond);
+    pthread_mutex_unlock(&s->_queue_lock);
+    for (size_t i = 0; i < s->workers; i++) {
+        pthread_join(s->_workers[i].thread, NULL);
+        http_arena_free(&s->_workers[i].arena);
+    }
+    free(s->_workers);
+    s->_workers = NULL;
+
+    HTTP_Conn *lists[] = { s->_ready_head, s->_served };
+    for (size_t i = 0; i < sizeof(lists)/sizeof(lists[0]); i++) {
+        HTTP_Conn *c = lists[i];
+        while (c != NULL) {
+            HTTP_Conn *next = c->next;
+            _idle_append(s, c);
+            c = next;
+        }
+    }
+    s->_ready_head = s->_ready_tail = s->_served = NULL;
+}
+
+/**
+ * Passes readable connection `c` of server `s` to the workers.
+ */
+static void _workers_dispatch(HTTP_Server *s, HTTP_Conn *c) {
+    c->next = NULL;
+    pthread_mutex_lock(&s->_queue_lock);
+    if (s->_ready_tail) s->_ready_tail->next = c;
+    else s->_ready_head = c;
+    s->_ready_tail = c;
+    pthread_cond_signal(&s->_queue_cond);
+    pthread_mutex_unlock(&s->_queue_lock);
+}
+
+/**
+ * Polls the connections of server `s`, that were served by the workers,
+ * again, or closes them.
+ */
+static void _workers_collect(HTTP_Server *s) {
+    uint64_t n;
+    if (read(s->_wakefd, &n, sizeof(n)) == -1 && errno != EAGAIN) HTTP_WARN("Failed to read wake-ups");
+
+    pthread_mutex_lock(&s->_queue_lock);
+    HTTP_Conn *c = s->_served;
+    s->_served = NULL;
+    pthread_mutex_unlock(&s->_queue_lock);
+
+    bool released = false;
+    while (c != NULL) {
+        HTTP_Conn *next = c->next;
+        if (c->hup) {
+            _conn_close(s, c);
+            released = true;
+        } else if (c->paused) {
+            _conn_pause(s, c);
+            _idle_append(s, c);
+        } else {
+            plex epoll_event ev = { .events = _conn_events(s), .data.ptr = c };
+            epoll_ctl(s->_epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+            _idle_append(s, c);
+            released = true;
+        }
+        c = next;
+    }
+    // Some buffers were released, so paused connections may proceed
+    if (released && s->_conns_paused > 0) _resume_paused_conns(s);
+}
+//////////////////// END:   Workers ////////////////////
+
+#ifndef HTTP_SERVER_MAX_EVENTS
+#  define HTTP_SERVER_MAX_EVENTS 64
+#endif // HTTP_SERVER_MAX_EVENTS
+
+HTTP_Err http_server_run(HTTP_Server *s) {
+    HTTP_Err err;
+
+    if (s->use_arena) http_arena_init(&s->_arena, s->arena_chunk_sz);
+    for (size_t i = 0; i < s->_handlers.len && s->cache_max_sz > 0; i++) {
+        HTTP_Handler *h = &s->_handlers.items[i];
+        if ((h->opts.cache_ttl <= 0 && h->file_path == NULL) || s->_cache.nshards > 0) continue;
+        if ((err = http_cache_init(&s->_cache, s->cache_max_sz, HTTP_CACHE_SHARDS))) return err;
+    }
+    http_da_reset(&s->_common_head);
+    for (size_t i = 0; i < s->common_headers.len; i++) {
+        HTTP_Header *h = &s->common_headers.items[i];
+        http_sb_append_format(&s->_common_head, "%s: %s\r\n", h->k, h->v);
+    }
+    if ((err = http_buffer_pool_init(&s->_pool, s->recv_buf_sz, s->pool_max_sz))) return err;
+    s->_pool.hugepages = s->pool_hugepages;
+    // Decided once, before the workers read the option
+    if (s->mirrored_buffers) {
+        IO_Buffer probe = {0};
+        IO_Err ioerr = io_buffer_init_mirrored(&probe, s->recv_buf_sz);
+        if (ioerr == IO_ERR_OK) io_buffer_free(&probe);
+        if (ioerr == IO_ERR_UNSUPPORTED) {
+            HTTP_WARN("Mirrored buffers are not supported, falling back to regular ones");
+            s->mirrored_buffers = false;
+        }
+    }
+#ifndef HTTP_WITH_ZLIB
+    // Precompressed variants (e.g. `.gz` files) are still served
+    if (s->compress) HTTP_WARN("Compression is not compiled in (define HTTP_WITH_ZLIB), sending responses as is");
+    if (s->decompress) HTTP_WARN("Compression is not compiled in (define HTTP_WITH_ZLIB), passing request bodies as is");
+#endif // HTTP_WITH_ZLIB
+    size_t max_free = s->workers > HTTP_COMPRESS_POOL_MAX ? s->workers : HTTP_COMPRESS_POOL_MAX;
+    if (s->compress && (err = http_compressor_pool_init(&s->_compressors, s->compress_level, max_free))) return err;
+    if (s->decompress && (err = http_decompressor_pool_init(&s->_decompressors, max_free))) return err;
+    if (s->metrics && s->_route_names == NULL) {
+        if ((err = http_metrics_init(&s->_metrics, s->_handlers.len + 1))) return err;
+        if ((s->_route_names = calloc(s->_handlers.len + 1, sizeof(*s->_route_names))) == NULL) {
+            http_metrics_free(&s->_metrics);
+            return HTTP_ERR_OOM;
+        }
+        for (size_t i = 0; i < s->_handlers.len; i++) s->_route_names[i] = s->_handlers.items[i].route;
+    }
+    if (s->access_log && !s->_access_log._started &&
+        (err = http_access_log_init(&s->_access_log, s->access_log_fd, s->access_log_sample, HTTP_AccessLog_TEXT)))
+        return err;
+    if (s->trace_fd >= 0 && !s->_trace._started) {
+        if ((err = http_access_log_init(&s->_trace, s->trace_fd, s->trace_sample, HTTP_AccessLog_TRACE))) return err;
+        s->phases = true;
+    }
+
+    s->_epollfd = epoll_create1(0);
+    if (s->_epollfd == -1) return HTTP_ERR_FAILED_SOCK;
+    plex epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(s->_epollfd, EPOLL_CTL_ADD, s->_sockfd, &ev) == -1) return HTTP_ERR_BAD_SOCK;
+    if (s->workers > 0 && (err = _workers_start(s))) {
+        _workers_stop(s);
+        return err;
     }
 
+    plex epoll_event events[HTTP_SERVER_MAX_EVENTS];
+    for (;should_run;)  {
+        int n = epoll_wait(s->_epollfd, events, HTTP_SERVER_MAX_EVENTS, 1000);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return HTTP_ERR_FAILED_SOCK;
+        }
+
+        for (int i = 0; i < n && should_run; i++) {
+            HTTP_Conn *c = events[i].data.ptr;
+            if (c == NULL) {
+                if ((err = _accept_conn(s)) && should_run)
+                    HTTP_WARN("Failed to accept connection: %s", http_err_to_cstr(err));
+                continue;
+            }
+            if (events[i].data.ptr == &s->_wakefd) {
+                _workers_collect(s);
+                continue;
+            }
+
+            _idle_remove(s, c);
+            if (s->workers > 0) {
+                c->hup = events[i].events & (EPOLLERR | EPOLLHUP);
+                _workers_dispatch(s, c);
+                continue;
+            }
+            bool paused = false;
+            if (events[i].events & (EPOLLERR | EPOLLHUP) || !_serve_conn(s, &s->_arena, c)) {
+                _conn_close(s, c);
+            } else {
+                if ((paused = c->paused)) _conn_pause(s, c);
+                _idle_append(s, c);
+            }
+            // The buffer is released, so paused connections may proceed
+            if (!paused && s->_conns_paused > 0) _resume_paused_conns(s);
+        }
+
+        _close_expired_conns(s);
+    }
+
+    if (s->workers > 0) _workers_stop(s);
     return HTTP_ERR_OK;
 }
 
 HTTP_Err http_server_free(HTTP_Server *s) {
-    for (size_t i = 0; i < s->_handlers.len; i++)
+    for (size_t i = 0; i < s->_handlers.len; i++) {
         http_pattern_free(&s->_handlers.items[i].pattern);
+        HTTP_Handler *h = &s->_handlers.items[i];
+        if (h->static_resp.data) HTTP_FREE(h->static_resp.data);
+        if (h->static_gz.data) HTTP_FREE(h->static_gz.data);
+        if (h->file_path) HTTP_FREE(h->file_path);
+        if (h->file_type) HTTP_FREE(h->file_type);
+        if (h->route) HTTP_FREE(h->route);
+    }
     http_da_free(&s->_handlers);
+
+    while (s->_idle_head) {
+        HTTP_Conn *c = s->_idle_head;
+        _idle_remove(s, c);
+        _conn_close(s, c);
+    }
+    if (s->_pool.buf_sz > 0) http_buffer_pool_free(&s->_pool);
+    if (s->_cache.nshards > 0) http_cache_free(&s->_cache);
+    if (s->compress) http_compressor_pool_free(&s->_compressors);
+    if (s->decompress) http_decompressor_pool_free(&s->_decompressors);
+    if (s->_route_names) {
+        http_metrics_free(&s->_metrics);
+        free(s->_route_names);
+        s->_route_names = NULL;
+    }
+    // The records of the last requests are written first
+    http_access_log_free(&s->_access_log);
+    http_access_log_free(&s->_trace);
+    if (s->_epollfd != -1) close(s->_epollfd);
+    if (s->_wakefd != -1) close(s->_wakefd);
+    pthread_mutex_destroy(&s->_queue_lock);
+    pthread_cond_destroy(&s->_queue_cond);
+    pthread_mutex_destroy(&s->_flights_lock);
+    pthread_cond_destroy(&s->_flights_cond);
+    http_sb_free(&s->_common_head);
+    for (size_t i = 0; i < HTTP_SERVER_CANNED_MAX; i++) {
+        HTTP_FREE(s->_canned[i].data);
+        HTTP_FREE(s->_canned[i].data_close);
+    }
+
+    http_arena_free(&s->_arena);
     return HTTP_ERR_OK;
 }
 
@@ -52,6 +52,12 @@ HTTP_Err http_sock_create_and_listen(int *sockfd, const char *addr_repr);
  */
 HTTP_Err http_sock_accept_conn(int sockfd, int *connfd,
                                char *peer_addr_repr, size_t peer_addr_repr_len);
+/**
+ * Makes blocking reads from socket `sockfd` fail, if no data arrives within
+ * `timeout_ms` milliseconds. 0 means reads never time out.
+ */
+HTTP_Err http_sock_set_recv_timeout(int sockfd, int timeout_ms);
+
 /**
  * Closes opened socket `sockfd`.
  */
@@ -73,6 +79,7 @@ HTTP_Err http_sock_get_repr(int sockfd, char *dest, size_t n, bool is_remote);
 #include <errno.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #include "common.h"
@@ -104,7 +111,7 @@ static HTTP_Err _parse_addr_repr(const char *addr_repr, char **host, char **port
     if (addr_repr_len == 0) {
     default_addr:
         *host = NULL;
-        *port = strdup("http");
+        *port = HTTP_STRDUP("http");
         return HTTP_ERR_OK;
     }
 
@@ -129,8 +136,8 @@ static HTTP_Err _parse_addr_repr(const char *addr_repr, char **host, char **port
             || addr_repr[cb_pos + 1] != ':'
             ) return HTTP_ERR_BAD_ADDR;
         if (cb_pos <= 1) return HTTP_ERR_BAD_ADDR;
-        *host = strndup(addr_repr + 1, cb_pos - 1);
-        *port = strndup(addr_repr + cb_pos + 2, addr_repr_len - cb_pos - 2);
+        *host = HTTP_STRNDUP(addr_repr + 1, cb_pos - 1);
+        *port = HTTP_STRNDUP(addr_repr + cb_pos + 2, addr_repr_len - cb_pos - 2);
     } else {
         // IPv4 or ":8080"
         int colon_pos = -1;
@@ -142,8 +149,8 @@ static HTTP_Err _parse_addr_repr(const char *addr_repr, char **host, char **port
         }
         if (colon_pos == -1 || addr_repr_len <= colon_pos + 1) return HTTP_ERR_BAD_ADDR;
         if (colon_pos == 0) *host = NULL;
-        else *host = strndup(addr_repr, colon_pos);
-        *port = strndup(addr_repr + colon_pos + 1, addr_repr_len - colon_pos - 1);
+        else *host = HTTP_STRNDUP(addr_repr, colon_pos);
+        *port = HTTP_STRNDUP(addr_repr + colon_pos + 1, addr_repr_len - colon_pos - 1);
     }
 
     return HTTP_ERR_OK;
@@ -218,8 +225,8 @@ HTTP_Err http_sock_create_and_listen(int *sockfd, const char *addr_repr) {
     if ((err = _parse_addr_repr(addr_repr, &host, &port))) return err;
     if ((err = _hp_to_sa(host, port, &addr, &addr_len))) return err;
 
-    free(host);
-    free(port);
+    HTTP_FREE(host);
+    HTTP_FREE(port);
 
     *sockfd = socket(addr->sa_family, SOCK_STREAM, 0);
     if (*sockfd == -1) return HTTP_ERR_FAILED_SOCK;
@@ -258,6 +265,12 @@ HTTP_Err http_sock_accept_conn(int sockfd, int *connfd,
     return HTTP_ERR_OK;
 }
 
+HTTP_Err http_sock_set_recv_timeout(int sockfd, int timeout_ms) {
+    plex timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1) return HTTP_ERR_BAD_SOCK;
+    return HTTP_ERR_OK;
+}
+
 HTTP_Err http_sock_close(int sockfd) {
     if (!close(sockfd)) return HTTP_ERR_BAD_SOCK;
     return HTTP_ERR_OK;
@@ -245,7 +245,7 @@ static HTTP_Err _parse_url(HTTP_URL *url, char *s, size_t slen, HTTP_URL_PARSE_S
         if (_parse_scheme(s, slen, &off, &len)) {
             size_t pos = off + len;
             HTTP_ASSERT(pos < slen && s[pos] == ':' && "_parse_url - _parse_scheme");
-            url->scheme = strndup(s + off, len);
+            url->scheme = HTTP_STRNDUP(s + off, len);
             if (url->scheme == NULL) return HTTP_ERR_OOM;
             return _parse_url(url, s + pos + 1, slen - pos - 1, HTTP_UPS_HIERPART);
         }
@@ -259,7 +259,7 @@ static HTTP_Err _parse_url(HTTP_URL *url, char *s, size_t slen, HTTP_URL_PARSE_S
             if (_parse_userinfo(s, slen, &off, &len)) {
                     size_t pos = off + len;
                     HTTP_ASSERT(pos < slen && s[pos] == '@' && "_parse_url - _parse_userinfo");
-                    url->userinfo = strndup(s + off, len);
+                    url->userinfo = HTTP_STRNDUP(s + off, len);
                     if (url->userinfo == NULL) return HTTP_ERR_OOM;
                     return _parse_url(url, s + pos + 1, slen - pos - 1, HTTP_UPS_HOST);
                 }
@@ -276,17 +276,17 @@ static HTTP_Err _parse_url(HTTP_URL *url, char *s, size_t slen, HTTP_URL_PARSE_S
             if (!_parse_ipv6(s, slen, &off, &len)) return HTTP_ERR_FAILED_PARSE;
             size_t pos = off + len;
             HTTP_ASSERT(pos < slen && s[pos] == ']' && "_parse_url - _parse_ipv6");
-            url->host = strndup(s + off, len);
+            url->host = HTTP_STRNDUP(s + off, len);
             if (url->host == NULL) return HTTP_ERR_OOM;
             return _parse_url(url, s + pos + 1, slen - pos - 1, HTTP_UPS_PORT);
         }
         if (_parse_ipv4(s, slen, &off, &len)) {
-            url->host = strndup(s + off, len);
+            url->host = HTTP_STRNDUP(s + off, len);
             if (url->host == NULL) return HTTP_ERR_OOM;
             return _parse_url(url, s + off + len, slen - off - len, HTTP_UPS_PORT);
         }
         if (_parse_regname(s, slen, &off, &len)) {
-            url->host = strndup(s + off, len);
+            url->host = HTTP_STRNDUP(s + off, len);
             if (url->host == NULL) return HTTP_ERR_OOM;
             return _parse_url(url, s + off + len, slen - off - len, HTTP_UPS_PORT);
         }
@@ -294,7 +294,7 @@ static HTTP_Err _parse_url(HTTP_URL *url, char *s, size_t slen, HTTP_URL_PARSE_S
     }
     case HTTP_UPS_PORT: {
         if (_parse_port(s, slen, &off, &len)) {
-            url->port = strndup(s + off, len);
+            url->port = HTTP_STRNDUP(s + off, len);
             if (url->port == NULL) return HTTP_ERR_OOM;
         }
         return _parse_url(url, s + off + len, slen - off - len, HTTP_UPS_PATH);
@@ -303,21 +303,21 @@ static HTTP_Err _parse_url(HTTP_URL *url, char *s, size_t slen, HTTP_URL_PARSE_S
     //       path-noscheme, path-rootless or path-empty
     case HTTP_UPS_PATH: {
         if (_parse_path(s, slen, &off, &len)) {
-            url->path = strndup(s + off, len);
+            url->path = HTTP_STRNDUP(s + off, len);
             if (url->path == NULL) return HTTP_ERR_OOM;
         }
         return _parse_url(url, s + off + len, slen - off - len, HTTP_UPS_QUERY);
     }
     case HTTP_UPS_QUERY: {
         if (*s == '?' && _parse_query_fragment(s, slen, &off, &len)) {
-            url->query = strndup(s + off, len);
+            url->query = HTTP_STRNDUP(s + off, len);
             if (url->query == NULL) return HTTP_ERR_OOM;
         }
         return _parse_url(url, s + off + len, slen - off - len, HTTP_UPS_FRAGMENT);
     }
     case HTTP_UPS_FRAGMENT: {
         if (_parse_query_fragment(s, slen, &off, &len)) {
-            url->fragment = strndup(s + off, len);
+            url->fragment = HTTP_STRNDUP(s + off, len);
             if (url->fragment == NULL) return HTTP_ERR_OOM;
         }
         return _parse_url(url, s + off + len, slen - off - len, HTTP_UPS_MAX);
@@ -335,13 +335,13 @@ HTTP_Err http_url_parse(HTTP_URL *url, char *s, size_t slen) {
 }
 
 HTTP_Err http_url_free(HTTP_URL *url) {
-    if(url->scheme) free(url->scheme);
-    if(url->host) free(url->host);
-    if(url->port) free(url->port);
-    if(url->path) free(url->path);
-    if(url->query) free(url->query);
-    if(url->fragment) free(url->fragment);
-    if(url->userinfo) free(url->userinfo);
+    if(url->scheme) HTTP_FREE(url->scheme);
+    if(url->host) HTTP_FREE(url->host);
+    if(url->port) HTTP_FREE(url->port);
+    if(url->path) HTTP_FREE(url->path);
+    if(url->query) HTTP_FREE(url->query);
+    if(url->fragment) HTTP_FREE(url->fragment);
+    if(url->userinfo) HTTP_FREE(url->userinfo);
 
     return HTTP_ERR_OK;
 }